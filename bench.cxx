@@ -0,0 +1,420 @@
+// Benchmark for the pure code of both tools (bench <results> [--baseline
+// <file>]). From hotkeys: key lookup, shortcut name and manifest parsing and
+// the sequence matcher, on generated input that's partly malformed. From
+// volumeicon: drawing the digits and rendering every icon level in each
+// color theme and on each raster path. Writes one "name nanoseconds_per_op"
+// line per benchmark; with a baseline in the same format it fails (exit
+// code 1) when anything is bench_threshold slower.
+
+#define UNICODE
+#define NOMINMAX
+
+#include <windows.h>
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+
+#include "keys.h"
+#include "matcher.h"
+#include "manifest.h"
+#include "icons.h"
+
+static const int bench_names = 100000;
+static const int bench_runs = 5;
+static const double bench_threshold = 0.2;
+
+struct BenchResult
+{
+	const char *name;
+	double ns;
+};
+
+static volatile unsigned bench_sink = 0;
+
+template <class F>
+double bench_ns(size_t ops, F f)
+{
+	double best = 0;
+
+	for (int run = 0; run < bench_runs; run++)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		f();
+		double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ops;
+
+		if (run == 0 || ns < best)
+			best = ns;
+	}
+
+	return best;
+}
+
+// Shortcut names as they'd be found in a big hotkeys directory, with one in
+// four malformed: unknown keys, repeated modifiers, missing parts, no .lnk.
+
+std::vector<std::wstring> bench_filenames()
+{
+	static const wchar_t *modifiers[] = { L"ctrl+", L"alt+", L"shift+", L"win+" };
+	static const wchar_t *junk[] = { L"f25", L"VK_Q", L"ctrl", L"+", L"numpad", L"escape!" };
+
+	std::vector<std::wstring> names;
+	unsigned seed = 1;
+
+	auto next = [&seed]() {
+		seed = seed * 1103515245 + 12345;
+		return seed >> 8;
+	};
+
+	for (int i = 0; i < bench_names; i++)
+	{
+		std::wstring name;
+		unsigned kind = next() % 4;
+		unsigned mods = 1 + next() % 15;
+
+		for (int m = 0; m < 4; m++)
+		{
+			if (mods & (1 << m))
+				name += modifiers[m];
+		}
+
+		if (kind == 0)
+		{
+			switch (next() % 4)
+			{
+				case 0: name += junk[next() % 6]; break;
+				case 1: name += modifiers[next() % 4]; name += L"a"; break;
+				case 2: name.clear(); break;
+				default: name += L"x"; break;
+			}
+		}
+		else
+		{
+			name += (next() % 2) ? std::wstring(1, (wchar_t)(L'A' + next() % 26)) : std::wstring(key_map[next() % key_count].name + 3);
+		}
+
+		wchar_t title[32];
+		swprintf(title, 32, L" Application %u", next() % 10000);
+		name += title;
+		name += (kind == 0 && next() % 2) ? L".txt" : L".lnk";
+
+		names.push_back(name);
+	}
+
+	return names;
+}
+
+void bench_hotkeys(std::vector<BenchResult> &results)
+{
+	std::vector<std::wstring> filenames = bench_filenames();
+	std::vector<std::wstring> keys;
+
+	for (int i = 0; i < key_count; i++)
+	{
+		keys.push_back(key_map[i].name + 3);
+		keys.push_back(std::wstring(key_map[i].name + 3) + L"X");
+	}
+
+	for (int i = 0; i < 26; i++)
+		keys.push_back(std::wstring(1, (wchar_t)(L'a' + i)));
+
+	BenchResult map = { "map_key", bench_ns(keys.size() * 100, [&]() {
+		for (int n = 0; n < 100; n++)
+		{
+			for (int i = 0; i < keys.size(); i++)
+				bench_sink += map_key(keys[i].c_str(), (int)keys[i].size());
+		}
+	}) };
+
+	BenchResult linear = { "map_key_linear", bench_ns(keys.size() * 100, [&]() {
+		for (int n = 0; n < 100; n++)
+		{
+			for (int i = 0; i < keys.size(); i++)
+				bench_sink += map_key_linear(keys[i].c_str(), (int)keys[i].size());
+		}
+	}) };
+
+	BenchResult parse = { "parse_filename", bench_ns(filenames.size(), [&]() {
+		for (int i = 0; i < filenames.size(); i++)
+		{
+			UINT modifiers = 0, vk = 0;
+			bench_sink += parse_filename(filenames[i].c_str(), &modifiers, &vk) ? vk : 0;
+		}
+	}) };
+
+	BenchResult names = { "key_name", bench_ns(256 * 1000, [&]() {
+		for (int n = 0; n < 1000; n++)
+		{
+			for (UINT vk = 0; vk < 256; vk++)
+			{
+				const wchar_t *name = 0;
+				bench_sink += key_name(vk, &name);
+			}
+		}
+	}) };
+
+	// hook mode matcher: a thousand bindings of one to three steps, compiled,
+	// then fed a keystroke stream where one press in four walks a binding and
+	// the rest are random chords
+
+	std::vector<int> ids;
+	std::vector<unsigned short> steps;
+	std::vector<int> counts;
+	std::vector<int> firsts;
+	std::vector<unsigned short> strokes;
+	unsigned seed = 1;
+
+	auto next = [&seed]() {
+		seed = seed * 1103515245 + 12345;
+		return seed >> 8;
+	};
+
+	auto random_chord = [&]() {
+		return (unsigned short)(((1 + next() % 15) << 8) | key_map[next() % key_count].code);
+	};
+
+	for (int i = 0; i < bench_names / 100; i++)
+	{
+		ids.push_back(i + 1);
+		counts.push_back(1 + i % 3);
+		firsts.push_back((int)steps.size());
+
+		for (int j = 0; j < counts.back(); j++)
+			steps.push_back(random_chord());
+	}
+
+	while (strokes.size() < bench_names * 10)
+	{
+		if (next() % 4 == 0)
+		{
+			int binding = next() % ids.size();
+			strokes.insert(strokes.end(), steps.begin() + firsts[binding], steps.begin() + firsts[binding] + counts[binding]);
+		}
+		else
+		{
+			strokes.push_back(random_chord());
+		}
+	}
+
+	Matcher bench_matcher = {};
+
+	BenchResult compile = { "compile_matcher", bench_ns(ids.size(), [&]() {
+		compile_matcher(bench_matcher, ids, steps, counts);
+	}) };
+
+	BenchResult match = { "match_key", bench_ns(strokes.size(), [&]() {
+		for (int i = 0; i < strokes.size(); i++)
+			bench_sink += match_key(bench_matcher, strokes[i] >> 8, strokes[i] & 0xFF, (unsigned)i);
+	}) };
+
+	// a manifest of bench_names lines: quoted and bare targets, arguments,
+	// comments, blank lines and one in eight malformed
+
+	std::string manifest;
+
+	for (int i = 0; i < bench_names; i++)
+	{
+		char line[160];
+		const wchar_t *key = key_map[next() % key_count].name + 3;
+		char chord[64];
+
+		snprintf(chord, sizeof(chord), "ctrl+alt+%ls", key);
+
+		switch (next() % 8)
+		{
+			case 0: snprintf(line, sizeof(line), "# %s launches application %d\n", chord, i); break;
+			case 1: snprintf(line, sizeof(line), "\r\n"); break;
+			case 2: snprintf(line, sizeof(line), "%s \"C:\\Program Files\\App %d\\app.exe\n", chord, i); break;
+			case 3: snprintf(line, sizeof(line), "%s = notepad.exe C:\\Notes\\%d.txt\r\n", chord, i); break;
+			default: snprintf(line, sizeof(line), "%s = \"C:\\Program Files\\App %d\\app.exe\" --profile %d\r\n", chord, i, i); break;
+		}
+
+		manifest += line;
+	}
+
+	BenchResult manifest_parse = { "parse_manifest", bench_ns(bench_names, [&]() {
+		std::vector<HotKey> found;
+		std::vector<wchar_t> arena(1, 0);
+		std::vector<ManifestError> errors;
+
+		parse_manifest((const unsigned char*)manifest.data(), manifest.size(), found, arena, errors);
+		bench_sink += (unsigned)found.size();
+	}) };
+
+	results.push_back(map);
+	results.push_back(linear);
+	results.push_back(parse);
+	results.push_back(names);
+	results.push_back(compile);
+	results.push_back(match);
+	results.push_back(manifest_parse);
+}
+
+void bench_icons(std::vector<BenchResult> &results)
+{
+	static const char *path_names[] = { "render_icon_48_scalar", "render_icon_48_sse2", "render_icon_48_avx2" };
+	static DWORD buffer[48 * 48];
+
+	const int themes = sizeof(icon_themes) / sizeof(icon_themes[0]);
+	const int paths = DetectRasterPath() + 1;
+	DWORD saved_fore = fore, saved_back = back;
+	WORD rows[ICON_GRID] = {};
+
+	BenchResult digits = { "draw_number", bench_ns(10000 * 10, [&]() {
+		for (int n = 0; n < 10000; n++)
+		{
+			for (int digit = 0; digit < 10; digit++)
+				draw_number(rows, 4, digit);
+
+			bench_sink += rows[4];
+		}
+	}) };
+
+	BenchResult render = { "render_icon", bench_ns(100 * themes * ICON_LEVELS, [&]() {
+		for (int n = 0; n < 100; n++)
+		{
+			for (int t = 0; t < themes; t++)
+			{
+				fore = icon_themes[t][0];
+				back = icon_themes[t][1];
+
+				for (int i = 0; i < ICON_LEVELS; i++)
+				{
+					RenderIcon(buffer, 16, i);
+					bench_sink += buffer[4 * 16 + 10];
+				}
+			}
+		}
+	}) };
+
+	fore = saved_fore;
+	back = saved_back;
+
+	results.push_back(digits);
+	results.push_back(render);
+
+	// 48 px is 300% scaling, on every raster path the CPU has
+	for (int path = 0; path < paths; path++)
+	{
+		raster_path = path;
+
+		BenchResult large = { path_names[path], bench_ns(20 * ICON_LEVELS, [&]() {
+			for (int n = 0; n < 20; n++)
+			{
+				for (int i = 0; i < ICON_LEVELS; i++)
+				{
+					RenderIcon(buffer, 48, i);
+					bench_sink += buffer[12 * 48 + 30];
+				}
+			}
+		}) };
+
+		results.push_back(large);
+	}
+
+	raster_path = paths - 1;
+}
+
+bool read_text(const char *filename, std::string &text)
+{
+	FILE *file = fopen(filename, "rb");
+
+	if (file == 0)
+		return false;
+
+	char chunk[4096];
+	size_t count = 0;
+
+	while ((count = fread(chunk, 1, sizeof(chunk), file)) != 0)
+		text.append(chunk, count);
+
+	fclose(file);
+	return true;
+}
+
+bool write_text(const char *filename, const std::string &text)
+{
+	FILE *file = fopen(filename, "wb");
+
+	if (file == 0)
+		return false;
+
+	bool ok = fwrite(text.data(), 1, text.size(), file) == text.size();
+	return fclose(file) == 0 && ok;
+}
+
+int main(int argc, char **argv)
+{
+	const char *results_path = 0;
+	const char *baseline_path = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+			baseline_path = argv[++i];
+		else
+			results_path = argv[i];
+	}
+
+	if (results_path == 0)
+	{
+		fprintf(stderr, "usage: bench <results> [--baseline <file>]\n");
+		return 1;
+	}
+
+	std::vector<BenchResult> results;
+
+	bench_hotkeys(results);
+	bench_icons(results);
+
+	std::string text;
+	char line[128];
+
+	for (int i = 0; i < results.size(); i++)
+	{
+		snprintf(line, sizeof(line), "%s %.2f\n", results[i].name, results[i].ns);
+		text += line;
+	}
+
+	fputs(text.c_str(), stdout);
+
+	if (!write_text(results_path, text))
+	{
+		fprintf(stderr, "bench: can't write %s\n", results_path);
+		return 1;
+	}
+
+	std::string baseline;
+
+	if (baseline_path == 0)
+		return 0;
+
+	if (!read_text(baseline_path, baseline))
+	{
+		fprintf(stderr, "bench: can't read %s\n", baseline_path);
+		return 1;
+	}
+
+	int regressions = 0;
+
+	for (const char *p = baseline.c_str(); *p != 0; p = strchr(p, '\n') ? strchr(p, '\n') + 1 : p + strlen(p))
+	{
+		char name[64];
+		double ns = 0;
+
+		if (sscanf(p, "%63s %lf", name, &ns) != 2)
+			continue;
+
+		for (int i = 0; i < results.size(); i++)
+		{
+			if (strcmp(results[i].name, name) == 0 && results[i].ns > ns * (1 + bench_threshold))
+			{
+				printf("regression %s %.2f (baseline %.2f)\n", name, results[i].ns, ns);
+				regressions++;
+			}
+		}
+	}
+
+	return regressions != 0 ? 1 : 0;
+}
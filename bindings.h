@@ -0,0 +1,94 @@
+#pragma once
+
+#include <windows.h>
+#include <vector>
+#include <string>
+
+// The binding table's types, and the little endian reads and writes the
+// file formats (.lnk, PE images, the snapshot) share.
+
+// A parsed .lnk, or a binding's link put together from the names arena for
+// a launch.
+
+struct Shortcut
+{
+	std::wstring target;
+	std::wstring arguments;
+	std::wstring directory;
+	int show;
+	bool expand; // target has environment variables
+};
+
+// Paths aren't stored per binding: a HotKey has the index of its root and
+// the offset of its path below that root in the names arena, which is
+// rebuilt on every reload. Offset 0 is an empty name and marks a free slot.
+// The link's strings live in the same arena, where offset 0 is an empty
+// string.
+
+struct HotKey
+{
+	int id;
+	UINT modifiers;
+	UINT vk;
+	int root;
+	unsigned name;
+	unsigned long long mtime;
+	bool resolved; // the link was parsed and the target can be launched directly
+	bool manifest; // from the manifest, name is the target
+	bool expand; // target has environment variables
+	int show;
+	unsigned target;
+	unsigned arguments;
+	unsigned directory;
+};
+
+struct DirStamp
+{
+	std::wstring path;
+	unsigned long long mtime;
+};
+
+unsigned read_u16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+unsigned read_u32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+unsigned long long read_u64(const unsigned char *p)
+{
+	return read_u32(p) | ((unsigned long long)read_u32(p + 4) << 32);
+}
+
+void write_u32(std::vector<unsigned char> &out, unsigned value)
+{
+	for (int i = 0; i < 4; i++)
+		out.push_back((unsigned char)(value >> (i * 8)));
+}
+
+void write_u64(std::vector<unsigned char> &out, unsigned long long value)
+{
+	write_u32(out, (unsigned)value);
+	write_u32(out, (unsigned)(value >> 32));
+}
+
+// Appends s to the arena and returns its offset; the empty string is 0.
+unsigned add_string(std::vector<wchar_t> &arena, const wchar_t *s, size_t length)
+{
+	if (length == 0)
+		return 0;
+
+	unsigned offset = (unsigned)arena.size();
+	arena.insert(arena.end(), s, s + length);
+	arena.push_back(0);
+
+	return offset;
+}
+
+unsigned copy_string(std::vector<wchar_t> &to, const std::vector<wchar_t> &from, unsigned offset)
+{
+	return add_string(to, &from[offset], wcslen(&from[offset]));
+}
@@ -0,0 +1,75 @@
+// Stand-in for the CComPtr part of ATL outside Windows.
+
+#pragma once
+
+#include <objbase.h>
+
+template <class T>
+class CComPtr
+{
+public:
+	T *p;
+
+	CComPtr() : p(0)
+	{
+	}
+
+	CComPtr(T *other) : p(other)
+	{
+		if (p != 0)
+			p->AddRef();
+	}
+
+	CComPtr(const CComPtr &other) : CComPtr(other.p)
+	{
+	}
+
+	~CComPtr()
+	{
+		Release();
+	}
+
+	CComPtr &operator=(T *other)
+	{
+		if (other != 0)
+			other->AddRef();
+
+		Release();
+		p = other;
+		return *this;
+	}
+
+	CComPtr &operator=(const CComPtr &other)
+	{
+		return *this = other.p;
+	}
+
+	void Release()
+	{
+		T *old = p;
+		p = 0;
+
+		if (old != 0)
+			old->Release();
+	}
+
+	HRESULT CoCreateInstance(REFCLSID clsid, IUnknown *outer = 0, DWORD context = CLSCTX_ALL)
+	{
+		return ::CoCreateInstance(clsid, outer, context, __uuidof(T), (void**)&p);
+	}
+
+	operator T*() const
+	{
+		return p;
+	}
+
+	T *operator->() const
+	{
+		return p;
+	}
+
+	T **operator&()
+	{
+		return &p;
+	}
+};
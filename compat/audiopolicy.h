@@ -0,0 +1,83 @@
+// Stand-in for <audiopolicy.h> outside Windows: the session interfaces the
+// peak meter watches, in vtable order.
+
+#pragma once
+
+#include <objbase.h>
+
+enum AudioSessionState
+{
+	AudioSessionStateInactive,
+	AudioSessionStateActive,
+	AudioSessionStateExpired
+};
+
+enum AudioSessionDisconnectReason
+{
+	DisconnectReasonDeviceRemoval,
+	DisconnectReasonServerShutdown,
+	DisconnectReasonFormatChanged,
+	DisconnectReasonSessionLogoff,
+	DisconnectReasonSessionDisconnected,
+	DisconnectReasonExclusiveModeOverride
+};
+
+struct IAudioSessionEvents : IUnknown
+{
+	virtual HRESULT OnDisplayNameChanged(LPCWSTR NewDisplayName, LPCGUID EventContext) = 0;
+	virtual HRESULT OnIconPathChanged(LPCWSTR NewIconPath, LPCGUID EventContext) = 0;
+	virtual HRESULT OnSimpleVolumeChanged(float NewVolume, BOOL NewMute, LPCGUID EventContext) = 0;
+	virtual HRESULT OnChannelVolumeChanged(DWORD ChannelCount, float NewChannelVolumeArray[], DWORD ChangedChannel, LPCGUID EventContext) = 0;
+	virtual HRESULT OnGroupingParamChanged(LPCGUID NewGroupingParam, LPCGUID EventContext) = 0;
+	virtual HRESULT OnStateChanged(AudioSessionState NewState) = 0;
+	virtual HRESULT OnSessionDisconnected(AudioSessionDisconnectReason DisconnectReason) = 0;
+};
+
+struct IAudioSessionControl : IUnknown
+{
+	virtual HRESULT GetState(AudioSessionState *pRetVal) = 0;
+	virtual HRESULT GetDisplayName(LPWSTR *pRetVal) = 0;
+	virtual HRESULT SetDisplayName(LPCWSTR Value, LPCGUID EventContext) = 0;
+	virtual HRESULT GetIconPath(LPWSTR *pRetVal) = 0;
+	virtual HRESULT SetIconPath(LPCWSTR Value, LPCGUID EventContext) = 0;
+	virtual HRESULT GetGroupingParam(GUID *pRetVal) = 0;
+	virtual HRESULT SetGroupingParam(LPCGUID Override, LPCGUID EventContext) = 0;
+	virtual HRESULT RegisterAudioSessionNotification(IAudioSessionEvents *NewNotifications) = 0;
+	virtual HRESULT UnregisterAudioSessionNotification(IAudioSessionEvents *NewNotifications) = 0;
+};
+
+struct IAudioSessionNotification : IUnknown
+{
+	virtual HRESULT OnSessionCreated(IAudioSessionControl *NewSession) = 0;
+};
+
+struct IAudioSessionEnumerator : IUnknown
+{
+	virtual HRESULT GetCount(int *SessionCount) = 0;
+	virtual HRESULT GetSession(int SessionCount, IAudioSessionControl **Session) = 0;
+};
+
+struct ISimpleAudioVolume;
+
+struct IAudioSessionManager : IUnknown
+{
+	virtual HRESULT GetAudioSessionControl(LPCGUID AudioSessionGuid, DWORD StreamFlags, IAudioSessionControl **SessionControl) = 0;
+	virtual HRESULT GetSimpleAudioVolume(LPCGUID AudioSessionGuid, DWORD StreamFlags, ISimpleAudioVolume **AudioVolume) = 0;
+};
+
+struct IAudioVolumeDuckNotification;
+
+struct IAudioSessionManager2 : IAudioSessionManager
+{
+	virtual HRESULT GetSessionEnumerator(IAudioSessionEnumerator **SessionEnum) = 0;
+	virtual HRESULT RegisterSessionNotification(IAudioSessionNotification *SessionNotification) = 0;
+	virtual HRESULT UnregisterSessionNotification(IAudioSessionNotification *SessionNotification) = 0;
+	virtual HRESULT RegisterDuckNotification(LPCWSTR sessionID, IAudioVolumeDuckNotification *duckNotification) = 0;
+	virtual HRESULT UnregisterDuckNotification(IAudioVolumeDuckNotification *duckNotification) = 0;
+};
+
+COMPAT_UUID(IAudioSessionEvents, 0x24918ACC, 0x64B3, 0x37C1, 0x8C, 0xA9, 0x74, 0xA6, 0x6E, 0x99, 0x57, 0xA8);
+COMPAT_UUID(IAudioSessionControl, 0xF4B1A599, 0x7266, 0x4319, 0xA8, 0xCA, 0xE7, 0x0A, 0xCB, 0x11, 0xE8, 0xCD);
+COMPAT_UUID(IAudioSessionNotification, 0x641DD20B, 0x4D41, 0x49CC, 0xAB, 0xA3, 0x17, 0x4B, 0x94, 0x77, 0xBB, 0x08);
+COMPAT_UUID(IAudioSessionEnumerator, 0xE2F5BB11, 0x0570, 0x40CA, 0xAC, 0xDD, 0x3A, 0xA0, 0x12, 0x77, 0xDE, 0xE8);
+COMPAT_UUID(IAudioSessionManager2, 0x77AA99A0, 0x1BD6, 0x484F, 0x8B, 0xC7, 0x2C, 0x65, 0x4C, 0x9A, 0x9B, 0x6F);
@@ -0,0 +1,56 @@
+// Stand-in for <endpointvolume.h> outside Windows: the endpoint volume and
+// meter interfaces, in vtable order.
+
+#pragma once
+
+#include <objbase.h>
+
+struct AUDIO_VOLUME_NOTIFICATION_DATA
+{
+	GUID guidEventContext;
+	BOOL bMuted;
+	float fMasterVolume;
+	UINT nChannels;
+	float afChannelVolumes[1];
+};
+
+typedef AUDIO_VOLUME_NOTIFICATION_DATA *PAUDIO_VOLUME_NOTIFICATION_DATA;
+
+struct IAudioEndpointVolumeCallback : IUnknown
+{
+	virtual HRESULT OnNotify(PAUDIO_VOLUME_NOTIFICATION_DATA pNotify) = 0;
+};
+
+struct IAudioEndpointVolume : IUnknown
+{
+	virtual HRESULT RegisterControlChangeNotify(IAudioEndpointVolumeCallback *pNotify) = 0;
+	virtual HRESULT UnregisterControlChangeNotify(IAudioEndpointVolumeCallback *pNotify) = 0;
+	virtual HRESULT GetChannelCount(UINT *pnChannelCount) = 0;
+	virtual HRESULT SetMasterVolumeLevel(float fLevelDB, LPCGUID pguidEventContext) = 0;
+	virtual HRESULT SetMasterVolumeLevelScalar(float fLevel, LPCGUID pguidEventContext) = 0;
+	virtual HRESULT GetMasterVolumeLevel(float *pfLevelDB) = 0;
+	virtual HRESULT GetMasterVolumeLevelScalar(float *pfLevel) = 0;
+	virtual HRESULT SetChannelVolumeLevel(UINT nChannel, float fLevelDB, LPCGUID pguidEventContext) = 0;
+	virtual HRESULT SetChannelVolumeLevelScalar(UINT nChannel, float fLevel, LPCGUID pguidEventContext) = 0;
+	virtual HRESULT GetChannelVolumeLevel(UINT nChannel, float *pfLevelDB) = 0;
+	virtual HRESULT GetChannelVolumeLevelScalar(UINT nChannel, float *pfLevel) = 0;
+	virtual HRESULT SetMute(BOOL bMute, LPCGUID pguidEventContext) = 0;
+	virtual HRESULT GetMute(BOOL *pbMute) = 0;
+	virtual HRESULT GetVolumeStepInfo(UINT *pnStep, UINT *pnStepCount) = 0;
+	virtual HRESULT VolumeStepUp(LPCGUID pguidEventContext) = 0;
+	virtual HRESULT VolumeStepDown(LPCGUID pguidEventContext) = 0;
+	virtual HRESULT QueryHardwareSupport(DWORD *pdwHardwareSupportMask) = 0;
+	virtual HRESULT GetVolumeRange(float *pflVolumeMindB, float *pflVolumeMaxdB, float *pflVolumeIncrementdB) = 0;
+};
+
+struct IAudioMeterInformation : IUnknown
+{
+	virtual HRESULT GetPeakValue(float *pfPeak) = 0;
+	virtual HRESULT GetMeteringChannelCount(UINT *pnChannelCount) = 0;
+	virtual HRESULT GetChannelsPeakValues(UINT32 u32ChannelCount, float *afPeakValues) = 0;
+	virtual HRESULT QueryHardwareSupport(DWORD *pdwHardwareSupportMask) = 0;
+};
+
+COMPAT_UUID(IAudioEndpointVolumeCallback, 0x657804FA, 0xD6AD, 0x4496, 0x8A, 0x60, 0x35, 0x27, 0x52, 0xAF, 0x4F, 0x89);
+COMPAT_UUID(IAudioEndpointVolume, 0x5CDF2C82, 0x841E, 0x4546, 0x97, 0x22, 0x0C, 0xF7, 0x40, 0x78, 0x22, 0x9A);
+COMPAT_UUID(IAudioMeterInformation, 0xC02216F6, 0x8C67, 0x4B5B, 0x9D, 0x00, 0xD0, 0x08, 0xE7, 0x3E, 0x00, 0x64);
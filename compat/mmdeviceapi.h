@@ -0,0 +1,71 @@
+// Stand-in for <mmdeviceapi.h> outside Windows: the device enumerator
+// interfaces, in vtable order. MMDeviceEnumerator has no implementation.
+
+#pragma once
+
+#include <objbase.h>
+
+enum EDataFlow
+{
+	eRender,
+	eCapture,
+	eAll
+};
+
+enum ERole
+{
+	eConsole,
+	eMultimedia,
+	eCommunications
+};
+
+#define DEVICE_STATE_ACTIVE 0x1
+#define DEVICE_STATE_DISABLED 0x2
+#define DEVICE_STATE_NOTPRESENT 0x4
+#define DEVICE_STATE_UNPLUGGED 0x8
+
+struct IMMDevice : IUnknown
+{
+	virtual HRESULT Activate(REFIID iid, DWORD dwClsCtx, PROPVARIANT *pActivationParams, void **ppInterface) = 0;
+	virtual HRESULT OpenPropertyStore(DWORD stgmAccess, IPropertyStore **ppProperties) = 0;
+	virtual HRESULT GetId(LPWSTR *ppstrId) = 0;
+	virtual HRESULT GetState(DWORD *pdwState) = 0;
+};
+
+struct IMMDeviceCollection : IUnknown
+{
+	virtual HRESULT GetCount(UINT *pcDevices) = 0;
+	virtual HRESULT Item(UINT nDevice, IMMDevice **ppDevice) = 0;
+};
+
+struct IMMEndpoint : IUnknown
+{
+	virtual HRESULT GetDataFlow(EDataFlow *pDataFlow) = 0;
+};
+
+struct IMMNotificationClient : IUnknown
+{
+	virtual HRESULT OnDeviceStateChanged(LPCWSTR pwstrDeviceId, DWORD dwNewState) = 0;
+	virtual HRESULT OnDeviceAdded(LPCWSTR pwstrDeviceId) = 0;
+	virtual HRESULT OnDeviceRemoved(LPCWSTR pwstrDeviceId) = 0;
+	virtual HRESULT OnDefaultDeviceChanged(EDataFlow flow, ERole role, LPCWSTR pwstrDefaultDeviceId) = 0;
+	virtual HRESULT OnPropertyValueChanged(LPCWSTR pwstrDeviceId, const PROPERTYKEY key) = 0;
+};
+
+struct IMMDeviceEnumerator : IUnknown
+{
+	virtual HRESULT EnumAudioEndpoints(EDataFlow dataFlow, DWORD dwStateMask, IMMDeviceCollection **ppDevices) = 0;
+	virtual HRESULT GetDefaultAudioEndpoint(EDataFlow dataFlow, ERole role, IMMDevice **ppEndpoint) = 0;
+	virtual HRESULT GetDevice(LPCWSTR pwstrId, IMMDevice **ppDevice) = 0;
+	virtual HRESULT RegisterEndpointNotificationCallback(IMMNotificationClient *pClient) = 0;
+	virtual HRESULT UnregisterEndpointNotificationCallback(IMMNotificationClient *pClient) = 0;
+};
+
+class MMDeviceEnumerator;
+
+COMPAT_UUID(IMMDevice, 0xD666063F, 0x1587, 0x4E43, 0x81, 0xF1, 0xB9, 0x48, 0xE8, 0x07, 0x36, 0x3F);
+COMPAT_UUID(IMMDeviceCollection, 0x0BD7A1BE, 0x7A1A, 0x44DB, 0x83, 0x97, 0xCC, 0x53, 0x92, 0x38, 0x7B, 0x5E);
+COMPAT_UUID(IMMEndpoint, 0x1BE09788, 0x6894, 0x4089, 0x85, 0x86, 0x9A, 0x2A, 0x6C, 0x26, 0x5A, 0xC5);
+COMPAT_UUID(IMMNotificationClient, 0x7991EEC9, 0x7E89, 0x4D85, 0x83, 0x90, 0x6C, 0x70, 0x3C, 0xEC, 0x60, 0xC0);
+COMPAT_UUID(IMMDeviceEnumerator, 0xA95664D2, 0x9614, 0x4F35, 0xA7, 0x46, 0xDE, 0x8D, 0xB6, 0x36, 0x17, 0xE6);
+COMPAT_UUID(MMDeviceEnumerator, 0xBCDE0395, 0xE52F, 0x467C, 0x8E, 0x3D, 0xC4, 0x57, 0x92, 0x91, 0x69, 0x2E);
@@ -0,0 +1,75 @@
+// Stand-in for the COM base headers outside Windows. There's no COM runtime:
+// interfaces are plain abstract classes, CoCreateInstance finds no classes,
+// and only objects made in-process (the simulated audio backend) are ever
+// used through them. __uuidof looks the interface up in compat_uuid, which
+// each stand-in header fills with the real IIDs.
+
+#pragma once
+
+#include <windows.h>
+
+#define STDMETHODCALLTYPE
+#define STDMETHODIMP HRESULT
+#define STDMETHODIMP_(type) type
+#define IFACEMETHODIMP HRESULT
+#define IFACEMETHODIMP_(type) type
+
+template <class T> struct compat_uuid;
+
+#define __uuidof(type) compat_uuid<type>::id
+
+#define COMPAT_UUID(type, d1, d2, d3, b0, b1, b2, b3, b4, b5, b6, b7) \
+	template <> struct compat_uuid<type> \
+	{ \
+		static constexpr GUID id = { d1, d2, d3, { b0, b1, b2, b3, b4, b5, b6, b7 } }; \
+	}
+
+struct IUnknown
+{
+	virtual HRESULT QueryInterface(REFIID iid, void **ppv) = 0;
+	virtual ULONG AddRef() = 0;
+	virtual ULONG Release() = 0;
+};
+
+COMPAT_UUID(IUnknown, 0x00000000, 0x0000, 0x0000, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46);
+
+#define COINIT_APARTMENTTHREADED 0x2
+#define COINIT_MULTITHREADED 0x0
+#define COINIT_DISABLE_OLE1DDE 0x4
+
+#define CLSCTX_INPROC_SERVER 0x1
+#define CLSCTX_ALL 0x17
+
+inline HRESULT CoInitializeEx(void *reserved, DWORD flags)
+{
+	return S_OK;
+}
+
+inline void CoUninitialize()
+{
+}
+
+inline void *CoTaskMemAlloc(size_t size)
+{
+	return malloc(size);
+}
+
+inline void CoTaskMemFree(void *p)
+{
+	free(p);
+}
+
+inline HRESULT CoCreateInstance(REFCLSID clsid, IUnknown *outer, DWORD context, REFIID iid, void **ppv)
+{
+	*ppv = 0;
+	return REGDB_E_CLASSNOTREG;
+}
+
+struct PROPERTYKEY
+{
+	GUID fmtid;
+	DWORD pid;
+};
+
+struct PROPVARIANT;
+struct IPropertyStore;
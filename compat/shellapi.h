@@ -0,0 +1,61 @@
+// Stand-in for the notification area part of <shellapi.h> outside Windows.
+// There's no taskbar: adding an icon succeeds and shows nothing, and the
+// icon has no position for the pointer to be over.
+
+#pragma once
+
+#include <windows.h>
+
+#define NIM_ADD 0x0
+#define NIM_MODIFY 0x1
+#define NIM_DELETE 0x2
+#define NIM_SETVERSION 0x4
+
+#define NIF_MESSAGE 0x1
+#define NIF_ICON 0x2
+#define NIF_TIP 0x4
+
+#define NOTIFYICON_VERSION_4 4
+
+struct NOTIFYICONDATA
+{
+	DWORD cbSize;
+	HWND hWnd;
+	UINT uID;
+	UINT uFlags;
+	UINT uCallbackMessage;
+	HICON hIcon;
+	wchar_t szTip[128];
+	DWORD dwState;
+	DWORD dwStateMask;
+	wchar_t szInfo[256];
+	union
+	{
+		UINT uTimeout;
+		UINT uVersion;
+	};
+	wchar_t szInfoTitle[64];
+	DWORD dwInfoFlags;
+	GUID guidItem;
+	HICON hBalloonIcon;
+};
+
+typedef NOTIFYICONDATA *PNOTIFYICONDATA;
+
+struct NOTIFYICONIDENTIFIER
+{
+	DWORD cbSize;
+	HWND hWnd;
+	UINT uID;
+	GUID guidItem;
+};
+
+inline BOOL Shell_NotifyIcon(DWORD message, PNOTIFYICONDATA data)
+{
+	return TRUE;
+}
+
+inline HRESULT Shell_NotifyIconGetRect(const NOTIFYICONIDENTIFIER *identifier, RECT *rect)
+{
+	return E_FAIL;
+}
@@ -0,0 +1,1376 @@
+// Stand-in for <windows.h> outside Windows, put on the include path by
+// CMakeLists.txt. It has the types, constants and CRT extensions the
+// portable code (keys.h, icons.h and the other headers next to the tools)
+// is written against, with the sizes they have on Windows where it matters:
+// DWORD is 32 bits. LONG is a long, which is what %ld prints and what the
+// COM reference counts are declared as.
+//
+// Below those is a small runtime for the parts of the tools that build on
+// Linux: thread message queues with timers, windows, events, threads and
+// waits. Every waitable handle has a file descriptor that polls readable
+// while it's signaled, so MsgWaitForMultipleObjects is one poll over the
+// handles and the thread's queue. Paths are converted to UTF-8 with
+// backslashes turned into slashes (compat_path), so code that joins paths
+// with L"\\" works unchanged. GDI keeps bitmaps and icons in memory and
+// counts them the way GetGuiResources does; there's no display.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+typedef int BOOL;
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef uint32_t DWORD;
+typedef long LONG;
+typedef unsigned long ULONG;
+typedef unsigned int UINT;
+typedef uint32_t UINT32;
+typedef long long LONGLONG;
+typedef unsigned long long ULONGLONG;
+typedef intptr_t INT_PTR;
+typedef uintptr_t UINT_PTR;
+typedef uintptr_t ULONG_PTR;
+typedef unsigned short ATOM;
+typedef wchar_t WCHAR;
+typedef wchar_t *LPWSTR;
+typedef const wchar_t *LPCWSTR;
+typedef void *LPVOID;
+typedef void *HANDLE;
+typedef HANDLE HWND;
+typedef HANDLE HINSTANCE;
+typedef HANDLE HMODULE;
+typedef HANDLE HICON;
+typedef HANDLE HCURSOR;
+typedef HANDLE HBRUSH;
+typedef HANDLE HBITMAP;
+typedef HANDLE HGDIOBJ;
+typedef HANDLE HDC;
+typedef HANDLE HHOOK;
+typedef HANDLE HKEY;
+typedef uintptr_t WPARAM;
+typedef intptr_t LPARAM;
+typedef intptr_t LRESULT;
+typedef int32_t HRESULT;
+
+#define WINAPI
+#define CALLBACK
+#define __declspec(x) COMPAT_DECLSPEC_##x
+#define COMPAT_DECLSPEC_thread thread_local
+
+#define TRUE 1
+#define FALSE 0
+
+#define S_OK ((HRESULT)0)
+#define S_FALSE ((HRESULT)1)
+#define E_NOTIMPL ((HRESULT)0x80004001)
+#define E_NOINTERFACE ((HRESULT)0x80004002)
+#define E_FAIL ((HRESULT)0x80004005)
+#define E_OUTOFMEMORY ((HRESULT)0x8007000E)
+#define E_INVALIDARG ((HRESULT)0x80070057)
+#define REGDB_E_CLASSNOTREG ((HRESULT)0x80040154)
+#define SUCCEEDED(hr) ((HRESULT)(hr) >= 0)
+#define FAILED(hr) ((HRESULT)(hr) < 0)
+#define HRESULT_FROM_WIN32(x) ((HRESULT)(x) <= 0 ? (HRESULT)(x) : (HRESULT)(((x) & 0x0000FFFF) | 0x80070000))
+
+#define ERROR_FILE_NOT_FOUND 2
+#define ERROR_NOT_FOUND 1168
+#define E_NOTFOUND HRESULT_FROM_WIN32(ERROR_NOT_FOUND)
+
+#define MOD_ALT 0x0001
+#define MOD_CONTROL 0x0002
+#define MOD_SHIFT 0x0004
+#define MOD_WIN 0x0008
+#define MOD_NOREPEAT 0x4000
+
+#define SW_SHOWNORMAL 1
+#define SW_SHOWMAXIMIZED 3
+#define SW_SHOWMINNOACTIVE 7
+
+#define INFINITE 0xFFFFFFFF
+#define WAIT_OBJECT_0 0
+#define WAIT_TIMEOUT 258
+#define WAIT_FAILED 0xFFFFFFFF
+#define MAXIMUM_WAIT_OBJECTS 64
+
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+#define INVALID_FILE_ATTRIBUTES 0xFFFFFFFF
+#define FILE_ATTRIBUTE_DIRECTORY 0x10
+#define FILE_ATTRIBUTE_NORMAL 0x80
+#define GENERIC_READ 0x80000000
+#define GENERIC_WRITE 0x40000000
+#define CREATE_ALWAYS 2
+#define OPEN_EXISTING 3
+
+#define WM_DESTROY 0x0002
+#define WM_CLOSE 0x0010
+#define WM_QUIT 0x0012
+#define WM_ERASEBKGND 0x0014
+#define WM_ENDSESSION 0x0016
+#define WM_SETTINGCHANGE 0x001A
+#define WM_TIMER 0x0113
+#define WM_MOUSEMOVE 0x0200
+#define WM_LBUTTONUP 0x0202
+#define WM_MOUSEWHEEL 0x020A
+#define WM_WTSSESSION_CHANGE 0x02B1
+#define WM_HOTKEY 0x0312
+#define WM_USER 0x0400
+
+#define WTS_SESSION_LOCK 0x7
+#define WTS_SESSION_UNLOCK 0x8
+
+#define WS_EX_NOACTIVATE 0x08000000L
+#define IDC_ARROW ((LPCWSTR)32512)
+#define SM_CXSMICON 49
+#define WHEEL_DELTA 120
+#define HC_ACTION 0
+#define WH_MOUSE_LL 14
+
+#define GR_GDIOBJECTS 0
+#define GR_USEROBJECTS 1
+#define BI_BITFIELDS 3
+#define DIB_RGB_COLORS 0
+
+#define HKEY_CURRENT_USER ((HKEY)(uintptr_t)0x80000001)
+#define RRF_RT_REG_DWORD 0x00000018
+
+#define LOWORD(l) ((WORD)((ULONG_PTR)(l) & 0xFFFF))
+#define HIWORD(l) ((WORD)(((ULONG_PTR)(l) >> 16) & 0xFFFF))
+#define ZeroMemory(p, n) memset((p), 0, (n))
+#define _countof(a) (sizeof(a) / sizeof((a)[0]))
+
+#define PM_NOREMOVE 0x0000
+#define PM_REMOVE 0x0001
+#define QS_ALLINPUT 0x04FF
+
+struct POINT
+{
+	LONG x;
+	LONG y;
+};
+
+struct RECT
+{
+	LONG left;
+	LONG top;
+	LONG right;
+	LONG bottom;
+};
+
+struct MSG
+{
+	HWND hwnd;
+	UINT message;
+	WPARAM wParam;
+	LPARAM lParam;
+	DWORD time;
+	POINT pt;
+};
+
+union LARGE_INTEGER
+{
+	struct
+	{
+		DWORD LowPart;
+		LONG HighPart;
+	};
+	LONGLONG QuadPart;
+};
+
+struct FILETIME
+{
+	DWORD dwLowDateTime;
+	DWORD dwHighDateTime;
+};
+
+struct GUID
+{
+	uint32_t Data1;
+	WORD Data2;
+	WORD Data3;
+	BYTE Data4[8];
+};
+
+typedef GUID IID;
+typedef GUID CLSID;
+typedef const IID &REFIID;
+typedef const CLSID &REFCLSID;
+typedef const GUID *LPCGUID;
+
+inline bool operator==(const GUID &a, const GUID &b)
+{
+	return memcmp(&a, &b, sizeof(GUID)) == 0;
+}
+
+inline bool operator!=(const GUID &a, const GUID &b)
+{
+	return !(a == b);
+}
+
+template <size_t N>
+__attribute__((format(printf, 2, 3))) int sprintf_s(char (&buffer)[N], const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int n = vsnprintf(buffer, N, format, args);
+	va_end(args);
+	return n;
+}
+
+inline int wcscpy_s(wchar_t *dest, size_t size, const wchar_t *src)
+{
+	size_t length = wcslen(src);
+
+	if (length >= size)
+	{
+		if (size != 0)
+			dest[0] = 0;
+
+		return ERANGE;
+	}
+
+	wmemcpy(dest, src, length + 1);
+	return 0;
+}
+
+template <size_t N>
+int wcscpy_s(wchar_t (&dest)[N], const wchar_t *src)
+{
+	return wcscpy_s(dest, N, src);
+}
+
+inline int _wcsnicmp(const wchar_t *a, const wchar_t *b, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		wint_t x = towlower(a[i]);
+		wint_t y = towlower(b[i]);
+
+		if (x != y)
+			return x < y ? -1 : 1;
+
+		if (x == 0)
+			break;
+	}
+
+	return 0;
+}
+
+inline int _wcsicmp(const wchar_t *a, const wchar_t *b)
+{
+	return _wcsnicmp(a, b, (size_t)-1);
+}
+
+inline int _wtoi(const wchar_t *s)
+{
+	return (int)wcstol(s, 0, 10);
+}
+
+// UTF-8 for wchar_t text, which is UTF-32 here
+
+inline std::string compat_narrow(const wchar_t *s, size_t length)
+{
+	std::string out;
+	out.reserve(length);
+
+	for (size_t i = 0; i < length; i++)
+	{
+		unsigned c = (unsigned)s[i];
+
+		if (c < 0x80)
+		{
+			out += (char)c;
+		}
+		else if (c < 0x800)
+		{
+			out += (char)(0xC0 | (c >> 6));
+			out += (char)(0x80 | (c & 0x3F));
+		}
+		else if (c < 0x10000)
+		{
+			out += (char)(0xE0 | (c >> 12));
+			out += (char)(0x80 | ((c >> 6) & 0x3F));
+			out += (char)(0x80 | (c & 0x3F));
+		}
+		else
+		{
+			out += (char)(0xF0 | (c >> 18));
+			out += (char)(0x80 | ((c >> 12) & 0x3F));
+			out += (char)(0x80 | ((c >> 6) & 0x3F));
+			out += (char)(0x80 | (c & 0x3F));
+		}
+	}
+
+	return out;
+}
+
+inline std::string compat_narrow(const wchar_t *s)
+{
+	return compat_narrow(s, wcslen(s));
+}
+
+// invalid sequences come out as U+FFFD, one per byte
+inline std::wstring compat_widen(const char *s)
+{
+	std::wstring out;
+	const unsigned char *p = (const unsigned char*)s;
+
+	while (*p != 0)
+	{
+		unsigned c = *p;
+		int extra = c < 0x80 ? 0 : c >= 0xF0 && c < 0xF5 ? 3 : c >= 0xE0 ? 2 : c >= 0xC2 ? 1 : -1;
+		int i = 1;
+
+		if (extra > 0)
+		{
+			c &= 0x3F >> extra;
+
+			for (; i <= extra && (p[i] & 0xC0) == 0x80; i++)
+				c = (c << 6) | (p[i] & 0x3F);
+		}
+
+		if (extra < 0 || i <= extra)
+		{
+			out += (wchar_t)0xFFFD;
+			p++;
+			continue;
+		}
+
+		out += (wchar_t)c;
+		p += i;
+	}
+
+	return out;
+}
+
+inline std::string compat_path(const wchar_t *path)
+{
+	std::string out = compat_narrow(path);
+
+	for (size_t i = 0; i < out.size(); i++)
+	{
+		if (out[i] == '\\')
+			out[i] = '/';
+	}
+
+	return out;
+}
+
+inline void OutputDebugString(const wchar_t *text)
+{
+	fputs(compat_narrow(text).c_str(), stderr);
+}
+
+inline DWORD GetFileAttributes(const wchar_t *path)
+{
+	struct stat st;
+
+	if (stat(compat_path(path).c_str(), &st) != 0)
+		return INVALID_FILE_ATTRIBUTES;
+
+	return S_ISDIR(st.st_mode) ? FILE_ATTRIBUTE_DIRECTORY : 0;
+}
+
+inline DWORD GetCurrentThreadId()
+{
+	static thread_local DWORD id = (DWORD)syscall(SYS_gettid);
+	return id;
+}
+
+inline DWORD GetCurrentProcessId()
+{
+	return (DWORD)getpid();
+}
+
+inline ULONGLONG GetTickCount64()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void Sleep(DWORD ms)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+inline DWORD GetLastError()
+{
+	return (DWORD)errno;
+}
+
+// 100 ns ticks, the frequency Windows reports on current hardware
+inline BOOL QueryPerformanceFrequency(LARGE_INTEGER *frequency)
+{
+	frequency->QuadPart = 10000000;
+	return TRUE;
+}
+
+inline BOOL QueryPerformanceCounter(LARGE_INTEGER *counter)
+{
+	counter->QuadPart = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() / 100;
+	return TRUE;
+}
+
+inline HANDLE GetCurrentProcess()
+{
+	return (HANDLE)(intptr_t)-1;
+}
+
+// Only the CPU times are filled in, in 100 ns units.
+inline BOOL GetProcessTimes(HANDLE process, FILETIME *creation, FILETIME *exit, FILETIME *kernel, FILETIME *user)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return FALSE;
+
+	ULONGLONG system_time = (ULONGLONG)usage.ru_stime.tv_sec * 10000000 + (ULONGLONG)usage.ru_stime.tv_usec * 10;
+	ULONGLONG user_time = (ULONGLONG)usage.ru_utime.tv_sec * 10000000 + (ULONGLONG)usage.ru_utime.tv_usec * 10;
+
+	*creation = FILETIME();
+	*exit = FILETIME();
+	kernel->dwLowDateTime = (DWORD)system_time;
+	kernel->dwHighDateTime = (DWORD)(system_time >> 32);
+	user->dwLowDateTime = (DWORD)user_time;
+	user->dwHighDateTime = (DWORD)(user_time >> 32);
+	return TRUE;
+}
+
+// The spin loops this is used in wait on another thread, which may need
+// this core to get anywhere.
+inline void YieldProcessor()
+{
+	std::this_thread::yield();
+}
+
+inline LONG InterlockedIncrement(volatile LONG *p)
+{
+	return __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedDecrement(volatile LONG *p)
+{
+	return __atomic_sub_fetch(p, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedExchange(volatile LONG *p, LONG value)
+{
+	return __atomic_exchange_n(p, value, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedExchangeAdd(volatile LONG *p, LONG value)
+{
+	return __atomic_fetch_add(p, value, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedCompareExchange(volatile LONG *p, LONG exchange, LONG comparand)
+{
+	__atomic_compare_exchange_n(p, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return comparand;
+}
+
+inline void *InterlockedExchangePointer(void *volatile *p, void *value)
+{
+	return __atomic_exchange_n(p, value, __ATOMIC_SEQ_CST);
+}
+
+inline void *InterlockedCompareExchangePointer(void *volatile *p, void *exchange, void *comparand)
+{
+	__atomic_compare_exchange_n(p, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return comparand;
+}
+
+// recursive, like the real one
+struct CRITICAL_SECTION
+{
+	pthread_mutex_t mutex;
+};
+
+inline void InitializeCriticalSection(CRITICAL_SECTION *section)
+{
+	pthread_mutexattr_t attributes;
+	pthread_mutexattr_init(&attributes);
+	pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&section->mutex, &attributes);
+	pthread_mutexattr_destroy(&attributes);
+}
+
+inline void DeleteCriticalSection(CRITICAL_SECTION *section)
+{
+	pthread_mutex_destroy(&section->mutex);
+}
+
+inline void EnterCriticalSection(CRITICAL_SECTION *section)
+{
+	pthread_mutex_lock(&section->mutex);
+}
+
+inline void LeaveCriticalSection(CRITICAL_SECTION *section)
+{
+	pthread_mutex_unlock(&section->mutex);
+}
+
+// A waitable handle. fd polls readable while the object is signaled;
+// acquire is called when it does and returns false if another waiter got
+// there first (an auto-reset event has only one wake to give).
+
+struct CompatObject
+{
+	int fd = -1;
+
+	virtual ~CompatObject()
+	{
+		if (fd >= 0)
+			close(fd);
+	}
+
+	virtual bool acquire()
+	{
+		return true;
+	}
+};
+
+struct CompatEvent : CompatObject
+{
+	bool manual_reset = false;
+
+	bool acquire() override
+	{
+		uint64_t count;
+		return manual_reset || read(fd, &count, sizeof(count)) == sizeof(count);
+	}
+};
+
+inline HANDLE CreateEvent(void *attributes, BOOL manual_reset, BOOL initial, const wchar_t *name)
+{
+	CompatEvent *event = new CompatEvent();
+	event->fd = eventfd(initial ? 1 : 0, EFD_NONBLOCK | EFD_CLOEXEC);
+	event->manual_reset = manual_reset != 0;
+	return event;
+}
+
+inline BOOL SetEvent(HANDLE handle)
+{
+	uint64_t one = 1;
+	return write(((CompatObject*)handle)->fd, &one, sizeof(one)) == sizeof(one);
+}
+
+inline BOOL ResetEvent(HANDLE handle)
+{
+	uint64_t count;
+	while (read(((CompatObject*)handle)->fd, &count, sizeof(count)) == sizeof(count));
+	return TRUE;
+}
+
+inline BOOL CloseHandle(HANDLE handle)
+{
+	delete (CompatObject*)handle;
+	return TRUE;
+}
+
+// A thread handle is signaled for good once the thread is gone, after its
+// thread_local objects (its message queue among them) are destroyed.
+
+typedef DWORD (*LPTHREAD_START_ROUTINE)(LPVOID parameter);
+
+struct CompatThreadExit
+{
+	int fd = -1;
+
+	~CompatThreadExit()
+	{
+		uint64_t one = 1;
+
+		if (fd >= 0)
+		{
+			(void)!write(fd, &one, sizeof(one));
+			close(fd);
+		}
+	}
+};
+
+inline HANDLE CreateThread(void *attributes, size_t stack, LPTHREAD_START_ROUTINE start, LPVOID parameter, DWORD flags, DWORD *id)
+{
+	CompatObject *thread = new CompatObject();
+	thread->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	int exit_fd = thread->fd >= 0 ? fcntl(thread->fd, F_DUPFD_CLOEXEC, 0) : -1;
+
+	if (exit_fd < 0)
+	{
+		delete thread;
+		return 0;
+	}
+
+	std::atomic<DWORD> started(0);
+
+	std::thread([&started, exit_fd, start, parameter]() {
+		static thread_local CompatThreadExit exit;
+		exit.fd = exit_fd;
+		started = GetCurrentThreadId();
+		start(parameter);
+	}).detach();
+
+	while (started == 0)
+		std::this_thread::yield();
+
+	if (id != 0)
+		*id = started;
+
+	return thread;
+}
+
+// Enough of CreateFile for writing a file out or reading it in.
+
+inline HANDLE CreateFile(LPCWSTR filename, DWORD access, DWORD share, void *security, DWORD disposition, DWORD flags, HANDLE source)
+{
+	int mode = (access & GENERIC_WRITE) ? ((access & GENERIC_READ) ? O_RDWR : O_WRONLY) : O_RDONLY;
+
+	if (disposition == CREATE_ALWAYS)
+		mode |= O_CREAT | O_TRUNC;
+
+	int fd = open(compat_path(filename).c_str(), mode | O_CLOEXEC, 0644);
+
+	if (fd < 0)
+		return INVALID_HANDLE_VALUE;
+
+	CompatObject *file = new CompatObject();
+	file->fd = fd;
+	return file;
+}
+
+inline BOOL WriteFile(HANDLE file, const void *data, DWORD size, DWORD *written, void *overlapped)
+{
+	const char *p = (const char*)data;
+	DWORD done = 0;
+	ssize_t n = 1;
+
+	while (done < size && (n = write(((CompatObject*)file)->fd, p + done, size - done)) > 0)
+		done += (DWORD)n;
+
+	*written = done;
+	return done == size;
+}
+
+// Thread message queues. A thread gets one the first time it peeks, gets,
+// waits or sets a timer, and PostThreadMessage fails for threads without
+// one, as on Windows. Timers only ever have one WM_TIMER pending, made up
+// when the queue is read after they're due. A window belongs to the queue
+// of the thread that created it, which is where its messages and timers
+// go; DispatchMessage calls its window procedure.
+
+typedef LRESULT (*WNDPROC)(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam);
+
+struct CompatTimer
+{
+	HWND hwnd;
+	UINT_PTR id;
+	unsigned interval;
+	std::chrono::steady_clock::time_point due;
+};
+
+struct CompatQueue
+{
+	std::mutex lock;
+	std::deque<MSG> messages;
+	std::vector<CompatTimer> timers;
+	int fd; // readable while messages isn't empty
+	DWORD thread;
+};
+
+struct CompatWindow
+{
+	WNDPROC proc;
+	CompatQueue *queue;
+};
+
+// the lock covers both maps
+inline std::mutex compat_queues_lock;
+inline std::unordered_map<DWORD, CompatQueue*> compat_queues;
+inline std::unordered_set<CompatWindow*> compat_windows;
+inline std::atomic<UINT_PTR> compat_next_timer(1);
+inline std::atomic<DWORD> compat_user_objects(0);
+
+// the window if it still exists; the caller holds compat_queues_lock
+inline CompatWindow *compat_window(HWND hwnd)
+{
+	std::unordered_set<CompatWindow*>::iterator it = compat_windows.find((CompatWindow*)hwnd);
+	return it != compat_windows.end() ? *it : 0;
+}
+
+struct CompatQueueOwner
+{
+	CompatQueue *queue = 0;
+
+	~CompatQueueOwner()
+	{
+		if (queue == 0)
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(compat_queues_lock);
+			compat_queues.erase(queue->thread);
+
+			// windows the thread didn't destroy go with it
+			for (std::unordered_set<CompatWindow*>::iterator it = compat_windows.begin(); it != compat_windows.end();)
+			{
+				if ((*it)->queue != queue)
+				{
+					++it;
+					continue;
+				}
+
+				delete *it;
+				it = compat_windows.erase(it);
+				compat_user_objects--;
+			}
+		}
+
+		close(queue->fd);
+		delete queue;
+	}
+};
+
+inline CompatQueue *compat_queue()
+{
+	static thread_local CompatQueueOwner owner;
+
+	if (owner.queue == 0)
+	{
+		CompatQueue *queue = new CompatQueue();
+		queue->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		queue->thread = GetCurrentThreadId();
+
+		std::lock_guard<std::mutex> lock(compat_queues_lock);
+		compat_queues[queue->thread] = queue;
+		owner.queue = queue;
+	}
+
+	return owner.queue;
+}
+
+inline void compat_post(CompatQueue *queue, HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
+{
+	MSG msg = { hwnd, message, wParam, lParam, (DWORD)GetTickCount64() };
+	uint64_t one = 1;
+
+	queue->messages.push_back(msg);
+
+	if (queue->messages.size() == 1)
+		(void)!write(queue->fd, &one, sizeof(one));
+}
+
+inline BOOL PostThreadMessage(DWORD thread, UINT message, WPARAM wParam, LPARAM lParam)
+{
+	std::lock_guard<std::mutex> lock(compat_queues_lock);
+	std::unordered_map<DWORD, CompatQueue*>::iterator it = compat_queues.find(thread);
+
+	if (it == compat_queues.end())
+		return FALSE;
+
+	std::lock_guard<std::mutex> queue_lock(it->second->lock);
+	compat_post(it->second, 0, message, wParam, lParam);
+	return TRUE;
+}
+
+// PostMessage to no window posts to the calling thread
+inline BOOL PostMessage(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
+{
+	CompatQueue *queue = hwnd == 0 ? compat_queue() : 0;
+	std::lock_guard<std::mutex> lock(compat_queues_lock);
+
+	if (hwnd != 0)
+	{
+		CompatWindow *window = compat_window(hwnd);
+
+		if (window == 0)
+			return FALSE;
+
+		queue = window->queue;
+	}
+
+	std::lock_guard<std::mutex> queue_lock(queue->lock);
+	compat_post(queue, hwnd, message, wParam, lParam);
+	return TRUE;
+}
+
+inline void PostQuitMessage(int code)
+{
+	PostMessage(0, WM_QUIT, (WPARAM)code, 0);
+}
+
+// the calling thread's queue, or the window's if it still exists
+inline CompatQueue *compat_timer_queue(HWND hwnd)
+{
+	if (hwnd == 0)
+		return compat_queue();
+
+	std::lock_guard<std::mutex> lock(compat_queues_lock);
+	CompatWindow *window = compat_window(hwnd);
+	return window != 0 ? window->queue : 0;
+}
+
+inline UINT_PTR SetTimer(HWND hwnd, UINT_PTR id, UINT interval, void *proc)
+{
+	CompatQueue *queue = compat_timer_queue(hwnd);
+
+	if (queue == 0)
+		return 0;
+
+	std::lock_guard<std::mutex> lock(queue->lock);
+
+	if (hwnd == 0)
+		id = compat_next_timer++;
+
+	for (size_t i = 0; i < queue->timers.size(); i++)
+	{
+		if (queue->timers[i].hwnd == hwnd && queue->timers[i].id == id)
+			queue->timers.erase(queue->timers.begin() + i);
+	}
+
+	CompatTimer timer = { hwnd, id, interval, std::chrono::steady_clock::now() + std::chrono::milliseconds(interval) };
+	queue->timers.push_back(timer);
+	return id;
+}
+
+inline BOOL KillTimer(HWND hwnd, UINT_PTR id)
+{
+	CompatQueue *queue = compat_timer_queue(hwnd);
+
+	if (queue == 0)
+		return FALSE;
+
+	std::lock_guard<std::mutex> lock(queue->lock);
+
+	for (size_t i = 0; i < queue->timers.size(); i++)
+	{
+		if (queue->timers[i].hwnd == hwnd && queue->timers[i].id == id)
+		{
+			queue->timers.erase(queue->timers.begin() + i);
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+// milliseconds until the next timer is due, or -1 if there's none
+inline int compat_next_due(CompatQueue *queue)
+{
+	std::lock_guard<std::mutex> lock(queue->lock);
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	long long next = -1;
+
+	for (size_t i = 0; i < queue->timers.size(); i++)
+	{
+		long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(queue->timers[i].due - now).count();
+		ms = ms < 0 ? 0 : ms + 1;
+
+		if (next < 0 || ms < next)
+			next = ms;
+	}
+
+	return (int)next;
+}
+
+inline BOOL PeekMessage(MSG *msg, HWND hwnd, UINT first, UINT last, UINT flags)
+{
+	CompatQueue *queue = compat_queue();
+	std::lock_guard<std::mutex> lock(queue->lock);
+
+	for (std::deque<MSG>::iterator it = queue->messages.begin(); it != queue->messages.end(); ++it)
+	{
+		if ((first != 0 || last != 0) && (it->message < first || it->message > last))
+			continue;
+
+		if (hwnd != 0 && it->hwnd != hwnd)
+			continue;
+
+		*msg = *it;
+
+		if (flags & PM_REMOVE)
+		{
+			queue->messages.erase(it);
+
+			uint64_t count;
+
+			if (queue->messages.empty())
+				(void)!read(queue->fd, &count, sizeof(count));
+		}
+
+		return TRUE;
+	}
+
+	if ((first != 0 || last != 0) && (WM_TIMER < first || WM_TIMER > last))
+		return FALSE;
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < queue->timers.size(); i++)
+	{
+		CompatTimer &timer = queue->timers[i];
+
+		if (timer.due > now || (hwnd != 0 && timer.hwnd != hwnd))
+			continue;
+
+		MSG tick = { timer.hwnd, WM_TIMER, timer.id, 0, (DWORD)GetTickCount64() };
+		*msg = tick;
+
+		if (flags & PM_REMOVE)
+			timer.due = now + std::chrono::milliseconds(timer.interval);
+
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+// Waits for one of the handles or, with the queue, for a message or a due
+// timer (returned as count). Signaled handles win over messages, lower
+// indices over higher ones.
+
+inline DWORD compat_wait(DWORD count, const HANDLE *handles, CompatQueue *queue, DWORD timeout)
+{
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout == INFINITE ? 0 : timeout);
+	std::vector<pollfd> fds(count + (queue != 0 ? 1 : 0));
+
+	for (DWORD i = 0; i < count; i++)
+		fds[i] = { ((CompatObject*)handles[i])->fd, POLLIN, 0 };
+
+	if (queue != 0)
+		fds[count] = { queue->fd, POLLIN, 0 };
+
+	for (;;)
+	{
+		int wait = -1;
+
+		if (timeout != INFINITE)
+		{
+			long long left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+			wait = left < 0 ? 0 : (int)left;
+		}
+
+		if (queue != 0)
+		{
+			int due = compat_next_due(queue);
+
+			if (due >= 0 && (wait < 0 || due < wait))
+				wait = due;
+		}
+
+		int ready = poll(fds.data(), fds.size(), wait);
+
+		if (ready < 0 && errno != EINTR)
+			return WAIT_FAILED;
+
+		for (DWORD i = 0; ready > 0 && i < count; i++)
+		{
+			if ((fds[i].revents & POLLIN) && ((CompatObject*)handles[i])->acquire())
+				return WAIT_OBJECT_0 + i;
+		}
+
+		if (queue != 0)
+		{
+			MSG msg;
+
+			if (PeekMessage(&msg, 0, 0, 0, PM_NOREMOVE))
+				return WAIT_OBJECT_0 + count;
+		}
+
+		if (timeout != INFINITE && std::chrono::steady_clock::now() >= deadline)
+			return WAIT_TIMEOUT;
+	}
+}
+
+inline DWORD WaitForSingleObject(HANDLE handle, DWORD timeout)
+{
+	return compat_wait(1, &handle, 0, timeout);
+}
+
+inline DWORD WaitForMultipleObjects(DWORD count, const HANDLE *handles, BOOL wait_all, DWORD timeout)
+{
+	return compat_wait(count, handles, 0, timeout);
+}
+
+inline DWORD MsgWaitForMultipleObjects(DWORD count, const HANDLE *handles, BOOL wait_all, DWORD timeout, DWORD mask)
+{
+	return compat_wait(count, handles, compat_queue(), timeout);
+}
+
+inline BOOL GetMessage(MSG *msg, HWND hwnd, UINT first, UINT last)
+{
+	while (!PeekMessage(msg, hwnd, first, last, PM_REMOVE))
+		compat_wait(0, 0, compat_queue(), INFINITE);
+
+	return msg->message != WM_QUIT;
+}
+
+inline BOOL TranslateMessage(const MSG *msg)
+{
+	return FALSE;
+}
+
+inline LRESULT DispatchMessage(const MSG *msg)
+{
+	WNDPROC proc = 0;
+
+	if (msg->hwnd != 0)
+	{
+		std::lock_guard<std::mutex> lock(compat_queues_lock);
+		CompatWindow *window = compat_window(msg->hwnd);
+		proc = window != 0 ? window->proc : 0;
+	}
+
+	return proc != 0 ? proc(msg->hwnd, msg->message, msg->wParam, msg->lParam) : 0;
+}
+
+// Windows: classes only carry the window procedure, and nothing is drawn.
+
+struct WNDCLASSEX
+{
+	UINT cbSize;
+	UINT style;
+	WNDPROC lpfnWndProc;
+	int cbClsExtra;
+	int cbWndExtra;
+	HINSTANCE hInstance;
+	HICON hIcon;
+	HCURSOR hCursor;
+	HBRUSH hbrBackground;
+	LPCWSTR lpszMenuName;
+	LPCWSTR lpszClassName;
+	HICON hIconSm;
+};
+
+inline std::unordered_map<std::wstring, WNDPROC> compat_classes;
+
+inline ATOM RegisterClassEx(const WNDCLASSEX *wc)
+{
+	std::lock_guard<std::mutex> lock(compat_queues_lock);
+	compat_classes[wc->lpszClassName] = wc->lpfnWndProc;
+	return (ATOM)compat_classes.size();
+}
+
+inline HWND CreateWindowEx(DWORD ex_style, LPCWSTR class_name, LPCWSTR title, DWORD style, int x, int y, int width, int height,
+	HWND parent, HANDLE menu, HINSTANCE instance, LPVOID parameter)
+{
+	CompatQueue *queue = compat_queue();
+	std::lock_guard<std::mutex> lock(compat_queues_lock);
+	std::unordered_map<std::wstring, WNDPROC>::iterator it = compat_classes.find(class_name);
+
+	if (it == compat_classes.end())
+		return 0;
+
+	CompatWindow *window = new CompatWindow();
+	window->proc = it->second;
+	window->queue = queue;
+
+	compat_windows.insert(window);
+	compat_user_objects++;
+	return window;
+}
+
+inline BOOL DestroyWindow(HWND hwnd)
+{
+	WNDPROC proc;
+	CompatQueue *queue;
+
+	{
+		std::lock_guard<std::mutex> lock(compat_queues_lock);
+		CompatWindow *window = compat_window(hwnd);
+
+		if (window == 0)
+			return FALSE;
+
+		proc = window->proc;
+		queue = window->queue;
+	}
+
+	proc(hwnd, WM_DESTROY, 0, 0);
+
+	std::lock_guard<std::mutex> lock(compat_queues_lock);
+	CompatWindow *window = compat_window(hwnd);
+
+	if (window == 0)
+		return TRUE;
+
+	{
+		std::lock_guard<std::mutex> queue_lock(queue->lock);
+
+		for (size_t i = queue->timers.size(); i-- > 0;)
+		{
+			if (queue->timers[i].hwnd == hwnd)
+				queue->timers.erase(queue->timers.begin() + i);
+		}
+	}
+
+	compat_windows.erase(window);
+	compat_user_objects--;
+	delete window;
+	return TRUE;
+}
+
+inline LRESULT DefWindowProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
+{
+	if (message == WM_CLOSE)
+		DestroyWindow(hwnd);
+
+	return 0;
+}
+
+inline HMODULE GetModuleHandle(LPCWSTR name)
+{
+	return name == 0 ? (HMODULE)1 : 0;
+}
+
+inline HCURSOR LoadCursor(HINSTANCE instance, LPCWSTR name)
+{
+	return 0;
+}
+
+inline int GetSystemMetrics(int index)
+{
+	return index == SM_CXSMICON ? 16 : 0;
+}
+
+inline BOOL SetProcessDPIAware()
+{
+	return TRUE;
+}
+
+// Ctrl+C isn't caught; it ends the process as it would without a handler.
+inline BOOL SetConsoleCtrlHandler(BOOL (*handler)(DWORD type), BOOL add)
+{
+	return TRUE;
+}
+
+inline BOOL PtInRect(const RECT *rect, POINT pt)
+{
+	return pt.x >= rect->left && pt.x < rect->right && pt.y >= rect->top && pt.y < rect->bottom;
+}
+
+// There are no low level hooks to install.
+
+typedef LRESULT (*HOOKPROC)(int code, WPARAM wParam, LPARAM lParam);
+
+struct MSLLHOOKSTRUCT
+{
+	POINT pt;
+	DWORD mouseData;
+	DWORD flags;
+	DWORD time;
+	ULONG_PTR dwExtraInfo;
+};
+
+inline HHOOK SetWindowsHookEx(int type, HOOKPROC proc, HINSTANCE module, DWORD thread)
+{
+	return 0;
+}
+
+inline BOOL UnhookWindowsHookEx(HHOOK hook)
+{
+	return TRUE;
+}
+
+inline LRESULT CallNextHookEx(HHOOK hook, int code, WPARAM wParam, LPARAM lParam)
+{
+	return 0;
+}
+
+// GDI. Bitmaps are plain memory; an icon holds its own copies of the color
+// and mask bitmaps it was made from, as it does on Windows, so it counts as
+// one USER object and two GDI objects.
+
+struct BITMAPINFOHEADER
+{
+	DWORD biSize;
+	LONG biWidth;
+	LONG biHeight;
+	WORD biPlanes;
+	WORD biBitCount;
+	DWORD biCompression;
+	DWORD biSizeImage;
+	LONG biXPelsPerMeter;
+	LONG biYPelsPerMeter;
+	DWORD biClrUsed;
+	DWORD biClrImportant;
+};
+
+struct RGBQUAD
+{
+	BYTE rgbBlue;
+	BYTE rgbGreen;
+	BYTE rgbRed;
+	BYTE rgbReserved;
+};
+
+struct BITMAPINFO
+{
+	BITMAPINFOHEADER bmiHeader;
+	RGBQUAD bmiColors[1];
+};
+
+// the header fields of BITMAPINFOHEADER, then the masks; the color space
+// fields aren't used
+struct BITMAPV5HEADER
+{
+	DWORD bV5Size;
+	LONG bV5Width;
+	LONG bV5Height;
+	WORD bV5Planes;
+	WORD bV5BitCount;
+	DWORD bV5Compression;
+	DWORD bV5SizeImage;
+	LONG bV5XPelsPerMeter;
+	LONG bV5YPelsPerMeter;
+	DWORD bV5ClrUsed;
+	DWORD bV5ClrImportant;
+	DWORD bV5RedMask;
+	DWORD bV5GreenMask;
+	DWORD bV5BlueMask;
+	DWORD bV5AlphaMask;
+};
+
+struct ICONINFO
+{
+	BOOL fIcon;
+	DWORD xHotspot;
+	DWORD yHotspot;
+	HBITMAP hbmMask;
+	HBITMAP hbmColor;
+};
+
+struct CompatBitmap
+{
+	std::vector<BYTE> bits;
+};
+
+struct CompatIcon
+{
+	HBITMAP mask;
+	HBITMAP color;
+};
+
+inline std::atomic<DWORD> compat_gdi_objects(0);
+
+// rows are padded to align, as GDI does
+inline HBITMAP compat_bitmap(LONG width, LONG height, WORD bits_per_pixel, int align)
+{
+	size_t row = ((size_t)width * bits_per_pixel + align * 8 - 1) / (align * 8) * align;
+	CompatBitmap *bitmap = new CompatBitmap();
+
+	bitmap->bits.assign(row * (size_t)(height < 0 ? -height : height), 0);
+	compat_gdi_objects++;
+	return bitmap;
+}
+
+inline HBITMAP compat_copy_bitmap(HBITMAP source)
+{
+	CompatBitmap *bitmap = new CompatBitmap(*(CompatBitmap*)source);
+	compat_gdi_objects++;
+	return bitmap;
+}
+
+inline HDC GetDC(HWND hwnd)
+{
+	return (HDC)1;
+}
+
+inline int ReleaseDC(HWND hwnd, HDC hdc)
+{
+	return 1;
+}
+
+inline HBITMAP CreateDIBSection(HDC hdc, const BITMAPINFO *info, UINT usage, void **bits, HANDLE section, DWORD offset)
+{
+	const BITMAPINFOHEADER &header = info->bmiHeader;
+	HBITMAP bitmap = compat_bitmap(header.biWidth, header.biHeight, header.biBitCount, 4);
+
+	*bits = ((CompatBitmap*)bitmap)->bits.data();
+	return bitmap;
+}
+
+inline HBITMAP CreateBitmap(int width, int height, UINT planes, UINT bits_per_pixel, const void *bits)
+{
+	HBITMAP bitmap = compat_bitmap(width, height, (WORD)(planes * bits_per_pixel), 2);
+	std::vector<BYTE> &data = ((CompatBitmap*)bitmap)->bits;
+
+	if (bits != 0)
+		memcpy(data.data(), bits, data.size());
+
+	return bitmap;
+}
+
+inline BOOL DeleteObject(HGDIOBJ object)
+{
+	if (object == 0)
+		return FALSE;
+
+	delete (CompatBitmap*)object;
+	compat_gdi_objects--;
+	return TRUE;
+}
+
+inline HICON CreateIconIndirect(const ICONINFO *info)
+{
+	if (info->hbmMask == 0 || info->hbmColor == 0)
+		return 0;
+
+	CompatIcon *icon = new CompatIcon();
+	icon->mask = compat_copy_bitmap(info->hbmMask);
+	icon->color = compat_copy_bitmap(info->hbmColor);
+
+	compat_user_objects++;
+	return icon;
+}
+
+inline BOOL DestroyIcon(HICON handle)
+{
+	CompatIcon *icon = (CompatIcon*)handle;
+
+	if (icon == 0)
+		return FALSE;
+
+	DeleteObject(icon->mask);
+	DeleteObject(icon->color);
+	delete icon;
+
+	compat_user_objects--;
+	return TRUE;
+}
+
+inline DWORD GetGuiResources(HANDLE process, DWORD flags)
+{
+	return flags == GR_GDIOBJECTS ? compat_gdi_objects.load() : flags == GR_USEROBJECTS ? compat_user_objects.load() : 0;
+}
+
+// There is no registry; every value is missing.
+inline LONG RegGetValue(HKEY key, LPCWSTR subkey, LPCWSTR value, DWORD flags, DWORD *type, void *data, DWORD *size)
+{
+	return ERROR_FILE_NOT_FOUND;
+}
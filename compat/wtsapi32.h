@@ -0,0 +1,18 @@
+// Stand-in for the session notifications of <wtsapi32.h> outside Windows.
+// Nothing locks the session, so nothing is ever sent.
+
+#pragma once
+
+#include <windows.h>
+
+#define NOTIFY_FOR_THIS_SESSION 0
+
+inline BOOL WTSRegisterSessionNotification(HWND hwnd, DWORD flags)
+{
+	return TRUE;
+}
+
+inline BOOL WTSUnRegisterSessionNotification(HWND hwnd)
+{
+	return TRUE;
+}
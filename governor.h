@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+
+// Launch governor. A press takes a token from its binding's bucket, which
+// holds up to burst tokens and gets one back every refill milliseconds (kept
+// as the time the bucket drains to empty, so there's nothing to refill). A
+// press without a token, or while max_pending launches are already queued
+// or running, doesn't launch. A burst of 0 turns the rate limit off.
+
+enum GovernorDecision
+{
+	governor_launch,
+	governor_rate_limited,
+	governor_capped
+};
+
+struct Governor
+{
+	unsigned burst;
+	unsigned refill;
+	unsigned max_pending;
+	std::vector<unsigned long long> empty_at; // per id, sized with the table on reload
+	unsigned launched;
+	unsigned rate_limited;
+	unsigned capped;
+};
+
+GovernorDecision govern(Governor &g, int id, unsigned long long now, unsigned pending)
+{
+	if (pending >= g.max_pending)
+	{
+		g.capped++;
+		return governor_capped;
+	}
+
+	if (g.burst != 0 && id < g.empty_at.size())
+	{
+		unsigned long long &empty_at = g.empty_at[id];
+
+		if (empty_at < now)
+			empty_at = now;
+
+		if (empty_at - now > (unsigned long long)(g.burst - 1) * g.refill)
+		{
+			g.rate_limited++;
+			return governor_rate_limited;
+		}
+
+		empty_at += g.refill;
+	}
+
+	g.launched++;
+	return governor_launch;
+}
@@ -0,0 +1,181 @@
+// Runs hotkeys and volumeicon in one process: both are compiled into this
+// file, each in its own namespace, and share the main thread, its message
+// loop (hotkeys' run, which dispatches volumeicon's hidden window), COM and
+// the trace. The low level hooks (hotkeys' --hook, volumeicon's wheel) each
+// run on a thread of their own, so nothing either module does on the loop
+// delays input. The command line is the hotkeys one plus --no-hotkeys and
+// --no-volumeicon to leave a module out, volumeicon's --meter, and
+// --resources <file>.
+
+#define UNICODE
+#define NOMINMAX
+#pragma comment(lib, "Psapi.lib")
+
+// everything the modules include, so the namespaces below only see the
+// include guards
+#include <windows.h>
+#include <initguid.h>
+#include <KnownFolders.h>
+#include <shlobj.h>
+#include <shellapi.h>
+#include <psapi.h>
+#include <tlhelp32.h>
+#include <wtsapi32.h>
+#include <atlbase.h>
+#include <mmdeviceapi.h>
+#include <endpointvolume.h>
+#include <audiopolicy.h>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h>
+#endif
+
+namespace hotkeys
+{
+	#include "hotkeys.cxx"
+}
+
+namespace volumeicon
+{
+	#include "volumeicon.cxx"
+}
+
+static const wchar_t *resources_path = 0;
+static const wchar_t *resources_modules = L"";
+
+// threads of this process, which shows what the hook threads add
+DWORD count_threads()
+{
+	HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+	THREADENTRY32 entry = { sizeof(entry) };
+	DWORD count = 0;
+
+	if (snapshot == INVALID_HANDLE_VALUE)
+		return 0;
+
+	for (BOOL ok = Thread32First(snapshot, &entry); ok; ok = Thread32Next(snapshot, &entry))
+	{
+		if (entry.th32OwnerProcessID == GetCurrentProcessId())
+			count++;
+	}
+
+	CloseHandle(snapshot);
+	return count;
+}
+
+// One line for comparing against the two tools run as separate processes,
+// also appended to the --resources file. Running with --no-volumeicon and
+// then --no-hotkeys gives the two halves of the same build to add up.
+void report_resources(const wchar_t *when)
+{
+	PROCESS_MEMORY_COUNTERS memory = { sizeof(memory) };
+	DWORD handles = 0;
+
+	GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory));
+	GetProcessHandleCount(GetCurrentProcess(), &handles);
+
+	wchar_t text[256];
+	swprintf(text, 256, L"host: %s %s, working set %zu KB (peak %zu KB), private %zu KB, %lu handles, %lu GDI objects, %lu USER objects, %lu threads\n",
+		resources_modules, when, memory.WorkingSetSize / 1024, memory.PeakWorkingSetSize / 1024, memory.PagefileUsage / 1024, handles,
+		GetGuiResources(GetCurrentProcess(), GR_GDIOBJECTS),
+		GetGuiResources(GetCurrentProcess(), GR_USEROBJECTS),
+		count_threads());
+
+	OutputDebugString(text);
+
+	FILE *file = resources_path != 0 ? _wfopen(resources_path, L"a, ccs=UTF-8") : 0;
+
+	if (file != 0)
+	{
+		fputws(text, file);
+		fclose(file);
+	}
+}
+
+int wmain(int argc, wchar_t **argv)
+{
+	bool with_hotkeys = true;
+	bool with_volumeicon = true;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (wcscmp(argv[i], L"--no-hotkeys") == 0)
+			with_hotkeys = false;
+		else if (wcscmp(argv[i], L"--no-volumeicon") == 0)
+			with_volumeicon = false;
+		else if (wcscmp(argv[i], L"--meter") == 0)
+			volumeicon::meter_enabled = TRUE;
+		else if (wcscmp(argv[i], L"--resources") == 0 && i + 1 < argc)
+			resources_path = argv[++i];
+	}
+
+	resources_modules = with_hotkeys && with_volumeicon ? L"hotkeys+volumeicon" : with_hotkeys ? L"hotkeys" : L"volumeicon";
+
+	// the hotkeys parser ignores what it doesn't know, and also starts the
+	// trace for both modules (--trace)
+	if (hotkeys::initialize(argc, argv) != 0 && with_hotkeys)
+		return 1;
+
+	if (hotkeys::trace_enabled)
+	{
+		volumeicon::trace_host_now = hotkeys::trace_now;
+		volumeicon::trace_host_record = hotkeys::trace_record;
+	}
+
+	SetProcessDPIAware();
+
+	if (FAILED(CoInitializeEx(0, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE)))
+		return 1;
+
+	if (with_hotkeys)
+		hotkeys::start();
+	else if (hotkeys::trace_enabled)
+		hotkeys::create_session_window(); // the trace is still written at logoff
+
+	if (with_volumeicon && !volumeicon::StartVolumeIcon(0))
+		with_volumeicon = false;
+
+	int result = 1;
+
+	if (with_hotkeys || with_volumeicon)
+	{
+		report_resources(L"started");
+		result = hotkeys::run(hotkeys::watches);
+		report_resources(L"exiting");
+	}
+
+	if (with_volumeicon)
+		volumeicon::StopVolumeIcon();
+
+	if (with_hotkeys)
+	{
+		hotkeys::stop();
+	}
+	else
+	{
+		hotkeys::destroy_session_window();
+		hotkeys::write_trace();
+	}
+
+	CoUninitialize();
+	return result;
+}
+
+int main()
+{
+	int argc = 0;
+	wchar_t **argv = CommandLineToArgvW(GetCommandLine(), &argc);
+
+	return wmain(argc, argv);
+}
@@ -1,273 +1,2593 @@
 #define UNICODE
+#define NOMINMAX
 #pragma comment(lib, "Shell32.lib")
 #pragma comment(lib, "Ole32.lib")
 
 #include <windows.h>
+#ifdef _WIN32
 #include <initguid.h>
 #include <KnownFolders.h>
 #include <shlobj.h>
+#endif
 #include <vector>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
 
-struct HotKey
+#include "bindings.h"
+#include "keys.h"
+#include "governor.h"
+#include "matcher.h"
+#include "shortcut.h"
+#include "snapshot.h"
+#include "manifest.h"
+#include "platform.h"
+#ifndef _WIN32
+#include "platform_posix.h"
+#endif
+
+static std::vector<std::wstring> roots; // in order of precedence
+static wchar_t *manifest_path = 0;
+static std::vector<HotKey> hotkeys;
+static std::vector<wchar_t> names(1, 0);
+static bool watch_directory = false;
+static std::vector<DirStamp> hotkeys_stamps;
+static bool hook_mode = false;
+static bool prefetch_enabled = false;
+static bool focus_running = false;
+static const wchar_t *storm_path = 0;
+static unsigned storm_rate = 1000;
+static unsigned storm_events = 10000;
+static unsigned storm_files = 10000;
+static UINT_PTR watch_timer = 0;
+static const UINT watch_delay = 250;
+static Governor governor = { 3, 1000, 8 };
+
+// Opt-in phase tracing (--trace <file>). Scopes record into chunks of one
+// buffer allocated when tracing starts; each thread claims a chunk and fills
+// it without locking. The events are written as Chrome trace JSON (for
+// chrome://tracing or Perfetto) at exit, on Ctrl+C or closing the console,
+// and on logoff or shutdown through WM_ENDSESSION to a hidden window (the
+// console logoff event never reaches a process that uses user32). With
+// tracing off a scope only tests trace_enabled.
+
+static const int trace_chunk_events = 256;
+static const int trace_chunk_count = 256;
+
+struct TraceEvent
+{
+	const char *name;
+	long long start; // microseconds since tracing started
+	long long duration;
+};
+
+struct TraceChunk
+{
+	std::atomic<int> count;
+	DWORD thread;
+	TraceEvent events[trace_chunk_events];
+};
+
+static bool trace_enabled = false;
+static const wchar_t *trace_path = 0;
+static TraceChunk *trace_chunks = 0;
+static std::atomic<int> trace_next(0);
+static std::atomic<unsigned> trace_dropped(0);
+static std::chrono::steady_clock::time_point trace_origin;
+static thread_local TraceChunk *trace_chunk = 0;
+
+void start_trace(const wchar_t *path)
+{
+	trace_path = path;
+	trace_chunks = new TraceChunk[trace_chunk_count]();
+	trace_origin = std::chrono::steady_clock::now();
+	trace_enabled = true;
+}
+
+long long trace_now()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - trace_origin).count();
+}
+
+void trace_record(const char *name, long long start)
+{
+	long long end = trace_now();
+	TraceChunk *chunk = trace_chunk;
+
+	if (chunk == 0 || chunk->count.load(std::memory_order_relaxed) == trace_chunk_events)
+	{
+		int index = trace_next.load(std::memory_order_relaxed) < trace_chunk_count ? trace_next++ : trace_chunk_count;
+
+		if (index >= trace_chunk_count)
+		{
+			trace_dropped++;
+			return;
+		}
+
+		chunk = &trace_chunks[index];
+		chunk->thread = GetCurrentThreadId();
+		trace_chunk = chunk;
+	}
+
+	// the writer only reads events below count
+	int n = chunk->count.load(std::memory_order_relaxed);
+	TraceEvent event = { name, start, end - start };
+	chunk->events[n] = event;
+	chunk->count.store(n + 1, std::memory_order_release);
+}
+
+struct TraceScope
+{
+	const char *name;
+	long long start;
+
+	TraceScope(const char *name) : name(name), start(trace_enabled ? trace_now() : 0) {}
+	~TraceScope() { if (trace_enabled) trace_record(name, start); }
+};
+
+#ifdef _WIN32
+void add_default_root(REFKNOWNFOLDERID folder, bool required)
+{
+	TraceScope scope("SHGetKnownFolderPath");
+	wchar_t *base = 0;
+
+	if (SUCCEEDED(SHGetKnownFolderPath(folder, 0, 0, &base)))
+	{
+		std::wstring dir = base;
+		dir += L"\\hotkeys";
+		CoTaskMemFree(base);
+
+		DWORD attr = GetFileAttributes(dir.c_str());
+
+		if (required || (attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY) != 0))
+			roots.push_back(dir);
+	}
+}
+
+#else
+void add_default_root(const char *base, bool required)
+{
+	if (base == 0)
+		return;
+
+	std::wstring dir = compat_widen(base) + L"/hotkeys";
+	DWORD attr = GetFileAttributes(dir.c_str());
+
+	if (required || (attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY) != 0))
+		roots.push_back(dir);
+}
+#endif
+
+int initialize(int argc, wchar_t **argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		if (wcscmp(argv[i], L"--watch") == 0)
+		{
+			watch_directory = true;
+		}
+#ifdef _WIN32
+		else if (wcscmp(argv[i], L"--hook") == 0)
+		{
+			hook_mode = true;
+		}
+#endif
+		else if (wcscmp(argv[i], L"--manifest") == 0 && i + 1 < argc)
+		{
+			manifest_path = argv[++i];
+		}
+		else if (wcscmp(argv[i], L"--prefetch") == 0)
+		{
+			prefetch_enabled = true;
+		}
+		else if (wcscmp(argv[i], L"--focus") == 0)
+		{
+			focus_running = true;
+		}
+		else if (wcscmp(argv[i], L"--rate") == 0 && i + 2 < argc)
+		{
+			governor.burst = (unsigned)_wtoi(argv[++i]);
+			governor.refill = (unsigned)_wtoi(argv[++i]);
+		}
+		else if (wcscmp(argv[i], L"--max-launches") == 0 && i + 1 < argc)
+		{
+			governor.max_pending = (unsigned)std::max(1, _wtoi(argv[++i]));
+		}
+		else if (wcscmp(argv[i], L"--storm") == 0 && i + 1 < argc)
+		{
+			storm_path = argv[++i];
+		}
+		else if (wcscmp(argv[i], L"--storm-rate") == 0 && i + 1 < argc)
+		{
+			storm_rate = (unsigned)std::max(1, _wtoi(argv[++i]));
+		}
+		else if (wcscmp(argv[i], L"--storm-events") == 0 && i + 1 < argc)
+		{
+			storm_events = (unsigned)std::max(1, _wtoi(argv[++i]));
+		}
+		else if (wcscmp(argv[i], L"--storm-files") == 0 && i + 1 < argc)
+		{
+			storm_files = (unsigned)std::max(1, _wtoi(argv[++i]));
+		}
+		else if (wcscmp(argv[i], L"--trace") == 0 && i + 1 < argc)
+		{
+			start_trace(argv[++i]);
+		}
+		else
+		{
+			DWORD attr = GetFileAttributes(argv[i]);
+
+			if (attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY) != 0)
+			{
+				std::wstring dir = argv[i];
+
+				while (dir.size() > 1 && (dir.back() == L'\\' || dir.back() == L'/'))
+					dir.pop_back();
+
+				roots.push_back(dir);
+			}
+		}
+	}
+
+	// without directories on the command line, the user's and then the
+	// machine wide (if it exists) hotkeys directories are used
+	if (roots.empty())
+	{
+#ifdef _WIN32
+		add_default_root(FOLDERID_Profile, true);
+		add_default_root(FOLDERID_ProgramData, false);
+#else
+		add_default_root(getenv("HOME"), true);
+#endif
+	}
+
+	return roots.empty() && storm_path == 0 ? 1 : 0;
+}
+
+#ifdef _WIN32
+bool win32_register_hotkey(int id, UINT modifiers, UINT vk)
+{
+	TraceScope scope("RegisterHotKey");
+
+	// a held chord would otherwise keep posting WM_HOTKEY
+	return RegisterHotKey(0, id, modifiers | MOD_NOREPEAT, vk) != 0;
+}
+
+void win32_unregister_hotkey(int id)
+{
+	UnregisterHotKey(0, id);
+}
+
+void win32_find_files(const wchar_t *directory, void (*found)(const wchar_t *name, bool directory, unsigned long long mtime, void *context), void *context)
+{
+	TraceScope scope("FindFirstFile");
+	std::wstring path = directory;
+	path += + L"\\*";
+
+	WIN32_FIND_DATA ffd;
+	HANDLE hFind = FindFirstFile(path.c_str(), &ffd);
+
+	if (hFind == INVALID_HANDLE_VALUE)
+		return;
+
+	do
+	{
+		bool directory = (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+
+		// skip . and .., and don't follow junctions or symlinks out of the tree
+		if (directory && (wcscmp(ffd.cFileName, L".") == 0 || wcscmp(ffd.cFileName, L"..") == 0 ||
+			(ffd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0))
+			continue;
+
+		ULARGE_INTEGER mtime;
+		mtime.LowPart = ffd.ftLastWriteTime.dwLowDateTime;
+		mtime.HighPart = ffd.ftLastWriteTime.dwHighDateTime;
+
+		found(ffd.cFileName, directory, mtime.QuadPart, context);
+	}
+	while (FindNextFile(hFind, &ffd) != 0);
+
+	FindClose(hFind);
+}
+
+bool win32_read_file(const wchar_t *filename, std::vector<unsigned char> &data)
+{
+	HANDLE hFile = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	DWORD size = GetFileSize(hFile, 0);
+	DWORD read = 0;
+	bool ok = false;
+
+	// shortcuts are small, anything big isn't worth parsing
+	if (size != INVALID_FILE_SIZE && size <= 1024 * 1024)
+	{
+		data.resize(size);
+		ok = size == 0 || (ReadFile(hFile, &data[0], size, &read, 0) && read == size);
+	}
+
+	CloseHandle(hFile);
+	return ok;
+}
+
+bool win32_write_file(const wchar_t *filename, const std::vector<unsigned char> &data)
+{
+	// write a temporary file and swap it in, so readers never see a partial file
+	std::wstring temp = filename;
+	temp += L".tmp";
+
+	HANDLE hFile = CreateFile(temp.c_str(), GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	DWORD written = 0;
+	bool ok = data.empty() || (WriteFile(hFile, &data[0], (DWORD)data.size(), &written, 0) && written == data.size());
+
+	CloseHandle(hFile);
+
+	if (ok)
+		ok = MoveFileEx(temp.c_str(), filename, MOVEFILE_REPLACE_EXISTING) != 0;
+
+	if (!ok)
+		DeleteFile(temp.c_str());
+
+	return ok;
+}
+
+const unsigned char *win32_map_file(const wchar_t *filename, size_t *size)
+{
+	HANDLE hFile = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+
+	if (hFile == INVALID_HANDLE_VALUE)
+		return 0;
+
+	LARGE_INTEGER length;
+	const unsigned char *data = 0;
+
+	if (GetFileSizeEx(hFile, &length) && length.QuadPart > 0 && length.QuadPart < 0x40000000)
+	{
+		HANDLE hMapping = CreateFileMapping(hFile, 0, PAGE_READONLY, 0, 0, 0);
+
+		if (hMapping != 0)
+		{
+			data = (const unsigned char*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+			*size = (size_t)length.QuadPart;
+			CloseHandle(hMapping);
+		}
+	}
+
+	CloseHandle(hFile);
+	return data;
+}
+
+void win32_unmap_file(const unsigned char *data)
+{
+	UnmapViewOfFile(data);
+}
+
+bool win32_directory_stamp(const wchar_t *directory, unsigned long long *stamp)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attr;
+
+	if (!GetFileAttributesEx(directory, GetFileExInfoStandard, &attr))
+		return false;
+
+	ULARGE_INTEGER mtime;
+	mtime.LowPart = attr.ftLastWriteTime.dwLowDateTime;
+	mtime.HighPart = attr.ftLastWriteTime.dwHighDateTime;
+
+	*stamp = mtime.QuadPart;
+	return true;
+}
+
+// A watch is a waitable handle that's signaled when names change anywhere
+// under the directory, and rearmed with next_watch. What changed isn't
+// reported: the reload diffs a fresh scan against the table anyway.
+
+HANDLE win32_open_watch(const wchar_t *directory)
+{
+	HANDLE watch = FindFirstChangeNotification(directory, TRUE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME);
+
+	return watch != INVALID_HANDLE_VALUE ? watch : 0;
+}
+
+void win32_next_watch(HANDLE watch)
+{
+	FindNextChangeNotification(watch);
+}
+
+void win32_close_watch(HANDLE watch)
+{
+	FindCloseChangeNotification(watch);
+}
+
+std::wstring win32_expand(const std::wstring &s)
+{
+	wchar_t buffer[MAX_PATH * 2];
+	DWORD n = ExpandEnvironmentStrings(s.c_str(), buffer, sizeof(buffer) / sizeof(wchar_t));
+
+	return (n != 0 && n <= sizeof(buffer) / sizeof(wchar_t)) ? std::wstring(buffer) : s;
+}
+
+bool win32_create_process(const Shortcut &link)
+{
+	std::wstring target = link.expand ? win32_expand(link.target) : link.target;
+	std::wstring directory = win32_expand(link.directory);
+
+	std::wstring command = L"\"" + target + L"\"";
+
+	if (!link.arguments.empty())
+	{
+		command += L" ";
+		command += link.arguments;
+	}
+
+	STARTUPINFO si = { sizeof(si) };
+	si.dwFlags = STARTF_USESHOWWINDOW;
+	si.wShowWindow = (WORD)link.show;
+
+	PROCESS_INFORMATION pi;
+
+	if (!CreateProcess(target.c_str(), &command[0], 0, 0, FALSE, 0, 0, directory.empty() ? 0 : directory.c_str(), &si, &pi))
+		return false;
+
+	CloseHandle(pi.hThread);
+	CloseHandle(pi.hProcess);
+	return true;
+}
+
+bool win32_launch(const wchar_t *filename, const wchar_t *parameters)
+{
+	return (INT_PTR)ShellExecute(0, L"open", filename, parameters, 0, SW_SHOWNORMAL) > 32;
+}
+
+struct WindowSearch
+{
+	const std::wstring *image;
+	DWORD checked; // last process that didn't match
+	HWND window;
+};
+
+BOOL CALLBACK win32_find_window(HWND hWnd, LPARAM lParam)
+{
+	WindowSearch &search = *(WindowSearch*)lParam;
+	DWORD pid = 0;
+
+	if (!IsWindowVisible(hWnd) || GetWindow(hWnd, GW_OWNER) != 0 || GetWindowThreadProcessId(hWnd, &pid) == 0 || pid == search.checked)
+		return TRUE;
+
+	HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+
+	if (hProcess == 0)
+		return TRUE;
+
+	wchar_t path[MAX_PATH * 2];
+	DWORD size = sizeof(path) / sizeof(wchar_t);
+	bool match = QueryFullProcessImageName(hProcess, 0, path, &size) && _wcsicmp(path, search.image->c_str()) == 0;
+
+	CloseHandle(hProcess);
+
+	if (!match)
+	{
+		search.checked = pid;
+		return TRUE;
+	}
+
+	search.window = hWnd;
+	return FALSE;
+}
+
+// Brings up a top level window of a process running the link's target.
+// Returns false when there's none, so the caller launches instead.
+
+bool win32_focus_running(const Shortcut &link)
+{
+	std::wstring target = link.expand ? win32_expand(link.target) : link.target;
+	WindowSearch search = { &target, 0, 0 };
+
+	EnumWindows(win32_find_window, (LPARAM)&search);
+
+	if (search.window == 0)
+		return false;
+
+	if (IsIconic(search.window))
+		ShowWindow(search.window, SW_RESTORE);
+
+	// even if the foreground lock refuses, another instance isn't wanted
+	SetForegroundWindow(search.window);
+	return true;
+}
+
+// Reads the file (up to limit bytes) just to get it into the file cache,
+// with the thread in background mode so it doesn't compete with foreground
+// I/O.
+
+unsigned long long win32_read_ahead(const wchar_t *filename, unsigned long long limit)
+{
+	HANDLE hFile = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+
+	if (hFile == INVALID_HANDLE_VALUE)
+		return 0;
+
+	static const DWORD chunk = 256 * 1024;
+	std::vector<unsigned char> buffer(chunk);
+	unsigned long long total = 0;
+	DWORD read = 0;
+
+	SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+
+	while (total < limit && ReadFile(hFile, &buffer[0], (DWORD)std::min<unsigned long long>(chunk, limit - total), &read, 0) && read != 0)
+		total += read;
+
+	SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+	CloseHandle(hFile);
+
+	return total;
+}
+
+void win32_thread_init()
+{
+	// ShellExecute may use shell extensions that need an STA
+	CoInitializeEx(0, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
+}
+
+void win32_thread_exit()
+{
+	CoUninitialize();
+}
+
+static const Platform win32_platform = {
+	win32_register_hotkey,
+	win32_unregister_hotkey,
+	win32_find_files,
+	win32_read_file,
+	win32_write_file,
+	win32_map_file,
+	win32_unmap_file,
+	win32_directory_stamp,
+	win32_open_watch,
+	win32_next_watch,
+	win32_close_watch,
+	win32_create_process,
+	win32_launch,
+	win32_focus_running,
+	win32_read_ahead,
+	win32_expand,
+	win32_thread_init,
+	win32_thread_exit
+};
+
+static const Platform *platform = &win32_platform;
+#else
+static const Platform *platform = &posix_platform;
+#endif
+
+// Only the first call writes, whichever of exit and the console handler
+// gets there first; events still being recorded by other threads are left
+// out.
+
+void write_trace()
+{
+	static std::atomic<bool> written(false);
+
+	if (!trace_enabled || written.exchange(true))
+		return;
+
+	std::string json = "{\"traceEvents\":[";
+	char line[256];
+	unsigned pid = (unsigned)GetCurrentProcessId();
+	int chunks = std::min(trace_next.load(), trace_chunk_count);
+	const char *separator = "\n";
+
+	for (int c = 0; c < chunks; c++)
+	{
+		const TraceChunk &chunk = trace_chunks[c];
+		int count = chunk.count.load(std::memory_order_acquire);
+
+		for (int i = 0; i < count; i++)
+		{
+			const TraceEvent &event = chunk.events[i];
+
+			snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%lld,\"dur\":%lld}",
+				separator, event.name, pid, (unsigned)chunk.thread, event.start, event.duration);
+
+			json += line;
+			separator = ",\n";
+		}
+	}
+
+	snprintf(line, sizeof(line), "\n],\"otherData\":{\"dropped\":%u}}\n", trace_dropped.load());
+	json += line;
+
+	platform->write_file(trace_path, std::vector<unsigned char>(json.begin(), json.end()));
+}
+
+#ifdef _WIN32
+BOOL WINAPI trace_console_handler(DWORD type)
+{
+	write_trace();
+	return FALSE;
+}
+
+static HWND session_window = 0;
+
+LRESULT CALLBACK session_proc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
+{
+	// the process may be ended any time after this returns
+	if (message == WM_ENDSESSION && wParam)
+		write_trace();
+
+	return DefWindowProc(hwnd, message, wParam, lParam);
+}
+
+// Hidden top-level window for WM_ENDSESSION, which isn't sent to
+// message-only windows or threads. The loop dispatches its messages.
+void create_session_window()
+{
+	WNDCLASS wc = {0};
+
+	wc.lpfnWndProc = session_proc;
+	wc.hInstance = GetModuleHandle(0);
+	wc.lpszClassName = L"hotkeys_session";
+
+	RegisterClass(&wc);
+	session_window = CreateWindowEx(0, wc.lpszClassName, L"", 0, 0, 0, 0, 0, 0, 0, wc.hInstance, 0);
+}
+
+void destroy_session_window()
+{
+	if (session_window != 0)
+		DestroyWindow(session_window);
+
+	session_window = 0;
+}
+#endif
+
+// Keyboard hook mode. Bindings aren't registered with the system; instead a
+// low level hook feeds every key press to the matcher, which allows key
+// sequences and any number of bindings. The hook only posts WM_HOTKEY for
+// completed bindings, everything else happens in the message loop.
+//
+// The hook runs on a thread of its own that does nothing but pump its
+// messages, so a reload or a stats flush on the loop never holds up input
+// (Windows drops a hook that takes longer than LowLevelHooksTimeout). The
+// loop compiles a new matcher and leaves it in hook_next; the hook thread
+// takes it over before the next key and frees the one it replaces.
+//
+// The hook is Windows only; elsewhere --hook isn't accepted.
+
+static std::atomic<Matcher*> hook_next(0);
+static std::atomic<unsigned> hook_repeats(0); // auto-repeats swallowed by the hook
+
+#ifdef _WIN32
+static Matcher *hook_matcher = 0; // hook thread only
+static std::thread hook_thread;
+static DWORD hook_thread_id = 0;
+static DWORD hook_loop_thread = 0; // where completed bindings are posted
+static UINT hook_modifiers = 0;
+static UINT hook_held = 0; // last key pressed, until it's released
+static bool hook_held_swallowed = false;
+
+bool hook_register_hotkey(int id, UINT modifiers, UINT vk)
+{
+	return id != 0 || win32_register_hotkey(id, modifiers, vk);
+}
+
+void hook_unregister_hotkey(int id)
+{
+	if (id == 0)
+		win32_unregister_hotkey(id);
+}
+#endif
+
+void compile_hotkeys()
+{
+	TraceScope scope("compile_hotkeys");
+	std::vector<int> ids;
+	std::vector<unsigned short> steps;
+	std::vector<int> counts;
+
+	for (int i = 0; i < hotkeys.size(); i++)
+	{
+		const HotKey &hk = hotkeys[i];
+
+		if (hk.name == 0)
+			continue;
+
+		unsigned short sequence[sequence_max];
+		int count = 1;
+
+		// manifest chords are single steps
+		if (hk.manifest)
+		{
+			sequence[0] = (unsigned short)((hk.modifiers << 8) | hk.vk);
+		}
+		else
+		{
+			const wchar_t *name = &names[hk.name];
+			const wchar_t *slash = wcsrchr(name, L'\\');
+
+			if (slash != 0)
+				name = slash + 1;
+
+			count = parse_sequence(name, sequence, sequence_max);
+		}
+
+		if (count > 0)
+		{
+			ids.push_back(hk.id);
+			steps.insert(steps.end(), sequence, sequence + count);
+			counts.push_back(count);
+		}
+	}
+
+	Matcher *compiled = new Matcher();
+	compile_matcher(*compiled, ids, steps, counts);
+
+	// one the hook thread never got to is simply replaced
+	delete hook_next.exchange(compiled);
+}
+
+#ifdef _WIN32
+UINT modifier_flag(DWORD vk)
+{
+	switch (vk)
+	{
+		case VK_SHIFT: case VK_LSHIFT: case VK_RSHIFT: return MOD_SHIFT;
+		case VK_CONTROL: case VK_LCONTROL: case VK_RCONTROL: return MOD_CONTROL;
+		case VK_MENU: case VK_LMENU: case VK_RMENU: return MOD_ALT;
+		case VK_LWIN: case VK_RWIN: return MOD_WIN;
+	}
+
+	return 0;
+}
+
+LRESULT CALLBACK keyboard_proc(int code, WPARAM wParam, LPARAM lParam)
+{
+	if (code == HC_ACTION)
+	{
+		const KBDLLHOOKSTRUCT *key = (const KBDLLHOOKSTRUCT*)lParam;
+		bool down = (wParam == WM_KEYDOWN || wParam == WM_SYSKEYDOWN);
+		UINT modifier = modifier_flag(key->vkCode);
+
+		if (modifier != 0)
+		{
+			if (down)
+				hook_modifiers |= modifier;
+			else
+				hook_modifiers &= ~modifier;
+		}
+		else if (!down)
+		{
+			if (key->vkCode == hook_held)
+				hook_held = 0;
+		}
+		else if (key->vkCode == hook_held)
+		{
+			// auto-repeat, the first press already went through the matcher
+			if (hook_held_swallowed)
+			{
+				hook_repeats.fetch_add(1, std::memory_order_relaxed);
+				return 1;
+			}
+		}
+		else
+		{
+			Matcher *next = hook_next.exchange(0);
+
+			if (next != 0)
+			{
+				delete hook_matcher;
+				hook_matcher = next;
+			}
+
+			int result = hook_matcher != 0 ? match_key(*hook_matcher, hook_modifiers, key->vkCode, key->time) : 0;
+
+			hook_held = key->vkCode;
+			hook_held_swallowed = result != 0;
+
+			if (result > 0)
+				PostThreadMessage(hook_loop_thread, WM_HOTKEY, result, 0);
+
+			// keys that belong to a binding are swallowed, like registered hotkeys
+			if (result != 0)
+				return 1;
+		}
+	}
+
+	return CallNextHookEx(0, code, wParam, lParam);
+}
+
+void hook_worker(HANDLE ready)
+{
+	MSG msg;
+
+	// the queue has to exist before stop_hook can post WM_QUIT to it
+	PeekMessage(&msg, 0, WM_USER, WM_USER, PM_NOREMOVE);
+	hook_thread_id = GetCurrentThreadId();
+
+	HHOOK hook = SetWindowsHookEx(WH_KEYBOARD_LL, keyboard_proc, GetModuleHandle(0), 0);
+	SetEvent(ready);
+
+	while (hook != 0 && GetMessage(&msg, 0, 0, 0) > 0)
+		DispatchMessage(&msg);
+
+	if (hook != 0)
+		UnhookWindowsHookEx(hook);
+
+	delete hook_matcher;
+	hook_matcher = 0;
+}
+
+// Installs the hook on its own thread; completed bindings are posted to the
+// calling thread.
+void start_hook()
+{
+	HANDLE ready = CreateEvent(0, FALSE, FALSE, 0);
+
+	hook_loop_thread = GetCurrentThreadId();
+	hook_thread = std::thread(hook_worker, ready);
+
+	WaitForSingleObject(ready, INFINITE);
+	CloseHandle(ready);
+}
+
+void stop_hook()
+{
+	if (!hook_thread.joinable())
+		return;
+
+	PostThreadMessage(hook_thread_id, WM_QUIT, 0, 0);
+	hook_thread.join();
+
+	delete hook_next.exchange(0);
+}
+#endif
+
+// Counters for every binding, indexed by id. They live in fixed chunks that
+// are never moved or freed, so the message loop and the launch workers update
+// them without locks while reloads hand out new ids. Latency bucket n counts
+// launches that took less than 2^n microseconds (the last one is open ended).
+
+static const int stats_chunk = 1024;
+static const int latency_buckets = 24;
+
+struct BindingStats
+{
+	std::atomic<unsigned> presses;
+	std::atomic<unsigned> launches;
+	std::atomic<unsigned> failures;
+	std::atomic<unsigned> limited; // presses the governor didn't let through
+	std::atomic<unsigned> latency[latency_buckets];
+};
+
+// only touched by the message loop; scan counts are for the last reload
+struct ReloadStats
+{
+	unsigned reloads;
+	unsigned files;
+	unsigned rejects;
+	unsigned duplicates;
+	unsigned register_failures;
+	unsigned register_skipped; // known to fail, still backing off
+	unsigned long long last_us;
+	unsigned long long total_us;
+};
+
+static std::atomic<BindingStats*> binding_stats[snapshot_max_id / stats_chunk];
+static ReloadStats reload_stats = {};
+
+BindingStats *find_stats(int id)
+{
+	if (id <= 0 || id > snapshot_max_id)
+		return 0;
+
+	BindingStats *chunk = binding_stats[(id - 1) / stats_chunk].load(std::memory_order_acquire);
+	return chunk != 0 ? &chunk[(id - 1) % stats_chunk] : 0;
+}
+
+// called from the message loop whenever an id gets a new binding
+void reset_stats(int id)
+{
+	if (id <= 0 || id > snapshot_max_id)
+		return;
+
+	// a reused id starts with a full bucket
+	if (id < governor.empty_at.size())
+		governor.empty_at[id] = 0;
+
+	std::atomic<BindingStats*> &slot = binding_stats[(id - 1) / stats_chunk];
+	BindingStats *chunk = slot.load(std::memory_order_relaxed);
+
+	if (chunk == 0)
+	{
+		chunk = new BindingStats[stats_chunk]();
+		slot.store(chunk, std::memory_order_release);
+		return;
+	}
+
+	BindingStats &stats = chunk[(id - 1) % stats_chunk];
+	stats.presses.store(0, std::memory_order_relaxed);
+	stats.launches.store(0, std::memory_order_relaxed);
+	stats.failures.store(0, std::memory_order_relaxed);
+	stats.limited.store(0, std::memory_order_relaxed);
+
+	for (int i = 0; i < latency_buckets; i++)
+		stats.latency[i].store(0, std::memory_order_relaxed);
+}
+
+void record_launch(int id, bool ok, unsigned long long us)
+{
+	BindingStats *stats = find_stats(id);
+
+	if (stats == 0)
+		return;
+
+	int bucket = 0;
+
+	while (bucket < latency_buckets - 1 && (us >> bucket) != 0)
+		bucket++;
+
+	(ok ? stats->launches : stats->failures).fetch_add(1, std::memory_order_relaxed);
+	stats->latency[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+// The link to launch or prefetch, copied out of the names arena so it
+// outlives the next reload.
+
+Shortcut binding_link(const HotKey &hk)
+{
+	Shortcut link;
+
+	link.target = &names[hk.target];
+	link.arguments = &names[hk.arguments];
+	link.directory = &names[hk.directory];
+	link.show = hk.show;
+	link.expand = hk.expand;
+
+	return link;
+}
+
+// Optional read-ahead of launch targets (--prefetch). After every reload a
+// background thread reads the executables of resolved bindings, most
+// pressed first, so a launch doesn't wait on a cold disk. For the first few
+// it also reads the DLLs they import that sit next to them. A pass stops
+// after prefetch_budget bytes, and is abandoned when a newer one is queued.
+
+static const unsigned long long prefetch_budget = 64 * 1024 * 1024;
+static const int prefetch_dll_targets = 8;
+
+struct PrefetchStats
+{
+	std::atomic<unsigned> passes;
+	std::atomic<unsigned> files;
+	std::atomic<unsigned long long> bytes;
+};
+
+static std::mutex prefetch_lock;
+static std::condition_variable prefetch_ready;
+static std::vector<Shortcut> prefetch_pending;
+static std::atomic<unsigned> prefetch_generation(0);
+static bool prefetch_stopping = false;
+static std::thread prefetch_thread;
+static PrefetchStats prefetch_stats = {};
+
+bool prefetch_file(const std::wstring &path, std::unordered_set<std::wstring> &seen, unsigned long long &budget)
+{
+	std::wstring key = path;
+	std::transform(key.begin(), key.end(), key.begin(), towlower);
+
+	if (!seen.insert(key).second)
+		return false;
+
+	unsigned long long read = platform->read_ahead(path.c_str(), budget);
+
+	if (read == 0)
+		return false;
+
+	budget -= std::min(read, budget);
+	prefetch_stats.files++;
+	prefetch_stats.bytes += read;
+	return true;
+}
+
+void prefetch_targets(const std::vector<Shortcut> &targets, unsigned generation)
+{
+	TraceScope scope("prefetch");
+
+	std::unordered_set<std::wstring> seen;
+	std::vector<std::wstring> dlls;
+	unsigned long long budget = prefetch_budget;
+	int images = 0;
+
+	for (int i = 0; i < targets.size() && budget > 0 && generation == prefetch_generation; i++)
+	{
+		std::wstring path = targets[i].expand ? platform->expand(targets[i].target) : targets[i].target;
+
+		if (!prefetch_file(path, seen, budget) || images++ >= prefetch_dll_targets)
+			continue;
+
+		// only DLLs next to the executable, system ones are most likely cached already
+		size_t slash = path.find_last_of(L"\\/");
+		size_t size = 0;
+		const unsigned char *data = slash != std::wstring::npos ? platform->map_file(path.c_str(), &size) : 0;
+
+		if (data == 0)
+			continue;
+
+		dlls.clear();
+		parse_imports(data, size, dlls);
+		platform->unmap_file(data);
+
+		for (int j = 0; j < dlls.size() && budget > 0; j++)
+		{
+			// api sets are resolved by the loader, they're never files
+			if (_wcsnicmp(dlls[j].c_str(), L"api-ms-", 7) != 0 && _wcsnicmp(dlls[j].c_str(), L"ext-ms-", 7) != 0)
+				prefetch_file(path.substr(0, slash + 1) + dlls[j], seen, budget);
+		}
+	}
+
+	prefetch_stats.passes++;
+}
+
+void prefetch_worker()
+{
+	std::unique_lock<std::mutex> lock(prefetch_lock);
+
+	for (;;)
+	{
+		while (!prefetch_stopping && prefetch_pending.empty())
+			prefetch_ready.wait(lock);
+
+		if (prefetch_stopping)
+			break;
+
+		std::vector<Shortcut> targets;
+		targets.swap(prefetch_pending);
+		unsigned generation = prefetch_generation;
+
+		lock.unlock();
+		prefetch_targets(targets, generation);
+		lock.lock();
+	}
+}
+
+// called from the message loop after the bindings changed
+void queue_prefetch()
+{
+	if (!prefetch_enabled)
+		return;
+
+	std::vector<std::pair<unsigned, int>> ranked;
+
+	for (int i = 0; i < hotkeys.size(); i++)
+	{
+		if (hotkeys[i].name != 0 && hotkeys[i].resolved)
+		{
+			const BindingStats *stats = find_stats(hotkeys[i].id);
+			ranked.push_back(std::make_pair(stats != 0 ? stats->presses.load(std::memory_order_relaxed) : 0, i));
+		}
+	}
+
+	std::stable_sort(ranked.begin(), ranked.end(), [](const std::pair<unsigned, int> &a, const std::pair<unsigned, int> &b) {
+		return a.first > b.first;
+	});
+
+	std::vector<Shortcut> targets;
+	targets.reserve(ranked.size());
+
+	for (int i = 0; i < ranked.size(); i++)
+		targets.push_back(binding_link(hotkeys[ranked[i].second]));
+
+	{
+		std::lock_guard<std::mutex> lock(prefetch_lock);
+		prefetch_pending.swap(targets);
+		prefetch_generation++;
+	}
+
+	prefetch_ready.notify_one();
+}
+
+void start_prefetch()
+{
+	if (prefetch_enabled)
+		prefetch_thread = std::thread(prefetch_worker);
+}
+
+void stop_prefetch()
+{
+	if (!prefetch_thread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(prefetch_lock);
+		prefetch_stopping = true;
+		prefetch_generation++;
+	}
+
+	prefetch_ready.notify_all();
+	prefetch_thread.join();
+}
+
+// Chords are dense, 4 modifier bits by 256 virtual keys, so duplicates are
+// found with a bitmap while the scan results are merged and never reach
+// RegisterHotKey. Chords that fail to register (another program owns them)
+// aren't retried before their backoff runs out, which doubles on every
+// failure up to register_backoff_max.
+
+static const unsigned chord_count = 16 * 256;
+static const int duplicate_reports = 32;
+static const unsigned register_backoff_min = 5000;
+static const unsigned register_backoff_max = 10 * 60 * 1000;
+
+struct ChordIndex
+{
+	unsigned long long bits[chord_count / 64];
+};
+
+struct RegisterFailure
+{
+	unsigned long long retry_at;
+	unsigned backoff;
+};
+
+static RegisterFailure failed_chords[chord_count] = {};
+
+unsigned chord_of(UINT modifiers, UINT vk)
+{
+	return ((modifiers & 0xF) << 8) | (vk & 0xFF);
+}
+
+// returns whether the chord was already in the index
+bool claim_chord(ChordIndex &index, unsigned chord)
+{
+	unsigned long long mask = 1ull << (chord & 63);
+	bool taken = (index.bits[chord >> 6] & mask) != 0;
+
+	index.bits[chord >> 6] |= mask;
+	return taken;
+}
+
+void append_chord(std::wstring &text, UINT modifiers, UINT vk)
+{
+	if (modifiers & MOD_WIN) text += L"Win+";
+	if (modifiers & MOD_CONTROL) text += L"Ctrl+";
+	if (modifiers & MOD_ALT) text += L"Alt+";
+	if (modifiers & MOD_SHIFT) text += L"Shift+";
+
+	const wchar_t *name = 0;
+	int len = key_name(vk, &name);
+
+	if (len != 0)
+	{
+		text.append(name, len);
+	}
+	else
+	{
+		wchar_t code[8];
+		swprintf(code, 8, L"0x%02X", vk);
+		text += code;
+	}
+}
+
+void report_duplicate(const std::wstring &path, UINT modifiers, UINT vk)
+{
+	if (reload_stats.duplicates++ >= duplicate_reports)
+		return;
+
+	std::wstring text = L"hotkeys: " + path + L": ";
+	append_chord(text, modifiers, vk);
+	text += reload_stats.duplicates == duplicate_reports ? L" is already bound (not reporting further duplicates)\n" : L" is already bound\n";
+
+	OutputDebugString(text.c_str());
+}
+
+unsigned long long now_ms()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// RegisterHotKey through the failure cache
+bool register_chord(int id, UINT modifiers, UINT vk, unsigned long long now)
+{
+	RegisterFailure &failure = failed_chords[chord_of(modifiers, vk)];
+
+	if (failure.backoff != 0 && now < failure.retry_at)
+	{
+		reload_stats.register_skipped++;
+		return false;
+	}
+
+	if (platform->register_hotkey(id, modifiers, vk))
+	{
+		failure.backoff = 0;
+		return true;
+	}
+
+	failure.backoff = failure.backoff == 0 ? register_backoff_min : std::min(failure.backoff * 2, register_backoff_max);
+	failure.retry_at = now + failure.backoff;
+	reload_stats.register_failures++;
+	return false;
+}
+
+// Each root is scanned recursively on its own thread into a ScanResult, and
+// the results are merged in root order afterwards.
+
+static const int scan_threads = 4;
+
+struct ScanResult
+{
+	std::vector<HotKey> found;
+	std::vector<wchar_t> names;
+	std::vector<DirStamp> stamps;
+	unsigned files;
+	unsigned rejects;
+};
+
+struct ScanContext
+{
+	ScanResult *result;
+	int root;
+	const std::wstring *subdir;
+	std::vector<std::wstring> *pending;
+};
+
+void add_stamp(std::vector<DirStamp> &stamps, const std::wstring &path)
+{
+	DirStamp stamp = { path, 0 };
+
+	if (!platform->directory_stamp(path.c_str(), &stamp.mtime))
+		stamp.mtime = 0;
+
+	stamps.push_back(stamp);
+}
+
+void add_shortcut(const wchar_t *name, bool directory, unsigned long long mtime, void *context)
+{
+	ScanContext &scan = *(ScanContext*)context;
+	HotKey hk = {0};
+
+	if (directory)
+	{
+		std::wstring subdir = scan.subdir->empty() ? name : *scan.subdir + L"\\" + name;
+
+		// stamped before it's listed, same as the root
+		add_stamp(scan.result->stamps, roots[scan.root] + L"\\" + subdir);
+		scan.pending->push_back(subdir);
+		return;
+	}
+
+	scan.result->files++;
+
+	if (!parse_filename(name, &hk.modifiers, &hk.vk))
+	{
+		scan.result->rejects++;
+		return;
+	}
+
+	std::vector<wchar_t> &arena = scan.result->names;
+
+	hk.root = scan.root;
+	hk.mtime = mtime;
+	hk.name = (unsigned)arena.size();
+
+	if (!scan.subdir->empty())
+	{
+		arena.insert(arena.end(), scan.subdir->begin(), scan.subdir->end());
+		arena.push_back(L'\\');
+	}
+
+	arena.insert(arena.end(), name, name + wcslen(name) + 1);
+	scan.result->found.push_back(hk);
+}
+
+void scan_root(int root, ScanResult &result)
+{
+	TraceScope scope("scan_root");
+	std::vector<std::wstring> pending(1, std::wstring());
+
+	result.names.assign(1, 0);
+	add_stamp(result.stamps, roots[root]);
+
+	while (!pending.empty())
+	{
+		std::wstring subdir = pending.back();
+		pending.pop_back();
+
+		std::wstring path = subdir.empty() ? roots[root] : roots[root] + L"\\" + subdir;
+		ScanContext context = { &result, root, &subdir, &pending };
+
+		platform->find_files(path.c_str(), add_shortcut, &context);
+	}
+
+	// listing order depends on the file system, sort to make precedence stable
+	const std::vector<wchar_t> &arena = result.names;
+
+	std::sort(result.found.begin(), result.found.end(), [&arena](const HotKey &a, const HotKey &b) {
+		return _wcsicmp(&arena[a.name], &arena[b.name]) < 0;
+	});
+}
+
+// returns the number of lines that were rejected
+int load_manifest(std::vector<HotKey> &found, std::vector<wchar_t> &arena)
+{
+	TraceScope scope("load_manifest");
+	size_t size = 0;
+	const unsigned char *data = platform->map_file(manifest_path, &size);
+
+	if (data == 0)
+		return 0;
+
+	std::vector<ManifestError> errors;
+	parse_manifest(data, size, found, arena, errors);
+	platform->unmap_file(data);
+
+	for (int i = 0; i < errors.size(); i++)
+	{
+		wchar_t text[512];
+		swprintf(text, 512, L"hotkeys: %ls(%d,%d): %ls\n", manifest_path, errors[i].line, errors[i].column, errors[i].message);
+		OutputDebugString(text);
+	}
+
+	return (int)errors.size();
+}
+
+// Scans every root (in parallel) and the manifest into found, with names in
+// arena. Roots take precedence in order, then the manifest: unless the hook
+// mode is on, a chord is only kept for the first binding that uses it.
+
+void scan_hotkeys(std::vector<HotKey> &found, std::vector<wchar_t> &arena, std::vector<DirStamp> &stamps)
+{
+	TraceScope scope("scan_hotkeys");
+	std::vector<ScanResult> results(roots.size());
+	std::vector<std::thread> threads;
+	std::atomic<int> next(0);
+
+	auto scan = [&]() {
+		for (int i = next++; i < (int)roots.size(); i = next++)
+			scan_root(i, results[i]);
+	};
+
+	for (int i = 1; i < scan_threads && i < roots.size(); i++)
+		threads.push_back(std::thread(scan));
+
+	scan();
+
+	for (int i = 0; i < threads.size(); i++)
+		threads[i].join();
+
+	ChordIndex taken = {};
+
+	arena.assign(1, 0);
+	stamps.clear();
+
+	reload_stats.files = 0;
+	reload_stats.rejects = 0;
+	reload_stats.duplicates = 0;
+
+	for (int r = 0; r < results.size(); r++)
+	{
+		const ScanResult &result = results[r];
+
+		stamps.insert(stamps.end(), result.stamps.begin(), result.stamps.end());
+		reload_stats.files += result.files;
+		reload_stats.rejects += result.rejects;
+
+		for (int i = 0; i < result.found.size(); i++)
+		{
+			HotKey hk = result.found[i];
+
+			// the hook mode allows them, sequences share their first chord
+			if (claim_chord(taken, chord_of(hk.modifiers, hk.vk)) && !hook_mode)
+			{
+				report_duplicate(roots[r] + L"\\" + &result.names[hk.name], hk.modifiers, hk.vk);
+				continue;
+			}
+
+			const wchar_t *name = &result.names[hk.name];
+			hk.name = (unsigned)arena.size();
+			arena.insert(arena.end(), name, name + wcslen(name) + 1);
+
+			found.push_back(hk);
+		}
+	}
+
+	if (manifest_path != 0)
+	{
+		add_stamp(stamps, manifest_path);
+
+		size_t first = found.size();
+		reload_stats.rejects += load_manifest(found, arena);
+
+		if (!hook_mode)
+		{
+			size_t kept = first;
+
+			for (size_t i = first; i < found.size(); i++)
+			{
+				if (claim_chord(taken, chord_of(found[i].modifiers, found[i].vk)))
+					report_duplicate(std::wstring(manifest_path) + L": " + &arena[found[i].name], found[i].modifiers, found[i].vk);
+				else
+					found[kept++] = std::move(found[i]);
+			}
+
+			found.resize(kept);
+		}
+	}
+}
+
+std::wstring binding_path(const HotKey &hk)
+{
+	if (hk.manifest)
+		return &names[hk.name];
+
+	return roots[hk.root] + L"\\" + &names[hk.name];
+}
+
+// Identifies a binding across reloads. A shortcut is its root and path; a
+// manifest entry is its whole definition, so editing a line replaces it.
+
+std::wstring binding_key(const HotKey &hk, const std::vector<wchar_t> &arena)
+{
+	wchar_t prefix[32];
+
+	if (!hk.manifest)
+	{
+		swprintf(prefix, 32, L"%d\n", hk.root);
+		return prefix + std::wstring(&arena[hk.name]);
+	}
+
+	swprintf(prefix, 32, L"*\n%u\n", (hk.modifiers << 16) | hk.vk);
+	return prefix + std::wstring(&arena[hk.name]) + L"\n" + &arena[hk.arguments];
+}
+
+std::vector<std::wstring> binding_sources()
+{
+	std::vector<std::wstring> sources = roots;
+
+	if (manifest_path != 0)
+		sources.push_back(manifest_path);
+
+	return sources;
+}
+
+// Parses the .lnk once so presses can create the process directly; links
+// that aren't a plain executable keep going through ShellExecute and don't
+// keep anything in the arena.
+
+void resolve_hotkey(HotKey &hk)
+{
+	if (hk.manifest)
+		return;
+
+	TraceScope scope("resolve_hotkey");
+	std::vector<unsigned char> data;
+	Shortcut link;
+
+	hk.resolved = platform->read_file(binding_path(hk).c_str(), data) &&
+		!data.empty() && parse_shortcut(&data[0], data.size(), &link) &&
+		is_executable(link.target.c_str());
+
+	if (!hk.resolved)
+	{
+		hk.target = hk.arguments = hk.directory = 0;
+		return;
+	}
+
+	hk.show = link.show;
+	hk.expand = link.expand;
+	hk.target = add_string(names, link.target.c_str(), link.target.size());
+	hk.arguments = add_string(names, link.arguments.c_str(), link.arguments.size());
+	hk.directory = add_string(names, link.directory.c_str(), link.directory.size());
+}
+
+std::wstring state_path(const wchar_t *extension)
+{
+	// next to the first root, not inside it where --watch would see it change
+	std::wstring path = roots[0];
+
+	while (!path.empty() && (path.back() == L'\\' || path.back() == L'/'))
+		path.pop_back();
+
+	path += extension;
+	return path;
+}
+
+std::wstring snapshot_path()
+{
+	return state_path(L".snapshot");
+}
+
+unsigned snapshot_mode()
+{
+	return hook_mode ? snapshot_mode_hook : snapshot_mode_registered;
+}
+
+void save_snapshot()
+{
+	TraceScope scope("save_snapshot");
+	std::vector<unsigned char> data;
+	write_snapshot(hotkeys, names, snapshot_mode(), binding_sources(), hotkeys_stamps, data);
+	platform->write_file(snapshot_path().c_str(), data);
+}
+
+// Rescans and applies only the difference to the registered hotkeys. Each id
+// is its slot in the hotkeys vector plus one; removed slots are left empty
+// and reused, so existing bindings keep their ids.
+
+void reload_hotkeys()
+{
+	TraceScope scope("reload_hotkeys");
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	std::vector<HotKey> found;
+	std::vector<wchar_t> arena;
+	scan_hotkeys(found, arena, hotkeys_stamps);
+
+	std::unordered_map<std::wstring, int> current;
+
+	for (int i = 0; i < hotkeys.size(); i++)
+	{
+		if (hotkeys[i].name != 0)
+			current[binding_key(hotkeys[i], names)] = i;
+	}
+
+	std::vector<bool> keep(hotkeys.size(), false);
+	std::vector<HotKey*> added;
+	std::vector<int> changed;
+
+	for (int i = 0; i < found.size(); i++)
+	{
+		std::unordered_map<std::wstring, int>::iterator it = current.find(binding_key(found[i], arena));
+
+		if (it != current.end())
+		{
+			HotKey &hk = hotkeys[it->second];
+			keep[it->second] = true;
+
+			// same name, now at its offset in the new arena
+			hk.name = found[i].name;
+
+			if (hk.manifest)
+			{
+				hk.target = found[i].target;
+				hk.arguments = found[i].arguments;
+			}
+			else if (hk.mtime == found[i].mtime)
+			{
+				hk.target = copy_string(arena, names, hk.target);
+				hk.arguments = copy_string(arena, names, hk.arguments);
+				hk.directory = copy_string(arena, names, hk.directory);
+			}
+			else
+			{
+				hk.mtime = found[i].mtime;
+				changed.push_back(it->second);
+			}
+		}
+		else
+		{
+			added.push_back(&found[i]);
+		}
+	}
+
+	// every live binding refers to the new arena from here on
+	names.swap(arena);
+
+	for (int i = 0; i < changed.size(); i++)
+		resolve_hotkey(hotkeys[changed[i]]);
+
+	// a file renamed without changing its chord just takes over the old slot,
+	// which stays registered. Every binding that's gone is cleared first and
+	// its slot listed under its chord; in hook mode several (sequences with
+	// the same first step) can share one, so each chord keeps all of them.
+
+	std::unordered_map<UINT, std::vector<int>> removed;
+
+	for (int i = 0; i < hotkeys.size(); i++)
+	{
+		if (!keep[i] && hotkeys[i].name != 0)
+		{
+			removed[(hotkeys[i].modifiers << 16) | hotkeys[i].vk].push_back(i);
+			hotkeys[i].name = 0;
+		}
+	}
+
+	std::vector<HotKey*> unmatched;
+
+	for (int i = 0; i < added.size(); i++)
+	{
+		std::unordered_map<UINT, std::vector<int>>::iterator it = removed.find((added[i]->modifiers << 16) | added[i]->vk);
+
+		if (it != removed.end() && !it->second.empty())
+		{
+			HotKey &hk = hotkeys[it->second.back()];
+			int id = hk.id;
+
+			hk = *added[i];
+			hk.id = id;
+			resolve_hotkey(hk);
+			reset_stats(id);
+
+			it->second.pop_back();
+		}
+		else
+		{
+			unmatched.push_back(added[i]);
+		}
+	}
+
+	for (std::unordered_map<UINT, std::vector<int>>::iterator it = removed.begin(); it != removed.end(); ++it)
+	{
+		for (int i = 0; i < it->second.size(); i++)
+			platform->unregister_hotkey(hotkeys[it->second[i]].id);
+	}
+
+	int slot = 0;
+	unsigned long long now = now_ms();
+
+	reload_stats.register_failures = 0;
+	reload_stats.register_skipped = 0;
+
+	for (int i = 0; i < unmatched.size(); i++)
+	{
+		while (slot < hotkeys.size() && hotkeys[slot].name != 0)
+			slot++;
+
+		HotKey &hk = *unmatched[i];
+		hk.id = slot + 1;
+
+		if (register_chord(hk.id, hk.modifiers, hk.vk, now))
+		{
+			if (slot < hotkeys.size())
+				hotkeys[slot] = hk;
+			else
+				hotkeys.push_back(hk);
+
+			resolve_hotkey(hotkeys[slot]);
+			reset_stats(hk.id);
+		}
+	}
+
+	while (!hotkeys.empty() && hotkeys.back().name == 0)
+		hotkeys.pop_back();
+
+	// new ids start with a full bucket, so dispatch never has to grow it
+	governor.empty_at.resize(hotkeys.size() + 1, 0);
+
+	if (hook_mode)
+		compile_hotkeys();
+
+	save_snapshot();
+	queue_prefetch();
+
+	std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+
+	reload_stats.reloads++;
+	reload_stats.last_us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+	reload_stats.total_us += reload_stats.last_us;
+}
+
+// Registers the bindings from the snapshot when none of the scanned
+// directories changed since it was written, otherwise falls back to a full
+// scan. Shortcuts edited in place don't touch their directory's stamp;
+// they're picked up by a reload.
+
+void load_hotkeys()
+{
+	TraceScope scope("load_hotkeys");
+	std::wstring path = snapshot_path();
+	size_t size = 0;
+	const unsigned char *data = platform->map_file(path.c_str(), &size);
+
+	if (data != 0)
+	{
+		std::vector<HotKey> table;
+		std::vector<wchar_t> arena;
+		std::vector<DirStamp> stamps;
+
+		bool ok = false;
+
+		{
+			TraceScope scope("read_snapshot");
+			ok = read_snapshot(data, size, snapshot_mode(), binding_sources(), (int)roots.size(), table, arena, stamps);
+		}
+
+		platform->unmap_file(data);
+
+		for (int i = 0; ok && i < stamps.size(); i++)
+		{
+			unsigned long long mtime = 0;
+
+			if (!platform->directory_stamp(stamps[i].path.c_str(), &mtime))
+				mtime = 0;
+
+			ok = mtime == stamps[i].mtime;
+		}
+
+		if (ok)
+		{
+			hotkeys.swap(table);
+			names.swap(arena);
+			hotkeys_stamps.swap(stamps);
+
+			unsigned long long now = now_ms();
+
+			for (int i = 0; i < hotkeys.size(); i++)
+			{
+				HotKey &hk = hotkeys[i];
+
+				if (hk.name == 0)
+					continue;
+
+				if (register_chord(hk.id, hk.modifiers, hk.vk, now))
+					reset_stats(hk.id);
+				else
+					hk.name = 0;
+			}
+
+			while (!hotkeys.empty() && hotkeys.back().name == 0)
+				hotkeys.pop_back();
+
+			governor.empty_at.resize(hotkeys.size() + 1, 0);
+
+			if (hook_mode)
+				compile_hotkeys();
+
+			queue_prefetch();
+			return;
+		}
+	}
+
+	reload_hotkeys();
+}
+
+// Launches run on a small pool of worker threads so a slow target (network
+// path, cold shell extension) never blocks the message loop. The loop only
+// queues requests; a binding can't have more than launch_inflight_limit
+// launches queued or running, and the queue itself is bounded.
+
+static const int launch_workers = 4;
+static const int launch_queue_limit = 64;
+static const int launch_inflight_limit = 2;
+
+struct LaunchRequest
 {
 	int id;
-	UINT modifiers;
-	UINT vk;
 	std::wstring filename;
+	bool resolved;
+	bool manifest;
+	Shortcut link;
+};
+
+struct LaunchStats
+{
+	std::atomic<unsigned> queued;
+	std::atomic<unsigned> dropped;
+	std::atomic<unsigned> launched;
+	std::atomic<unsigned> queue_depth;
+	std::atomic<unsigned> max_queue_depth;
+	std::atomic<unsigned long long> total_time_us;
+	std::atomic<unsigned long long> max_time_us;
+	std::atomic<unsigned> focused;
+	std::atomic<unsigned> pending; // queued or running
 };
 
-static wchar_t *hotkeys_directory = 0;
-static std::vector<HotKey> hotkeys;
+static std::mutex launch_lock;
+static std::condition_variable launch_ready;
+static std::deque<LaunchRequest> launch_queue;
+static std::vector<int> launch_inflight;
+static std::vector<std::thread> launch_threads;
+static bool launch_stopping = false;
+static LaunchStats launch_stats = {};
+
+void update_max(std::atomic<unsigned long long> &max, unsigned long long value)
+{
+	unsigned long long current = max.load(std::memory_order_relaxed);
+
+	while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed));
+}
+
+void perform_launch(const LaunchRequest &request)
+{
+	// with --focus a press brings up the running instance instead of another one
+	if (focus_running && request.resolved)
+	{
+		TraceScope scope("focus");
+
+		if (platform->focus_running(request.link))
+		{
+			launch_stats.focused++;
+			return;
+		}
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	bool ok = false;
+
+	{
+		TraceScope scope("launch");
+		ok = request.resolved && platform->create_process(request.link);
+
+		if (!ok)
+		{
+			const wchar_t *parameters = request.manifest && !request.link.arguments.empty() ? request.link.arguments.c_str() : 0;
+			ok = platform->launch(request.filename.c_str(), parameters);
+		}
+	}
+
+	std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+
+	unsigned long long us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+	launch_stats.launched++;
+	launch_stats.total_time_us += us;
+	update_max(launch_stats.max_time_us, us);
+	record_launch(request.id, ok, us);
+}
+
+void launch_worker()
+{
+	platform->thread_init();
+
+	std::unique_lock<std::mutex> lock(launch_lock);
+
+	for (;;)
+	{
+		while (!launch_stopping && launch_queue.empty())
+			launch_ready.wait(lock);
+
+		if (launch_stopping)
+			break;
+
+		LaunchRequest request = launch_queue.front();
+		launch_queue.pop_front();
+		launch_stats.queue_depth = (unsigned)launch_queue.size();
+
+		lock.unlock();
+
+		perform_launch(request);
+		launch_stats.pending--;
+
+		lock.lock();
+		launch_inflight[request.id]--;
+	}
+
+	lock.unlock();
+	platform->thread_exit();
+}
+
+void start_launchers()
+{
+	for (int i = 0; i < launch_workers; i++)
+		launch_threads.push_back(std::thread(launch_worker));
+}
+
+void stop_launchers()
+{
+	{
+		std::lock_guard<std::mutex> lock(launch_lock);
+		launch_stopping = true;
+	}
+
+	launch_ready.notify_all();
+
+	for (int i = 0; i < launch_threads.size(); i++)
+		launch_threads[i].join();
+
+	launch_threads.clear();
+}
+
+bool queue_launch(const HotKey &hk)
+{
+	{
+		std::lock_guard<std::mutex> lock(launch_lock);
+
+		if (launch_inflight.size() <= hk.id)
+			launch_inflight.resize(hk.id + 1, 0);
+
+		if (launch_queue.size() >= launch_queue_limit || launch_inflight[hk.id] >= launch_inflight_limit)
+		{
+			launch_stats.dropped++;
+			return false;
+		}
+
+		LaunchRequest request = { hk.id, binding_path(hk), hk.resolved, hk.manifest, binding_link(hk) };
+		launch_queue.push_back(request);
+		launch_inflight[hk.id]++;
+		launch_stats.pending++;
 
-int map_key(const wchar_t *keyname, int len)
-{
-	struct KeyInfo {
-		wchar_t *name;
-		int code;
-	};
+		unsigned depth = (unsigned)launch_queue.size();
+		launch_stats.queue_depth = depth;
 
-	static KeyInfo map[] = {
-		{L"VK_LBUTTON",             0x01}, {L"VK_RBUTTON",             0x02}, {L"VK_CANCEL",              0x03},
-		{L"VK_MBUTTON",             0x04}, {L"VK_XBUTTON1",            0x05}, {L"VK_XBUTTON2",            0x06},
-		{L"VK_BACK",                0x08}, {L"VK_TAB",                 0x09}, {L"VK_CLEAR",               0x0C},
-		{L"VK_RETURN",              0x0D}, {L"VK_SHIFT",               0x10}, {L"VK_CONTROL",             0x11},
-		{L"VK_MENU",                0x12}, {L"VK_PAUSE",               0x13}, {L"VK_CAPITAL",             0x14},
-		{L"VK_KANA",                0x15}, {L"VK_HANGEUL",             0x15}, {L"VK_HANGUL",              0x15},
-		{L"VK_JUNJA",               0x17}, {L"VK_FINAL",               0x18}, {L"VK_HANJA",               0x19},
-		{L"VK_KANJI",               0x19}, {L"VK_ESCAPE",              0x1B}, {L"VK_CONVERT",             0x1C},
-		{L"VK_NONCONVERT",          0x1D}, {L"VK_ACCEPT",              0x1E}, {L"VK_MODECHANGE",          0x1F},
-		{L"VK_SPACE",               0x20}, {L"VK_PRIOR",               0x21}, {L"VK_NEXT",                0x22},
-		{L"VK_END",                 0x23}, {L"VK_HOME",                0x24}, {L"VK_LEFT",                0x25},
-		{L"VK_UP",                  0x26}, {L"VK_RIGHT",               0x27}, {L"VK_DOWN",                0x28},
-		{L"VK_SELECT",              0x29}, {L"VK_PRINT",               0x2A}, {L"VK_EXECUTE",             0x2B},
-		{L"VK_SNAPSHOT",            0x2C}, {L"VK_INSERT",              0x2D}, {L"VK_DELETE",              0x2E},
-		{L"VK_HELP",                0x2F}, {L"VK_LWIN",                0x5B}, {L"VK_RWIN",                0x5C},
-		{L"VK_APPS",                0x5D}, {L"VK_SLEEP",               0x5F}, {L"VK_NUMPAD0",             0x60},
-		{L"VK_NUMPAD1",             0x61}, {L"VK_NUMPAD2",             0x62}, {L"VK_NUMPAD3",             0x63},
-		{L"VK_NUMPAD4",             0x64}, {L"VK_NUMPAD5",             0x65}, {L"VK_NUMPAD6",             0x66},
-		{L"VK_NUMPAD7",             0x67}, {L"VK_NUMPAD8",             0x68}, {L"VK_NUMPAD9",             0x69},
-		{L"VK_MULTIPLY",            0x6A}, {L"VK_ADD",                 0x6B}, {L"VK_SEPARATOR",           0x6C},
-		{L"VK_SUBTRACT",            0x6D}, {L"VK_DECIMAL",             0x6E}, {L"VK_DIVIDE",              0x6F},
-		{L"VK_F1",                  0x70}, {L"VK_F2",                  0x71}, {L"VK_F3",                  0x72},
-		{L"VK_F4",                  0x73}, {L"VK_F5",                  0x74}, {L"VK_F6",                  0x75},
-		{L"VK_F7",                  0x76}, {L"VK_F8",                  0x77}, {L"VK_F9",                  0x78},
-		{L"VK_F10",                 0x79}, {L"VK_F11",                 0x7A}, {L"VK_F12",                 0x7B},
-		{L"VK_F13",                 0x7C}, {L"VK_F14",                 0x7D}, {L"VK_F15",                 0x7E},
-		{L"VK_F16",                 0x7F}, {L"VK_F17",                 0x80}, {L"VK_F18",                 0x81},
-		{L"VK_F19",                 0x82}, {L"VK_F20",                 0x83}, {L"VK_F21",                 0x84},
-		{L"VK_F22",                 0x85}, {L"VK_F23",                 0x86}, {L"VK_F24",                 0x87},
-		{L"VK_NUMLOCK",             0x90}, {L"VK_SCROLL",              0x91}, {L"VK_OEM_NEC_EQUAL",       0x92},
-		{L"VK_OEM_FJ_JISHO",        0x92}, {L"VK_OEM_FJ_MASSHOU",      0x93}, {L"VK_OEM_FJ_TOUROKU",      0x94},
-		{L"VK_OEM_FJ_LOYA",         0x95}, {L"VK_OEM_FJ_ROYA",         0x96}, {L"VK_LSHIFT",              0xA0},
-		{L"VK_RSHIFT",              0xA1}, {L"VK_LCONTROL",            0xA2}, {L"VK_RCONTROL",            0xA3},
-		{L"VK_LMENU",               0xA4}, {L"VK_RMENU",               0xA5}, {L"VK_BROWSER_BACK",        0xA6},
-		{L"VK_BROWSER_FORWARD",     0xA7}, {L"VK_BROWSER_REFRESH",     0xA8}, {L"VK_BROWSER_STOP",        0xA9},
-		{L"VK_BROWSER_SEARCH",      0xAA}, {L"VK_BROWSER_FAVORITES",   0xAB}, {L"VK_BROWSER_HOME",        0xAC},
-		{L"VK_VOLUME_MUTE",         0xAD}, {L"VK_VOLUME_DOWN",         0xAE}, {L"VK_VOLUME_UP",           0xAF},
-		{L"VK_MEDIA_NEXT_TRACK",    0xB0}, {L"VK_MEDIA_PREV_TRACK",    0xB1}, {L"VK_MEDIA_STOP",          0xB2},
-		{L"VK_MEDIA_PLAY_PAUSE",    0xB3}, {L"VK_LAUNCH_MAIL",         0xB4}, {L"VK_LAUNCH_MEDIA_SELECT", 0xB5},
-		{L"VK_LAUNCH_APP1",         0xB6}, {L"VK_LAUNCH_APP2",         0xB7}, {L"VK_OEM_1",               0xBA},
-		{L"VK_OEM_PLUS",            0xBB}, {L"VK_OEM_COMMA",           0xBC}, {L"VK_OEM_MINUS",           0xBD},
-		{L"VK_OEM_PERIOD",          0xBE}, {L"VK_OEM_2",               0xBF}, {L"VK_OEM_3",               0xC0},
-		{L"VK_OEM_4",               0xDB}, {L"VK_OEM_5",               0xDC}, {L"VK_OEM_6",               0xDD},
-		{L"VK_OEM_7",               0xDE}, {L"VK_OEM_8",               0xDF}, {L"VK_OEM_AX",              0xE1},
-		{L"VK_OEM_102",             0xE2}, {L"VK_ICO_HELP",            0xE3}, {L"VK_ICO_00",              0xE4},
-		{L"VK_PROCESSKEY",          0xE5}, {L"VK_ICO_CLEAR",           0xE6}, {L"VK_PACKET",              0xE7},
-		{L"VK_OEM_RESET",           0xE9}, {L"VK_OEM_JUMP",            0xEA}, {L"VK_OEM_PA1",             0xEB},
-		{L"VK_OEM_PA2",             0xEC}, {L"VK_OEM_PA3",             0xED}, {L"VK_OEM_WSCTRL",          0xEE},
-		{L"VK_OEM_CUSEL",           0xEF}, {L"VK_OEM_ATTN",            0xF0}, {L"VK_OEM_FINISH",          0xF1},
-		{L"VK_OEM_COPY",            0xF2}, {L"VK_OEM_AUTO",            0xF3}, {L"VK_OEM_ENLW",            0xF4},
-		{L"VK_OEM_BACKTAB",         0xF5}, {L"VK_ATTN",                0xF6}, {L"VK_CRSEL",               0xF7},
-		{L"VK_EXSEL",               0xF8}, {L"VK_EREOF",               0xF9}, {L"VK_PLAY",                0xFA},
-		{L"VK_ZOOM",                0xFB}, {L"VK_NONAME",              0xFC}, {L"VK_PA1",                 0xFD},
-		{L"VK_OEM_CLEAR",           0xFE}
-	};
+		if (depth > launch_stats.max_queue_depth)
+			launch_stats.max_queue_depth = depth;
+	}
 
-	if (len == 1)
+	launch_stats.queued++;
+	launch_ready.notify_one();
+	return true;
+}
+
+// The counters are flushed to a plain text file next to the snapshot every
+// stats_interval milliseconds (only when something changed) and on every
+// reload, so `type` is all it takes to read them. One line per binding:
+// id, presses, launches, failures, presses the governor held back, latency
+// buckets, chord and path.
+
+static const UINT stats_interval = 10000;
+static UINT_PTR stats_timer = 0;
+static unsigned stats_flushed = 0;
+
+void encode_utf8(const std::wstring &text, std::vector<unsigned char> &out)
+{
+	out.clear();
+	out.reserve(text.size());
+
+	for (size_t i = 0; i < text.size(); i++)
 	{
-		wchar_t ch = towupper(keyname[0]);
+		unsigned c = text[i];
 
-		if (ch >= L'A' && ch <= L'Z' || ch >= L'0' && ch <= L'9')
-			return (int)ch;
+		if (c >= 0xD800 && c <= 0xDBFF && i + 1 < text.size() && text[i + 1] >= 0xDC00 && text[i + 1] <= 0xDFFF)
+			c = 0x10000 + ((c - 0xD800) << 10) + (text[++i] - 0xDC00);
+
+		if (c < 0x80)
+		{
+			out.push_back((unsigned char)c);
+		}
+		else if (c < 0x800)
+		{
+			out.push_back((unsigned char)(0xC0 | (c >> 6)));
+			out.push_back((unsigned char)(0x80 | (c & 0x3F)));
+		}
+		else if (c < 0x10000)
+		{
+			out.push_back((unsigned char)(0xE0 | (c >> 12)));
+			out.push_back((unsigned char)(0x80 | ((c >> 6) & 0x3F)));
+			out.push_back((unsigned char)(0x80 | (c & 0x3F)));
+		}
 		else
-			return 0;
+		{
+			out.push_back((unsigned char)(0xF0 | (c >> 18)));
+			out.push_back((unsigned char)(0x80 | ((c >> 12) & 0x3F)));
+			out.push_back((unsigned char)(0x80 | ((c >> 6) & 0x3F)));
+			out.push_back((unsigned char)(0x80 | (c & 0x3F)));
+		}
 	}
-	else
+}
+
+void write_stats()
+{
+	TraceScope scope("write_stats");
+	std::wstring text;
+	wchar_t line[1024];
+
+	swprintf(line, 1024,
+		L"reloads %u\nreload_us %llu\nreload_us_total %llu\nfiles %u\nrejects %u\nduplicates %u\nregister_failures %u\nregister_skipped %u\n"
+		L"queued %u\ndropped %u\nlaunched %u\nqueue_depth %u\nmax_queue_depth %u\nlaunch_us_total %llu\nlaunch_us_max %llu\n"
+		L"prefetch_passes %u\nprefetch_files %u\nprefetch_bytes %llu\n"
+		L"repeats %u\nrate_limited %u\ncapped %u\nfocused %u\n",
+		reload_stats.reloads, reload_stats.last_us, reload_stats.total_us,
+		reload_stats.files, reload_stats.rejects, reload_stats.duplicates, reload_stats.register_failures, reload_stats.register_skipped,
+		launch_stats.queued.load(), launch_stats.dropped.load(), launch_stats.launched.load(),
+		launch_stats.queue_depth.load(), launch_stats.max_queue_depth.load(),
+		launch_stats.total_time_us.load(), launch_stats.max_time_us.load(),
+		prefetch_stats.passes.load(), prefetch_stats.files.load(), prefetch_stats.bytes.load(),
+		hook_repeats.load(), governor.rate_limited, governor.capped, launch_stats.focused.load());
+
+	text += line;
+
+	for (int i = 0; i < hotkeys.size(); i++)
 	{
-		for (int i = 0; i < sizeof(map) / sizeof(KeyInfo); i++)
-		{
-			const wchar_t *name = map[i].name + 3;
-			int n = wcslen(name);
+		const HotKey &hk = hotkeys[i];
+		const BindingStats *stats = find_stats(hk.id);
 
-			if (n == len && _wcsnicmp(keyname, name, len) == 0)
-				return map[i].code;
+		if (hk.name == 0 || stats == 0)
+			continue;
+
+		swprintf(line, 1024, L"%d %u %u %u %u ", hk.id, stats->presses.load(), stats->launches.load(), stats->failures.load(), stats->limited.load());
+		text += line;
+
+		for (int b = 0; b < latency_buckets; b++)
+		{
+			swprintf(line, 1024, b == 0 ? L"%u" : L",%u", stats->latency[b].load());
+			text += line;
 		}
 
-		return 0;
+		text += L' ';
+		append_chord(text, hk.modifiers, hk.vk);
+		text += L' ';
+		text += binding_path(hk);
+		text += L'\n';
 	}
+
+	std::vector<unsigned char> data;
+	encode_utf8(text, data);
+	platform->write_file(state_path(L".stats").c_str(), data);
 }
 
-int initialize(int argc, wchar_t **argv)
+void flush_stats(bool force)
+{
+	unsigned version = launch_stats.queued + launch_stats.dropped + launch_stats.launched + reload_stats.reloads +
+		governor.rate_limited + governor.capped + hook_repeats + launch_stats.focused;
+
+	if (force || version != stats_flushed)
+	{
+		stats_flushed = version;
+		write_stats();
+	}
+}
+
+void dispatch_hotkey(int id)
+{
+	if (id > 0 && id <= hotkeys.size())
+	{
+		HotKey &hk = hotkeys[id - 1];
+
+		if (hk.name == 0)
+			return;
+
+		BindingStats *stats = find_stats(id);
+		unsigned long long now = now_ms();
+
+		if (stats != 0)
+			stats->presses.fetch_add(1, std::memory_order_relaxed);
+
+		if (govern(governor, id, now, launch_stats.pending) == governor_launch)
+			queue_launch(hk);
+		else if (stats != 0)
+			stats->limited.fetch_add(1, std::memory_order_relaxed);
+	}
+	else if (id == 0)
+	{
+		reload_hotkeys();
+		flush_stats(true);
+	}
+}
+
+void handle_message(const MSG &msg)
+{
+	// window messages belong to modules sharing the loop (host.cxx), the
+	// hotkeys and timers here are all thread messages
+	if (msg.hwnd != 0)
+	{
+		TranslateMessage(&msg);
+		DispatchMessage(&msg);
+	}
+	else if (msg.message == WM_HOTKEY)
+	{
+		dispatch_hotkey((int)msg.wParam);
+	}
+	else if (msg.message == WM_TIMER && watch_timer != 0 && msg.wParam == watch_timer)
+	{
+		KillTimer(0, watch_timer);
+		watch_timer = 0;
+		reload_hotkeys();
+	}
+	else if (msg.message == WM_TIMER && stats_timer != 0 && msg.wParam == stats_timer)
+	{
+		flush_stats(false);
+	}
+}
+
+int run(const std::vector<HANDLE> &watches)
 {
-	wchar_t *dir = 0;
+	MSG msg = {0};
 
-	if (argc > 1)
+	if (watches.empty())
 	{
-		DWORD attr = GetFileAttributes(argv[1]);
+		while (GetMessage(&msg, 0, 0, 0) != 0)
+			handle_message(msg);
 
-		if (attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY) != 0)
-			dir = argv[1];
+		return 0;
 	}
 
-	if (dir == 0)
+	// changes usually come in bursts (copying a folder of shortcuts), so the
+	// reload waits until the directories have been quiet for a while
+
+	for (;;)
 	{
-		wchar_t *home = 0;
-		wchar_t subdir[] = L"\\hotkeys";
+		DWORD count = (DWORD)watches.size();
+		DWORD result = MsgWaitForMultipleObjects(count, &watches[0], FALSE, INFINITE, QS_ALLINPUT);
+
+		if (result >= WAIT_OBJECT_0 && result < WAIT_OBJECT_0 + count)
+		{
+			if (watch_timer != 0)
+				KillTimer(0, watch_timer);
+
+			watch_timer = SetTimer(0, 0, watch_delay, 0);
+			platform->next_watch(watches[result - WAIT_OBJECT_0]);
+		}
 
-		if (SUCCEEDED(SHGetKnownFolderPath(FOLDERID_Profile, 0, 0, &home)))
+		while (PeekMessage(&msg, 0, 0, 0, PM_REMOVE))
 		{
-			dir = new wchar_t[wcslen(home) + sizeof(subdir) / sizeof(wchar_t) + 1];
-			wcscpy(dir, home);
-			wcscat(dir, subdir);
-			CoTaskMemFree(home);
+			if (msg.message == WM_QUIT)
+				return 0;
+
+			handle_message(msg);
 		}
 	}
+}
+
+// Synthetic session (--storm <results> [--storm-rate <presses per second>]
+// [--storm-events <count>] [--storm-files <count>]). A Platform that keeps a
+// generated hotkeys directory in memory, accepts every registration and
+// records launches instead of making them replaces the Win32 one, and the
+// real reload, message loop, governor and launch workers run on top of it.
+//
+// First the directory is loaded and reloaded (unchanged, then with a few
+// files renamed) to time the reload. Then a thread posts WM_HOTKEY for the
+// registered bindings at storm_rate, renaming files and signaling the watch
+// every quarter of the way, and the time from each post to its launch is
+// recorded. Results are "name value" lines, like the benchmark's.
+
+static const unsigned storm_rename_percent = 1;
+
+struct StormFile
+{
+	std::wstring name;
+	unsigned long long mtime;
+};
 
-	hotkeys_directory = dir;
+static std::mutex storm_lock;
+static std::vector<StormFile> storm_directory;
+static std::unordered_map<std::wstring, std::vector<unsigned char>> storm_written;
+static unsigned long long storm_stamp = 1;
+static HANDLE storm_watch = 0;
+static std::atomic<unsigned> storm_registered(0);
+static std::atomic<unsigned> storm_unregistered(0);
+static std::atomic<long long> storm_pressed[1 << 12]; // by chord, when the last press was posted
+static std::vector<long long> storm_latencies;
 
-	return (dir != 0 ? 0 : 1);
+long long storm_now()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool storm_register_hotkey(int id, UINT modifiers, UINT vk)
+{
+	storm_registered++;
+	return true;
+}
+
+void storm_unregister_hotkey(int id)
+{
+	storm_unregistered++;
+}
+
+void storm_find_files(const wchar_t *directory, void (*found)(const wchar_t *name, bool directory, unsigned long long mtime, void *context), void *context)
+{
+	std::lock_guard<std::mutex> lock(storm_lock);
+
+	if (wcscmp(directory, roots[0].c_str()) != 0)
+		return;
+
+	for (int i = 0; i < storm_directory.size(); i++)
+		found(storm_directory[i].name.c_str(), false, storm_directory[i].mtime, context);
 }
 
-bool parse_filename(const wchar_t *filename, UINT *modifiers, UINT *vk)
+bool storm_read_file(const wchar_t *filename, std::vector<unsigned char> &data)
 {
-	int len = wcslen(filename);
+	std::lock_guard<std::mutex> lock(storm_lock);
+	std::unordered_map<std::wstring, std::vector<unsigned char>>::iterator it = storm_written.find(filename);
 
-	if (len <= 4 || _wcsnicmp(filename + len - 4, L".lnk", 4) != 0)
+	if (it == storm_written.end())
 		return false;
 
-	const wchar_t *end = filename + len - 4;
-	const wchar_t *delim = wcschr(filename, L' ');
+	data = it->second;
+	return true;
+}
+
+bool storm_write_file(const wchar_t *filename, const std::vector<unsigned char> &data)
+{
+	std::lock_guard<std::mutex> lock(storm_lock);
+	storm_written[filename] = data;
+	return true;
+}
+
+const unsigned char *storm_map_file(const wchar_t *filename, size_t *size)
+{
+	std::vector<unsigned char> data;
 
-	if (delim != 0 && delim < end)
-		end = delim;
+	if (!storm_read_file(filename, data) || data.empty())
+		return 0;
 
-	const wchar_t *s = filename;
+	unsigned char *copy = new unsigned char[data.size()];
+	memcpy(copy, &data[0], data.size());
 
-	*modifiers = 0;
-	*vk = 0;
+	*size = data.size();
+	return copy;
+}
 
-	while (s < end && (delim = wcschr(s, L'+')) != 0 && delim < end)
-	{
-		len = delim - s;
+void storm_unmap_file(const unsigned char *data)
+{
+	delete[] data;
+}
 
-		if (len == 3 && _wcsnicmp(s, L"win", 3) == 0)
-		{
-			if (*modifiers & MOD_WIN)
-				return false;
+bool storm_directory_stamp(const wchar_t *directory, unsigned long long *stamp)
+{
+	std::lock_guard<std::mutex> lock(storm_lock);
+	*stamp = storm_stamp;
+	return wcscmp(directory, roots[0].c_str()) == 0;
+}
 
-			*modifiers |= MOD_WIN;
-		}
-		else if (len == 3 && _wcsnicmp(s, L"alt", 3) == 0)
-		{
-			if (*modifiers & MOD_ALT)
-				return false;
+HANDLE storm_open_watch(const wchar_t *directory)
+{
+	return storm_watch;
+}
 
-			*modifiers |= MOD_ALT;
-		}
-		else if (len == 4 && _wcsnicmp(s, L"ctrl", 4) == 0)
-		{
-			if (*modifiers & MOD_CONTROL)
-				return false;
+void storm_next_watch(HANDLE watch)
+{
+}
 
-			*modifiers |= MOD_CONTROL;
-		}
-		else if (len == 5 && _wcsnicmp(s, L"shift", 5) == 0)
-		{
-			if (*modifiers & MOD_SHIFT)
-				return false;
+void storm_close_watch(HANDLE watch)
+{
+}
 
-			*modifiers |= MOD_SHIFT;
-		}
-		else
-		{
-			return false;
-		}
+bool storm_create_process(const Shortcut &link)
+{
+	return false;
+}
 
-		s = delim + 1;
-	}
+bool storm_launch(const wchar_t *filename, const wchar_t *parameters)
+{
+	long long now = storm_now();
+	const wchar_t *name = wcsrchr(filename, L'\\');
+	UINT modifiers = 0;
+	UINT vk = 0;
 
-	if (s >= end)
+	if (!parse_filename(name != 0 ? name + 1 : filename, &modifiers, &vk))
 		return false;
 
-	len = end - s;
-	*vk = map_key(s, len);
+	long long pressed = storm_pressed[chord_of(modifiers, vk)].exchange(0);
+
+	if (pressed != 0)
+	{
+		std::lock_guard<std::mutex> lock(storm_lock);
+		storm_latencies.push_back(now - pressed);
+	}
 
-	return *vk != 0;
+	return true;
 }
 
-void reload_hotkeys()
+bool storm_focus_running(const Shortcut &link)
 {
-	for (int i = 0; i < hotkeys.size(); i++)
-		UnregisterHotKey(0, hotkeys[i].id);
+	return false;
+}
+
+unsigned long long storm_read_ahead(const wchar_t *filename, unsigned long long limit)
+{
+	return 0;
+}
 
-	hotkeys.clear();
+std::wstring storm_expand(const std::wstring &s)
+{
+	return s;
+}
 
-	std::wstring path = hotkeys_directory;
-	path += + L"\\*.lnk";
+void storm_thread_init()
+{
+}
 
-	WIN32_FIND_DATA ffd;
-	HANDLE hFind = FindFirstFile(path.c_str(), &ffd);
+void storm_thread_exit()
+{
+}
+
+static const Platform storm_platform = {
+	storm_register_hotkey,
+	storm_unregister_hotkey,
+	storm_find_files,
+	storm_read_file,
+	storm_write_file,
+	storm_map_file,
+	storm_unmap_file,
+	storm_directory_stamp,
+	storm_open_watch,
+	storm_next_watch,
+	storm_close_watch,
+	storm_create_process,
+	storm_launch,
+	storm_focus_running,
+	storm_read_ahead,
+	storm_expand,
+	storm_thread_init,
+	storm_thread_exit
+};
+
+// Every chord (modifiers 1 to 15 over the letters, digits and named keys) in
+// turn, so directories larger than that repeat chords the way a careless
+// hotkeys folder would, and those files are rejected as duplicates.
+
+void storm_fill_directory(unsigned count)
+{
+	std::vector<std::wstring> keys;
+
+	for (wchar_t ch = L'A'; ch <= L'Z'; ch++)
+		keys.push_back(std::wstring(1, ch));
+
+	for (wchar_t ch = L'0'; ch <= L'9'; ch++)
+		keys.push_back(std::wstring(1, ch));
 
-	if (hFind != INVALID_HANDLE_VALUE) do
+	for (int i = 0; i < key_count; i++)
+		keys.push_back(key_map[i].name + 3);
+
+	static const wchar_t *modifiers[] = { L"win+", L"alt+", L"ctrl+", L"shift+" };
+
+	storm_directory.clear();
+
+	for (unsigned i = 0; i < count; i++)
 	{
-		HotKey hk = {0};
+		unsigned mods = 1 + (i / (unsigned)keys.size()) % 15;
+		std::wstring name;
 
-		if (parse_filename(ffd.cFileName, &hk.modifiers, &hk.vk))
+		for (int m = 0; m < 4; m++)
 		{
-			hk.id = hotkeys.size() + 1;
-			hk.filename = hotkeys_directory;
-			hk.filename += L"\\";
-			hk.filename += ffd.cFileName;
-
-			if (RegisterHotKey(0, hk.id, hk.modifiers, hk.vk))
-				hotkeys.push_back(hk);
+			if (mods & (1 << m))
+				name += modifiers[m];
 		}
+
+		wchar_t title[32];
+		swprintf(title, 32, L" Application %u.lnk", i);
+
+		name += keys[i % keys.size()];
+		name += title;
+
+		StormFile file = { name, 1 };
+		storm_directory.push_back(file);
 	}
-	while (FindNextFile(hFind, &ffd) != 0);
+}
 
-	FindClose(hFind);
+// Renames every hundredth file or so (same chord, so the reload takes over
+// the slot) and bumps the stamps, like a user tidying up the folder.
+
+void storm_rename(unsigned round)
+{
+	std::lock_guard<std::mutex> lock(storm_lock);
+
+	for (size_t i = round % 100; i < storm_directory.size(); i += 100 / storm_rename_percent)
+	{
+		StormFile &file = storm_directory[i];
+		size_t extension = file.name.size() - 4;
+
+		file.name.insert(extension, L" (renamed)");
+		file.mtime++;
+	}
+
+	storm_stamp++;
 }
 
-int wmain(int argc, wchar_t **argv)
+long long storm_percentile(const std::vector<long long> &sorted, int percent)
 {
-	if (initialize(argc, argv) != 0)
-		return 1;
+	if (sorted.empty())
+		return 0;
+
+	return sorted[std::min(sorted.size() - 1, sorted.size() * percent / 100)];
+}
 
-	RegisterHotKey(0, 0, MOD_WIN | MOD_ALT | MOD_CONTROL | MOD_SHIFT, (UINT)L'R');
+int run_storm()
+{
+	const Platform *native = platform;
+
+	platform = &storm_platform;
+	roots.assign(1, L"S:\\storm");
+	manifest_path = 0;
+	storm_fill_directory(storm_files);
+	storm_watch = CreateEvent(0, FALSE, FALSE, 0);
+
+	std::vector<std::pair<std::string, long long>> results;
+	long long start = storm_now();
+
+	load_hotkeys();
+	results.push_back(std::make_pair("load_us", storm_now() - start));
+
+	start = storm_now();
 	reload_hotkeys();
+	long long reload = storm_now() - start;
 
-	MSG msg = {0};
+	storm_rename(0);
+	start = storm_now();
+	reload_hotkeys();
+	long long renamed = storm_now() - start;
+
+	results.push_back(std::make_pair("reload_us", reload));
+	results.push_back(std::make_pair("reload_renamed_us", renamed));
+	results.push_back(std::make_pair("reload_files_per_s", reload != 0 ? (long long)storm_files * 1000000 / reload : 0));
+	results.push_back(std::make_pair("files", (long long)storm_files));
+	results.push_back(std::make_pair("registered", (long long)storm_registered.load()));
+	results.push_back(std::make_pair("unregistered", (long long)storm_unregistered.load()));
+	results.push_back(std::make_pair("rejects", (long long)(reload_stats.rejects + reload_stats.duplicates)));
+
+	std::vector<int> ids;
+	std::vector<unsigned> chords;
+
+	for (int i = 0; i < hotkeys.size(); i++)
+	{
+		if (hotkeys[i].name != 0)
+		{
+			ids.push_back(hotkeys[i].id);
+			chords.push_back(chord_of(hotkeys[i].modifiers, hotkeys[i].vk));
+		}
+	}
+
+	results.push_back(std::make_pair("bindings", (long long)ids.size()));
 
-	while (GetMessage(&msg, 0, 0, 0) != 0)
+	if (ids.empty())
 	{
-		if (msg.message == WM_HOTKEY)
+		fputs("hotkeys: no bindings to press\n", stderr);
+		return 1;
+	}
+
+	// the loop's queue has to exist before the other thread posts to it
+	MSG msg;
+	PeekMessage(&msg, 0, WM_USER, WM_USER, PM_NOREMOVE);
+
+	DWORD loop_thread = GetCurrentThreadId();
+	unsigned reloads = reload_stats.reloads;
+
+	start_launchers();
+
+	std::thread injector([&]() {
+		long long begin = storm_now();
+
+		for (unsigned k = 0; k < storm_events; k++)
 		{
-			if (msg.wParam > 0 && msg.wParam <= hotkeys.size())
+			long long due = begin + (long long)k * 1000000 / storm_rate;
+
+			for (long long now = storm_now(); now < due; now = storm_now())
 			{
-				HotKey &hk = hotkeys[msg.wParam - 1];
-				ShellExecute(0, L"open", hk.filename.c_str(), 0, 0, SW_SHOWNORMAL);
+				if (due - now > 2000)
+					Sleep(1);
+				else
+					std::this_thread::yield();
 			}
-			else if (msg.wParam == 0)
+
+			if (k != 0 && k % (storm_events / 4 + 1) == 0)
 			{
-				reload_hotkeys();
+				storm_rename(k);
+				SetEvent(storm_watch);
 			}
+
+			int index = k % ids.size();
+			storm_pressed[chords[index]] = storm_now();
+			PostThreadMessage(loop_thread, WM_HOTKEY, ids[index], 0);
 		}
+
+		PostThreadMessage(loop_thread, WM_QUIT, 0, 0);
+	});
+
+	std::vector<HANDLE> watches(1, platform->open_watch(roots[0].c_str()));
+	run(watches);
+	injector.join();
+
+	for (int wait = 0; launch_stats.pending != 0 && wait < 1000; wait++)
+		Sleep(10);
+
+	stop_launchers();
+	CloseHandle(storm_watch);
+
+	std::vector<long long> sorted = storm_latencies;
+	std::sort(sorted.begin(), sorted.end());
+
+	results.push_back(std::make_pair("events", (long long)storm_events));
+	results.push_back(std::make_pair("rate", (long long)storm_rate));
+	results.push_back(std::make_pair("launched", (long long)sorted.size()));
+	results.push_back(std::make_pair("rate_limited", (long long)governor.rate_limited));
+	results.push_back(std::make_pair("capped", (long long)governor.capped));
+	results.push_back(std::make_pair("dropped", (long long)launch_stats.dropped));
+	results.push_back(std::make_pair("reloads", (long long)(reload_stats.reloads - reloads)));
+	results.push_back(std::make_pair("latency_p50_us", storm_percentile(sorted, 50)));
+	results.push_back(std::make_pair("latency_p99_us", storm_percentile(sorted, 99)));
+	results.push_back(std::make_pair("latency_max_us", sorted.empty() ? 0 : sorted.back()));
+
+	std::string text;
+	char line[128];
+
+	for (int i = 0; i < results.size(); i++)
+	{
+		snprintf(line, sizeof(line), "%s %lld\n", results[i].first.c_str(), results[i].second);
+		text += line;
 	}
 
-	return 0;
+	fputs(text.c_str(), stdout);
+
+	return native->write_file(storm_path, std::vector<unsigned char>(text.begin(), text.end())) ? 0 : 1;
+}
+
+static std::vector<HANDLE> watches;
+
+// Registers the hotkeys, starts the workers and opens the directory watches.
+// The caller then runs the message loop on this thread (run) and calls stop.
+void start()
+{
+#ifdef _WIN32
+	static Platform hook_platform = win32_platform;
+
+	if (hook_mode)
+	{
+		hook_platform.register_hotkey = hook_register_hotkey;
+		hook_platform.unregister_hotkey = hook_unregister_hotkey;
+		platform = &hook_platform;
+	}
+
+	if (trace_enabled)
+	{
+		SetConsoleCtrlHandler(trace_console_handler, TRUE);
+		create_session_window();
+	}
+#endif
+
+	{
+		TraceScope scope("startup");
+
+		platform->register_hotkey(0, MOD_WIN | MOD_ALT | MOD_CONTROL | MOD_SHIFT, (UINT)L'R');
+		load_hotkeys();
+		start_launchers();
+		start_prefetch();
+	}
+
+	stats_timer = SetTimer(0, 0, stats_interval, 0);
+
+#ifdef _WIN32
+	if (hook_mode)
+		start_hook();
+#endif
+
+	for (int i = 0; watch_directory && i < roots.size() && watches.size() < MAXIMUM_WAIT_OBJECTS - 1; i++)
+	{
+		HANDLE watch = platform->open_watch(roots[i].c_str());
+
+		if (watch != 0)
+			watches.push_back(watch);
+	}
+}
+
+void stop()
+{
+	for (int i = 0; i < watches.size(); i++)
+		platform->close_watch(watches[i]);
+
+	watches.clear();
+
+#ifdef _WIN32
+	stop_hook();
+#endif
+
+	stop_launchers();
+	stop_prefetch();
+
+	KillTimer(0, stats_timer);
+	flush_stats(true);
+#ifdef _WIN32
+	destroy_session_window();
+#endif
+	write_trace();
 }
 
+int wmain(int argc, wchar_t **argv)
+{
+	if (initialize(argc, argv) != 0)
+		return 1;
+
+	if (storm_path != 0)
+		return run_storm();
+
+	start();
+	int result = run(watches);
+	stop();
+
+	return result;
+}
+
+#ifdef _WIN32
 int main()
 {
 	int argc = 0;
@@ -275,3 +2595,21 @@ int main()
 
 	return wmain(argc, argv);
 }
+#else
+int main(int argc, char **argv)
+{
+	std::vector<std::wstring> args(argc);
+	std::vector<wchar_t*> wargv;
+
+	// launched programs aren't waited for
+	signal(SIGCHLD, SIG_IGN);
+
+	for (int i = 0; i < argc; i++)
+	{
+		args[i] = compat_widen(argv[i]);
+		wargv.push_back(&args[i][0]);
+	}
+
+	return wmain(argc, wargv.data());
+}
+#endif
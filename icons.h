@@ -0,0 +1,517 @@
+#pragma once
+
+#include <windows.h>
+
+// The icon rasterizer: glyphs, row masks, span expansion and the render
+// check. Nothing here needs a desktop, so it also builds for the tests and
+// the benchmark outside Windows.
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define RASTER_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#define RASTER_TARGET(isa)
+#else
+#include <cpuid.h>
+#include <immintrin.h>
+#define RASTER_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+// Digits are 4x9 pixels and the mute glyph 16x9, drawn where there's a '0'.
+// Both are packed into row masks at compile time, bit x set for column x.
+static constexpr char numbers[][6 * 10 - 1] = {
+    "0000     0  0000  0000  0  0  0000  0     0000  0000  0000",
+    "0  0     0     0     0  0  0  0     0        0  0  0  0  0",
+    "0  0     0     0     0  0  0  0     0        0  0  0  0  0",
+    "0  0     0     0     0  0  0  0     0        0  0  0  0  0",
+    "0  0     0  0000  0000  0000  0000  0000     0  0000  0000",
+    "0  0     0  0        0     0     0  0  0     0  0  0     0",
+    "0  0     0  0        0     0     0  0  0     0  0  0     0",
+    "0  0     0  0        0     0     0  0  0     0  0  0     0",
+    "0000     0  0000  0000     0  0000  0000     0  0000     0"
+};
+
+static constexpr char mute[][16 + 1] = {
+    "     0          ",
+    "    00          ",
+    " 0000 0  0   0  ",
+    " 0    0   0 0   ",
+    " 0    0    0    ",
+    " 0    0   0 0   ",
+    " 0000 0  0   0  ",
+    "    00          ",
+    "     0          "
+};
+
+struct GLYPHS
+{
+    BYTE digits[10][9];
+    WORD mute[9];
+};
+
+constexpr GLYPHS PackGlyphs()
+{
+    GLYPHS glyphs = {};
+
+    for (int y = 0; y < 9; y++)
+    {
+        for (int n = 0; n < 10; n++)
+        {
+            for (int x = 0; x < 4; x++)
+            {
+                if (numbers[y][n * 6 + x] == '0')
+                    glyphs.digits[n][y] |= (BYTE)(1 << x);
+            }
+        }
+
+        for (int x = 0; x < 16; x++)
+        {
+            if (mute[y][x] == '0')
+                glyphs.mute[y] |= (WORD)(1 << x);
+        }
+    }
+
+    return glyphs;
+}
+
+static constexpr GLYPHS glyphs = PackGlyphs();
+
+static DWORD fore = 0xFF000000;
+static DWORD back = 0x00000000;
+
+// Icons are laid out on a 16x16 grid of row masks and scaled from there to
+// whatever size the shell uses.
+#define ICON_GRID       16
+#define ICON_MAX_SIZE   256
+#define ICON_LEVELS     102
+
+constexpr void draw_number(WORD *rows, int x0, int n)
+{
+    const int y0 = 3;
+
+    for (int y = 0; y < 9; y++)
+        rows[y0 + y] |= (WORD)(x0 >= 0 ? glyphs.digits[n][y] << x0 : glyphs.digits[n][y] >> -x0);
+}
+
+// Fills the 16 row masks for a volume level (101 is mute).
+constexpr void BuildIconMask(WORD *rows, int i)
+{
+    for (int y = 0; y < ICON_GRID; y++)
+        rows[y] = 0;
+
+    if (i == 101)
+    {
+        for (int y = 0; y < 9; y++)
+            rows[3 + y] = glyphs.mute[y];
+    }
+    else
+    {
+        draw_number(rows, -1 + (4 + 1) * 2, i % 10);
+
+        if (i >= 10)
+            draw_number(rows, -1 + (4 + 1) * 1, (i / 10) % 10);
+
+        if (i >= 100)
+            draw_number(rows, -1 + (4 + 1) * 0, (i / 100) % 10);
+    }
+}
+
+// Every level's row masks, built by the compiler into read-only data. Only
+// the scaling and the colors are left for run time.
+struct ICON_ATLAS
+{
+    WORD rows[ICON_LEVELS][ICON_GRID];
+};
+
+constexpr ICON_ATLAS BuildAtlas()
+{
+    ICON_ATLAS atlas = {};
+
+    for (int i = 0; i < ICON_LEVELS; i++)
+        BuildIconMask(atlas.rows[i], i);
+
+    return atlas;
+}
+
+static constexpr ICON_ATLAS atlas = BuildAtlas();
+
+// Checks the atlas pixel by pixel against the character tables, the way
+// draw_number used to paint straight from them.
+constexpr bool CheckAtlas(int first, int last)
+{
+    for (int i = first; i < last; i++)
+    {
+        for (int y = 0; y < ICON_GRID; y++)
+        {
+            for (int x = 0; x < ICON_GRID; x++)
+            {
+                bool drawn = false;
+
+                if (y >= 3 && y < 3 + 9)
+                {
+                    if (i == 101)
+                    {
+                        drawn = mute[y - 3][x] == '0';
+                    }
+                    else
+                    {
+                        for (int k = 0, n = i; k < 3 && (k == 0 || n != 0); k++, n /= 10)
+                        {
+                            int x0 = -1 + (4 + 1) * (2 - k);
+
+                            if (x >= x0 && x < x0 + 4 && numbers[y - 3][(n % 10) * 6 + x - x0] == '0')
+                                drawn = true;
+                        }
+                    }
+                }
+
+                if (drawn != (((atlas.rows[i][y] >> x) & 1) != 0))
+                    return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static_assert(CheckAtlas(0, 34), "icon atlas doesn't match the glyph tables");
+static_assert(CheckAtlas(34, 68), "icon atlas doesn't match the glyph tables");
+static_assert(CheckAtlas(68, ICON_LEVELS), "icon atlas doesn't match the glyph tables");
+
+// Span expansion turns a bit per pixel into fore/back ARGB pixels. The SIMD
+// variants are picked once from CPUID; RASTER_SCALAR is always available.
+
+enum RASTER_PATH
+{
+    RASTER_SCALAR,
+    RASTER_SSE2,
+    RASTER_AVX2
+};
+
+static int raster_path = -1;
+
+#ifdef RASTER_X86
+void CpuId(int *info, int leaf)
+{
+#ifdef _MSC_VER
+    __cpuidex(info, leaf, 0);
+#else
+    __cpuid_count(leaf, 0, info[0], info[1], info[2], info[3]);
+#endif
+}
+
+// XCR0, which says whether the OS saves the AVX registers
+RASTER_TARGET("xsave") ULONGLONG GetXcr0()
+{
+    return _xgetbv(0);
+}
+#endif
+
+int DetectRasterPath()
+{
+#ifdef RASTER_X86
+    int info[4];
+    CpuId(info, 0);
+
+    int nMax = info[0];
+    CpuId(info, 1);
+
+    BOOL bSSE2 = (info[3] & (1 << 26)) != 0;
+    BOOL bAVX = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (GetXcr0() & 6) == 6;
+
+    if (bAVX && nMax >= 7)
+    {
+        CpuId(info, 7);
+
+        if (info[1] & (1 << 5))
+            return RASTER_AVX2;
+    }
+
+    if (bSSE2)
+        return RASTER_SSE2;
+#endif
+
+    return RASTER_SCALAR;
+}
+
+void ExpandSpanScalar(DWORD *p, const BYTE *mask, int x, int n)
+{
+    for (; x < n; x++)
+        p[x] = (mask[x >> 3] >> (x & 7)) & 1 ? fore : back;
+}
+
+#ifdef RASTER_X86
+RASTER_TARGET("sse2") void ExpandSpanSSE2(DWORD *p, const BYTE *mask, int n)
+{
+    const __m128i bits = _mm_setr_epi32(1, 2, 4, 8);
+    const __m128i vf = _mm_set1_epi32((int)fore);
+    const __m128i vb = _mm_set1_epi32((int)back);
+
+    int x = 0;
+
+    for (; x + 4 <= n; x += 4)
+    {
+        __m128i m = _mm_and_si128(_mm_set1_epi32(mask[x >> 3] >> (x & 4)), bits);
+        m = _mm_cmpeq_epi32(m, bits);
+        _mm_storeu_si128((__m128i*)&p[x], _mm_or_si128(_mm_and_si128(m, vf), _mm_andnot_si128(m, vb)));
+    }
+
+    ExpandSpanScalar(p, mask, x, n);
+}
+
+RASTER_TARGET("avx2") void ExpandSpanAVX2(DWORD *p, const BYTE *mask, int n)
+{
+    const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256i vf = _mm256_set1_epi32((int)fore);
+    const __m256i vb = _mm256_set1_epi32((int)back);
+
+    int x = 0;
+
+    for (; x + 8 <= n; x += 8)
+    {
+        __m256i m = _mm256_and_si256(_mm256_set1_epi32(mask[x >> 3]), bits);
+        m = _mm256_cmpeq_epi32(m, bits);
+        _mm256_storeu_si256((__m256i*)&p[x], _mm256_blendv_epi8(vb, vf, m));
+    }
+
+    _mm256_zeroupper();
+    ExpandSpanScalar(p, mask, x, n);
+}
+#endif
+
+void ExpandSpan(DWORD *p, const BYTE *mask, int n)
+{
+    if (raster_path < 0)
+        raster_path = DetectRasterPath();
+
+#ifdef RASTER_X86
+    if (raster_path == RASTER_AVX2)
+        return ExpandSpanAVX2(p, mask, n);
+
+    if (raster_path == RASTER_SSE2)
+        return ExpandSpanSSE2(p, mask, n);
+#endif
+
+    ExpandSpanScalar(p, mask, 0, n);
+}
+
+// Scales the row masks to a size x size buffer by sampling the grid at each
+// pixel's center. Integer scales replicate pixels exactly; fractional ones
+// (125%, 150%, ...) stay sharp, with some strokes one pixel wider than others.
+// Each distinct grid row is expanded once and copied down.
+void RasterizeIcon(DWORD *buffer, int size, const WORD *rows)
+{
+    BYTE src[ICON_MAX_SIZE];
+    BYTE mask[ICON_MAX_SIZE / 8];
+
+    for (int x = 0; x < size; x++)
+        src[x] = (BYTE)((2 * x + 1) * ICON_GRID / (2 * size));
+
+    int prev = -1;
+
+    for (int y = 0; y < size; y++)
+    {
+        DWORD *p = &buffer[y * size];
+        int sy = (2 * y + 1) * ICON_GRID / (2 * size);
+
+        if (sy == prev)
+        {
+            memcpy(p, p - size, size * sizeof(DWORD));
+            continue;
+        }
+
+        memset(mask, 0, (size + 7) / 8);
+
+        for (int x = 0; x < size; x++)
+        {
+            if ((rows[sy] >> src[x]) & 1)
+                mask[x >> 3] |= (BYTE)(1 << (x & 7));
+        }
+
+        ExpandSpan(p, mask, size);
+        prev = sy;
+    }
+}
+
+// The peak meter is a bar in the two columns right of the digits, growing
+// up from their baseline one row per step.
+#define METER_STEPS     9
+#define METER_COLUMNS   0xC000
+
+// Fills a size x size buffer with the icon for a volume level, with the
+// meter at the given step (0 draws no bar).
+void RenderIcon(DWORD *buffer, int size, int i, int meter = 0)
+{
+    if (meter == 0)
+    {
+        RasterizeIcon(buffer, size, atlas.rows[i]);
+        return;
+    }
+
+    WORD rows[ICON_GRID];
+    memcpy(rows, atlas.rows[i], sizeof(rows));
+
+    for (int k = 0; k < meter && k < METER_STEPS; k++)
+        rows[3 + 8 - k] |= METER_COLUMNS;
+
+    RasterizeIcon(buffer, size, rows);
+}
+
+// Foreground and background pairs the check and the benchmark render with:
+// dark and light digits, on transparent and on opaque backgrounds.
+static const DWORD icon_themes[][2] = {
+    { 0xFF000000, 0x00000000 },
+    { 0xFFFFFFFF, 0x00000000 },
+    { 0xFFFFFFFF, 0xFF000000 },
+    { 0xFF000000, 0xFFFFFFFF }
+};
+
+// Render check (volumeicon --verify, and the icons test). Every raster path
+// the CPU has is compared byte for byte with a reference that samples the
+// character tables directly for each pixel: every level and meter step at
+// the usual icon sizes, and a few levels at every size up to ICON_MAX_SIZE.
+// The icons of all levels are also hashed (FNV-1a over the ARGB buffers)
+// against golden values. At 16 px, levels 0-100 were recorded from the
+// original renderer and level 101 from the mute glyph. Prints each
+// difference and returns 1 if there is any.
+
+static const int verify_sizes[] = { 16, 20, 24, 28, 32, 40, 48, 64, 96, 128, 256 };
+
+// dark on transparent and light on opaque black
+static const int verify_themes[] = { 0, 2 };
+
+static const struct
+{
+    int nSize;
+    ULONGLONG hash;
+} verify_golden[] = {
+    { 16, 0x57029D5103AC6225ull },
+    { 24, 0xB9EE127E1EDC1FC5ull },
+    { 32, 0x92B2B9F3DD4287A5ull },
+    { 48, 0xA4459902EAB2E025ull }
+};
+
+BOOL ReferencePixel(int i, int meter, int size, int x, int y)
+{
+    int sx = (2 * x + 1) * ICON_GRID / (2 * size);
+    int sy = (2 * y + 1) * ICON_GRID / (2 * size);
+
+    if (sy < 3 || sy >= 3 + 9)
+        return FALSE;
+
+    if (sx >= 14 && 3 + 8 - sy < meter && 3 + 8 - sy < METER_STEPS)
+        return TRUE;
+
+    if (i == 101)
+        return mute[sy - 3][sx] == '0';
+
+    for (int k = 0, n = i; k < 3 && (k == 0 || n != 0); k++, n /= 10)
+    {
+        int x0 = -1 + (4 + 1) * (2 - k);
+
+        if (sx >= x0 && sx < x0 + 4 && numbers[sy - 3][(n % 10) * 6 + sx - x0] == '0')
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+ULONGLONG HashIcon(ULONGLONG hash, const DWORD *buffer, int size)
+{
+    const BYTE *p = (const BYTE*)buffer;
+
+    for (int j = 0; j < size * size * 4; j++)
+        hash = (hash ^ p[j]) * 0x100000001B3ull;
+
+    return hash;
+}
+
+int CheckRender(int path, int size, int i, int meter)
+{
+    static DWORD buffer[ICON_MAX_SIZE * ICON_MAX_SIZE];
+
+    raster_path = path;
+    RenderIcon(buffer, size, i, meter);
+
+    for (int y = 0; y < size; y++)
+    {
+        for (int x = 0; x < size; x++)
+        {
+            if (buffer[y * size + x] != (ReferencePixel(i, meter, size, x, y) ? fore : back))
+            {
+                printf("verify: path %d, %d px, level %d, meter %d differs at %d,%d\n", path, size, i, meter, x, y);
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int RunVerify()
+{
+    const int cPaths = DetectRasterPath() + 1;
+    const int cSizes = sizeof(verify_sizes) / sizeof(verify_sizes[0]);
+    const int cThemes = sizeof(verify_themes) / sizeof(verify_themes[0]);
+    const int cGolden = sizeof(verify_golden) / sizeof(verify_golden[0]);
+    DWORD foreSaved = fore, backSaved = back;
+
+    int cChecked = 0;
+    int cFailed = 0;
+
+    for (int path = 0; path < cPaths; path++)
+    {
+        for (int t = 0; t < cThemes; t++)
+        {
+            fore = icon_themes[verify_themes[t]][0];
+            back = icon_themes[verify_themes[t]][1];
+
+            for (int s = 0; s < cSizes; s++)
+            {
+                for (int i = 0; i < ICON_LEVELS; i++)
+                {
+                    for (int meter = 0; meter <= METER_STEPS; meter++, cChecked++)
+                        cFailed += CheckRender(path, verify_sizes[s], i, meter);
+                }
+            }
+        }
+
+        fore = icon_themes[0][0];
+        back = icon_themes[0][1];
+
+        for (int size = ICON_GRID; size <= ICON_MAX_SIZE; size++)
+        {
+            cFailed += CheckRender(path, size, 88, 0) + CheckRender(path, size, 101, METER_STEPS);
+            cChecked += 2;
+        }
+
+        static DWORD buffer[48 * 48];
+
+        for (int g = 0; g < cGolden; g++)
+        {
+            ULONGLONG hash = 0xCBF29CE484222325ull;
+
+            for (int i = 0; i < ICON_LEVELS; i++)
+            {
+                RenderIcon(buffer, verify_golden[g].nSize, i);
+                hash = HashIcon(hash, buffer, verify_golden[g].nSize);
+            }
+
+            cChecked += ICON_LEVELS;
+
+            if (hash != verify_golden[g].hash)
+            {
+                printf("verify: path %d, %d px hash %016llx, golden %016llx\n", path, verify_golden[g].nSize, hash, verify_golden[g].hash);
+                cFailed++;
+            }
+        }
+    }
+
+    raster_path = cPaths - 1;
+    fore = foreSaved;
+    back = backSaved;
+
+    printf("verify: %d icons on %d raster paths, %d differences\n", cChecked, cPaths, cFailed);
+    return cFailed != 0 ? 1 : 0;
+}
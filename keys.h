@@ -0,0 +1,321 @@
+#pragma once
+
+#include <windows.h>
+
+// Key names, chords and key sequences as they're written in shortcut names
+// and manifest lines.
+
+struct KeyInfo
+{
+	const wchar_t *name;
+	int code;
+};
+
+static constexpr KeyInfo key_map[] = {
+	{L"VK_LBUTTON",             0x01}, {L"VK_RBUTTON",             0x02}, {L"VK_CANCEL",              0x03},
+	{L"VK_MBUTTON",             0x04}, {L"VK_XBUTTON1",            0x05}, {L"VK_XBUTTON2",            0x06},
+	{L"VK_BACK",                0x08}, {L"VK_TAB",                 0x09}, {L"VK_CLEAR",               0x0C},
+	{L"VK_RETURN",              0x0D}, {L"VK_SHIFT",               0x10}, {L"VK_CONTROL",             0x11},
+	{L"VK_MENU",                0x12}, {L"VK_PAUSE",               0x13}, {L"VK_CAPITAL",             0x14},
+	{L"VK_KANA",                0x15}, {L"VK_HANGEUL",             0x15}, {L"VK_HANGUL",              0x15},
+	{L"VK_JUNJA",               0x17}, {L"VK_FINAL",               0x18}, {L"VK_HANJA",               0x19},
+	{L"VK_KANJI",               0x19}, {L"VK_ESCAPE",              0x1B}, {L"VK_CONVERT",             0x1C},
+	{L"VK_NONCONVERT",          0x1D}, {L"VK_ACCEPT",              0x1E}, {L"VK_MODECHANGE",          0x1F},
+	{L"VK_SPACE",               0x20}, {L"VK_PRIOR",               0x21}, {L"VK_NEXT",                0x22},
+	{L"VK_END",                 0x23}, {L"VK_HOME",                0x24}, {L"VK_LEFT",                0x25},
+	{L"VK_UP",                  0x26}, {L"VK_RIGHT",               0x27}, {L"VK_DOWN",                0x28},
+	{L"VK_SELECT",              0x29}, {L"VK_PRINT",               0x2A}, {L"VK_EXECUTE",             0x2B},
+	{L"VK_SNAPSHOT",            0x2C}, {L"VK_INSERT",              0x2D}, {L"VK_DELETE",              0x2E},
+	{L"VK_HELP",                0x2F}, {L"VK_LWIN",                0x5B}, {L"VK_RWIN",                0x5C},
+	{L"VK_APPS",                0x5D}, {L"VK_SLEEP",               0x5F}, {L"VK_NUMPAD0",             0x60},
+	{L"VK_NUMPAD1",             0x61}, {L"VK_NUMPAD2",             0x62}, {L"VK_NUMPAD3",             0x63},
+	{L"VK_NUMPAD4",             0x64}, {L"VK_NUMPAD5",             0x65}, {L"VK_NUMPAD6",             0x66},
+	{L"VK_NUMPAD7",             0x67}, {L"VK_NUMPAD8",             0x68}, {L"VK_NUMPAD9",             0x69},
+	{L"VK_MULTIPLY",            0x6A}, {L"VK_ADD",                 0x6B}, {L"VK_SEPARATOR",           0x6C},
+	{L"VK_SUBTRACT",            0x6D}, {L"VK_DECIMAL",             0x6E}, {L"VK_DIVIDE",              0x6F},
+	{L"VK_F1",                  0x70}, {L"VK_F2",                  0x71}, {L"VK_F3",                  0x72},
+	{L"VK_F4",                  0x73}, {L"VK_F5",                  0x74}, {L"VK_F6",                  0x75},
+	{L"VK_F7",                  0x76}, {L"VK_F8",                  0x77}, {L"VK_F9",                  0x78},
+	{L"VK_F10",                 0x79}, {L"VK_F11",                 0x7A}, {L"VK_F12",                 0x7B},
+	{L"VK_F13",                 0x7C}, {L"VK_F14",                 0x7D}, {L"VK_F15",                 0x7E},
+	{L"VK_F16",                 0x7F}, {L"VK_F17",                 0x80}, {L"VK_F18",                 0x81},
+	{L"VK_F19",                 0x82}, {L"VK_F20",                 0x83}, {L"VK_F21",                 0x84},
+	{L"VK_F22",                 0x85}, {L"VK_F23",                 0x86}, {L"VK_F24",                 0x87},
+	{L"VK_NUMLOCK",             0x90}, {L"VK_SCROLL",              0x91}, {L"VK_OEM_NEC_EQUAL",       0x92},
+	{L"VK_OEM_FJ_JISHO",        0x92}, {L"VK_OEM_FJ_MASSHOU",      0x93}, {L"VK_OEM_FJ_TOUROKU",      0x94},
+	{L"VK_OEM_FJ_LOYA",         0x95}, {L"VK_OEM_FJ_ROYA",         0x96}, {L"VK_LSHIFT",              0xA0},
+	{L"VK_RSHIFT",              0xA1}, {L"VK_LCONTROL",            0xA2}, {L"VK_RCONTROL",            0xA3},
+	{L"VK_LMENU",               0xA4}, {L"VK_RMENU",               0xA5}, {L"VK_BROWSER_BACK",        0xA6},
+	{L"VK_BROWSER_FORWARD",     0xA7}, {L"VK_BROWSER_REFRESH",     0xA8}, {L"VK_BROWSER_STOP",        0xA9},
+	{L"VK_BROWSER_SEARCH",      0xAA}, {L"VK_BROWSER_FAVORITES",   0xAB}, {L"VK_BROWSER_HOME",        0xAC},
+	{L"VK_VOLUME_MUTE",         0xAD}, {L"VK_VOLUME_DOWN",         0xAE}, {L"VK_VOLUME_UP",           0xAF},
+	{L"VK_MEDIA_NEXT_TRACK",    0xB0}, {L"VK_MEDIA_PREV_TRACK",    0xB1}, {L"VK_MEDIA_STOP",          0xB2},
+	{L"VK_MEDIA_PLAY_PAUSE",    0xB3}, {L"VK_LAUNCH_MAIL",         0xB4}, {L"VK_LAUNCH_MEDIA_SELECT", 0xB5},
+	{L"VK_LAUNCH_APP1",         0xB6}, {L"VK_LAUNCH_APP2",         0xB7}, {L"VK_OEM_1",               0xBA},
+	{L"VK_OEM_PLUS",            0xBB}, {L"VK_OEM_COMMA",           0xBC}, {L"VK_OEM_MINUS",           0xBD},
+	{L"VK_OEM_PERIOD",          0xBE}, {L"VK_OEM_2",               0xBF}, {L"VK_OEM_3",               0xC0},
+	{L"VK_OEM_4",               0xDB}, {L"VK_OEM_5",               0xDC}, {L"VK_OEM_6",               0xDD},
+	{L"VK_OEM_7",               0xDE}, {L"VK_OEM_8",               0xDF}, {L"VK_OEM_AX",              0xE1},
+	{L"VK_OEM_102",             0xE2}, {L"VK_ICO_HELP",            0xE3}, {L"VK_ICO_00",              0xE4},
+	{L"VK_PROCESSKEY",          0xE5}, {L"VK_ICO_CLEAR",           0xE6}, {L"VK_PACKET",              0xE7},
+	{L"VK_OEM_RESET",           0xE9}, {L"VK_OEM_JUMP",            0xEA}, {L"VK_OEM_PA1",             0xEB},
+	{L"VK_OEM_PA2",             0xEC}, {L"VK_OEM_PA3",             0xED}, {L"VK_OEM_WSCTRL",          0xEE},
+	{L"VK_OEM_CUSEL",           0xEF}, {L"VK_OEM_ATTN",            0xF0}, {L"VK_OEM_FINISH",          0xF1},
+	{L"VK_OEM_COPY",            0xF2}, {L"VK_OEM_AUTO",            0xF3}, {L"VK_OEM_ENLW",            0xF4},
+	{L"VK_OEM_BACKTAB",         0xF5}, {L"VK_ATTN",                0xF6}, {L"VK_CRSEL",               0xF7},
+	{L"VK_EXSEL",               0xF8}, {L"VK_EREOF",               0xF9}, {L"VK_PLAY",                0xFA},
+	{L"VK_ZOOM",                0xFB}, {L"VK_NONAME",              0xFC}, {L"VK_PA1",                 0xFD},
+	{L"VK_OEM_CLEAR",           0xFE}
+};
+
+static const int key_count = sizeof(key_map) / sizeof(KeyInfo);
+static const int key_slots = 512;
+
+// Compile-time open addressing table over key_map. Names are hashed without
+// their "VK_" prefix and ignoring case, same as parse_filename compares them.
+
+struct KeyTable
+{
+	unsigned char slots[key_slots];   // key_map index + 1, 0 if empty
+	unsigned char lengths[key_count]; // name length without "VK_"
+	unsigned char names[256];         // key_map index + 1 of the first name for each code
+};
+
+constexpr wchar_t key_upper(wchar_t ch)
+{
+	return (ch >= L'a' && ch <= L'z') ? (wchar_t)(ch - L'a' + L'A') : ch;
+}
+
+constexpr unsigned key_hash(const wchar_t *name, int len)
+{
+	unsigned h = 2166136261u;
+
+	for (int i = 0; i < len; i++)
+		h = (h ^ key_upper(name[i])) * 16777619u;
+
+	return h;
+}
+
+constexpr KeyTable build_key_table()
+{
+	KeyTable table = {};
+
+	for (int i = 0; i < key_count; i++)
+	{
+		const wchar_t *name = key_map[i].name + 3;
+		int len = 0;
+
+		while (name[len] != 0)
+			len++;
+
+		unsigned slot = key_hash(name, len) & (key_slots - 1);
+
+		while (table.slots[slot] != 0)
+			slot = (slot + 1) & (key_slots - 1);
+
+		table.slots[slot] = (unsigned char)(i + 1);
+		table.lengths[i] = (unsigned char)len;
+
+		if (table.names[key_map[i].code] == 0)
+			table.names[key_map[i].code] = (unsigned char)(i + 1);
+	}
+
+	return table;
+}
+
+static constexpr KeyTable key_table = build_key_table();
+
+static_assert(key_count < 255, "key_map indices must fit in KeyTable");
+
+int map_key(const wchar_t *keyname, int len)
+{
+	if (len == 1)
+	{
+		wchar_t ch = towupper(keyname[0]);
+
+		if (ch >= L'A' && ch <= L'Z' || ch >= L'0' && ch <= L'9')
+			return (int)ch;
+		else
+			return 0;
+	}
+	else
+	{
+		unsigned slot = key_hash(keyname, len) & (key_slots - 1);
+
+		while (int index = key_table.slots[slot])
+		{
+			const KeyInfo &key = key_map[index - 1];
+
+			if (key_table.lengths[index - 1] == len && _wcsnicmp(keyname, key.name + 3, len) == 0)
+				return key.code;
+
+			slot = (slot + 1) & (key_slots - 1);
+		}
+
+		return 0;
+	}
+}
+
+// The original lookup, a linear scan over key_map. Only kept for the
+// benchmark (bench.cxx), as the baseline map_key is measured against.
+
+int map_key_linear(const wchar_t *keyname, int len)
+{
+	if (len == 1)
+	{
+		wchar_t ch = towupper(keyname[0]);
+
+		if (ch >= L'A' && ch <= L'Z' || ch >= L'0' && ch <= L'9')
+			return (int)ch;
+		else
+			return 0;
+	}
+	else
+	{
+		for (int i = 0; i < key_count; i++)
+		{
+			const wchar_t *name = key_map[i].name + 3;
+			int n = wcslen(name);
+
+			if (n == len && _wcsnicmp(keyname, name, len) == 0)
+				return key_map[i].code;
+		}
+
+		return 0;
+	}
+}
+
+// Reverse of map_key: points *name at the key name (without "VK_") and
+// returns its length, or 0 if the code has no name.
+
+int key_name(UINT vk, const wchar_t **name)
+{
+	static const wchar_t alnum[] = L"0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+	if (vk >= L'0' && vk <= L'9')
+	{
+		*name = &alnum[vk - L'0'];
+		return 1;
+	}
+	else if (vk >= L'A' && vk <= L'Z')
+	{
+		*name = &alnum[10 + vk - L'A'];
+		return 1;
+	}
+	else if (vk < 256 && key_table.names[vk] != 0)
+	{
+		int index = key_table.names[vk] - 1;
+		*name = key_map[index].name + 3;
+		return key_table.lengths[index];
+	}
+
+	*name = 0;
+	return 0;
+}
+
+bool parse_chord(const wchar_t *s, const wchar_t *end, UINT *modifiers, UINT *vk)
+{
+	const wchar_t *delim = 0;
+	int len = 0;
+
+	*modifiers = 0;
+	*vk = 0;
+
+	// manifest chords point into the file, they aren't terminated at end
+	while (s < end && (delim = wmemchr(s, L'+', end - s)) != 0)
+	{
+		len = delim - s;
+
+		if (len == 3 && _wcsnicmp(s, L"win", 3) == 0)
+		{
+			if (*modifiers & MOD_WIN)
+				return false;
+
+			*modifiers |= MOD_WIN;
+		}
+		else if (len == 3 && _wcsnicmp(s, L"alt", 3) == 0)
+		{
+			if (*modifiers & MOD_ALT)
+				return false;
+
+			*modifiers |= MOD_ALT;
+		}
+		else if (len == 4 && _wcsnicmp(s, L"ctrl", 4) == 0)
+		{
+			if (*modifiers & MOD_CONTROL)
+				return false;
+
+			*modifiers |= MOD_CONTROL;
+		}
+		else if (len == 5 && _wcsnicmp(s, L"shift", 5) == 0)
+		{
+			if (*modifiers & MOD_SHIFT)
+				return false;
+
+			*modifiers |= MOD_SHIFT;
+		}
+		else
+		{
+			return false;
+		}
+
+		s = delim + 1;
+	}
+
+	if (s >= end)
+		return false;
+
+	len = end - s;
+	*vk = map_key(s, len);
+
+	return *vk != 0;
+}
+
+bool parse_filename(const wchar_t *filename, UINT *modifiers, UINT *vk)
+{
+	int len = wcslen(filename);
+
+	if (len <= 4 || _wcsnicmp(filename + len - 4, L".lnk", 4) != 0)
+		return false;
+
+	const wchar_t *end = filename + len - 4;
+	const wchar_t *delim = wcschr(filename, L' ');
+
+	if (delim != 0 && delim < end)
+		end = delim;
+
+	return parse_chord(filename, end, modifiers, vk);
+}
+
+// Parses a key sequence such as "ctrl+k ctrl+c.lnk" into steps of
+// (modifiers << 8 | vk) and returns the number of steps. Steps after the
+// first need a modifier, so names like "ctrl+a x.lnk" stay single chords.
+
+int parse_sequence(const wchar_t *filename, unsigned short *steps, int max)
+{
+	int len = wcslen(filename);
+
+	if (len <= 4 || _wcsnicmp(filename + len - 4, L".lnk", 4) != 0)
+		return 0;
+
+	const wchar_t *end = filename + len - 4;
+	const wchar_t *s = filename;
+	int count = 0;
+
+	while (s < end && count < max)
+	{
+		const wchar_t *delim = wcschr(s, L' ');
+		const wchar_t *token_end = (delim != 0 && delim < end) ? delim : end;
+
+		UINT modifiers = 0;
+		UINT vk = 0;
+
+		if (!parse_chord(s, token_end, &modifiers, &vk) || (count > 0 && modifiers == 0))
+			break;
+
+		steps[count++] = (unsigned short)((modifiers << 8) | vk);
+		s = token_end + 1;
+	}
+
+	return count;
+}
@@ -0,0 +1,301 @@
+#pragma once
+
+#include "bindings.h"
+#include "keys.h"
+#include "shortcut.h"
+
+// Manifest files hold one binding per line, as an alternative to encoding
+// them in shortcut names:
+//
+//   # comment
+//   ctrl+alt+t = "C:\Program Files\Terminal\term.exe" --new-tab
+//
+// The chord uses the same grammar as file names. The target may be quoted
+// (there are no escapes, backslashes are taken as they are) and the rest of
+// the line is passed as arguments. The file is UTF-16 if it starts with a
+// byte order mark, UTF-8 otherwise.
+
+struct ManifestError
+{
+	int line;
+	int column;
+	const wchar_t *message;
+};
+
+// Where the parts of a line are, in the line itself
+struct ManifestLine
+{
+	const wchar_t *target;
+	const wchar_t *target_end;
+	const wchar_t *arguments;
+	const wchar_t *arguments_end;
+};
+
+bool decode_utf8(const unsigned char *&p, const unsigned char *end, unsigned &ch)
+{
+	unsigned lead = *p++;
+
+	if (lead < 0x80)
+	{
+		ch = lead;
+		return true;
+	}
+
+	int extra = (lead >= 0xF0 && lead < 0xF5) ? 3 : (lead >= 0xE0) ? 2 : (lead >= 0xC2) ? 1 : -1;
+
+	if (extra < 0 || lead >= 0xF5 || end - p < extra)
+		return false;
+
+	ch = lead & (0x3F >> extra);
+
+	for (int i = 0; i < extra; i++)
+	{
+		if ((p[i] & 0xC0) != 0x80)
+			return false;
+
+		ch = (ch << 6) | (p[i] & 0x3F);
+	}
+
+	p += extra;
+
+	static const unsigned min[] = { 0, 0x80, 0x800, 0x10000 };
+	return ch >= min[extra] && ch <= 0x10FFFF && (ch < 0xD800 || ch > 0xDFFF);
+}
+
+bool decode_utf16(const unsigned char *&p, const unsigned char *end, unsigned &ch)
+{
+	if (end - p < 2)
+	{
+		p = end;
+		return false;
+	}
+
+	ch = read_u16(p);
+	p += 2;
+
+	if (ch < 0xD800 || ch > 0xDFFF)
+		return true;
+
+	if (ch > 0xDBFF || end - p < 2 || read_u16(p) < 0xDC00 || read_u16(p) > 0xDFFF)
+		return false;
+
+	ch = 0x10000 + ((ch - 0xD800) << 10) + (read_u16(p) - 0xDC00);
+	p += 2;
+	return true;
+}
+
+bool is_blank(wchar_t ch)
+{
+	return ch == L' ' || ch == L'\t';
+}
+
+// Parses one line; returns false with *error pointing at the offending
+// character. Blank and comment lines leave hk.vk at 0.
+
+bool parse_manifest_line(const wchar_t *s, const wchar_t *end, HotKey &hk, ManifestLine &parts, const wchar_t **error, const wchar_t **message)
+{
+	while (s < end && is_blank(*s))
+		s++;
+
+	if (s == end || *s == L'#' || *s == L';')
+		return true;
+
+	const wchar_t *eq = s;
+
+	while (eq < end && *eq != L'=')
+		eq++;
+
+	if (eq == end)
+	{
+		*error = end;
+		*message = L"expected '='";
+		return false;
+	}
+
+	const wchar_t *chord_end = eq;
+
+	while (chord_end > s && is_blank(chord_end[-1]))
+		chord_end--;
+
+	if (!parse_chord(s, chord_end, &hk.modifiers, &hk.vk))
+	{
+		*error = s;
+		*message = L"invalid chord";
+		return false;
+	}
+
+	const wchar_t *t = eq + 1;
+
+	while (t < end && is_blank(*t))
+		t++;
+
+	const wchar_t *target = t;
+	const wchar_t *target_end = 0;
+
+	if (t < end && *t == L'"')
+	{
+		target = ++t;
+
+		while (t < end && *t != L'"')
+			t++;
+
+		if (t == end)
+		{
+			*error = target - 1;
+			*message = L"unterminated quote";
+			return false;
+		}
+
+		target_end = t++;
+	}
+	else
+	{
+		while (t < end && !is_blank(*t))
+			t++;
+
+		target_end = t;
+	}
+
+	if (target == target_end)
+	{
+		*error = target;
+		*message = L"missing target";
+		return false;
+	}
+
+	while (t < end && is_blank(*t))
+		t++;
+
+	while (end > t && is_blank(end[-1]))
+		end--;
+
+	parts.target = target;
+	parts.target_end = target_end;
+	parts.arguments = t;
+	parts.arguments_end = end;
+
+	return true;
+}
+
+// Appends the entries to found. Each line is decoded straight from the
+// mapped file onto the end of arena and parsed there; a binding then keeps
+// its target and arguments, moved to the start of its line and null
+// terminated, as spans of the arena, and anything else is dropped again.
+
+void parse_manifest(const unsigned char *data, size_t size, std::vector<HotKey> &found, std::vector<wchar_t> &arena, std::vector<ManifestError> &errors)
+{
+	const unsigned char *p = data;
+	const unsigned char *end = data + size;
+	bool utf16 = size >= 2 && data[0] == 0xFF && data[1] == 0xFE;
+
+	if (utf16)
+		p += 2;
+	else if (size >= 3 && data[0] == 0xEF && data[1] == 0xBB && data[2] == 0xBF)
+		p += 3;
+
+	// never more code units than bytes, so the lines fit without growing
+	arena.reserve(arena.size() + (size_t)(end - p) + 1);
+
+	int number = 0;
+
+	while (p < end)
+	{
+		size_t start = arena.size();
+		int bad = 0;
+
+		number++;
+
+		while (p < end)
+		{
+			// plain ASCII runs are widened in one go
+			if (!utf16 && *p < 0x80 && *p != '\n' && *p != 0)
+			{
+				const unsigned char *run = p;
+
+				while (p < end && *p < 0x80 && *p != '\n' && *p != 0)
+					p++;
+
+				arena.insert(arena.end(), run, p);
+				continue;
+			}
+
+			unsigned ch = 0;
+
+			// a null would cut the target short in the arena
+			if (!(utf16 ? decode_utf16(p, end, ch) : decode_utf8(p, end, ch)) || ch == 0)
+			{
+				if (bad == 0)
+					bad = (int)(arena.size() - start) + 1;
+
+				continue;
+			}
+
+			if (ch == L'\n')
+				break;
+
+			if (ch > 0xFFFF)
+			{
+				arena.push_back((wchar_t)(0xD800 + ((ch - 0x10000) >> 10)));
+				arena.push_back((wchar_t)(0xDC00 + ((ch - 0x10000) & 0x3FF)));
+			}
+			else
+			{
+				arena.push_back((wchar_t)ch);
+			}
+		}
+
+		if (bad != 0)
+		{
+			ManifestError e = { number, bad, L"invalid text encoding" };
+			errors.push_back(e);
+			arena.resize(start);
+			continue;
+		}
+
+		if (arena.size() > start && arena.back() == L'\r')
+			arena.pop_back();
+
+		wchar_t *line = arena.data() + start;
+		HotKey hk = {0};
+		ManifestLine parts = {};
+		const wchar_t *error = 0;
+		const wchar_t *message = 0;
+
+		if (!parse_manifest_line(line, line + (arena.size() - start), hk, parts, &error, &message))
+		{
+			ManifestError e = { number, (int)(error - line) + 1, message };
+			errors.push_back(e);
+			arena.resize(start);
+			continue;
+		}
+
+		if (hk.vk == 0)
+		{
+			arena.resize(start);
+			continue;
+		}
+
+		// both parts only ever move towards the start of the line
+		wchar_t *out = std::copy(parts.target, parts.target_end, line);
+		*out++ = 0;
+
+		hk.name = (unsigned)start;
+
+		if (parts.arguments < parts.arguments_end)
+		{
+			hk.arguments = (unsigned)(out - arena.data());
+			out = std::copy(parts.arguments, parts.arguments_end, out);
+			*out++ = 0;
+		}
+
+		arena.resize(out - arena.data());
+
+		hk.manifest = true;
+		hk.target = hk.name;
+		hk.show = SW_SHOWNORMAL;
+		hk.expand = wcschr(&arena[hk.name], L'%') != 0;
+		hk.resolved = is_executable(&arena[hk.name]);
+
+		found.push_back(std::move(hk));
+	}
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <windows.h>
+#include <vector>
+
+// Sequence matcher for the keyboard hook mode. All bindings are compiled into
+// a DFA over the chords they use: each chord maps to a symbol (0 for chords
+// no binding uses) and each state has one transition per symbol, with misses
+// already redirected to wherever the root would go. A keystroke is then two
+// table lookups, with no allocation, whatever the number of bindings.
+
+static const int sequence_max = 4;
+static const unsigned sequence_timeout = 1500;
+
+struct Matcher
+{
+	std::vector<unsigned short> symbols; // chord -> symbol
+	std::vector<int> next;               // state * symbol_count + symbol -> state
+	std::vector<int> accept;             // state -> hotkey id, 0 if not accepting
+	int symbol_count;
+	int state;
+	unsigned last_time;
+};
+
+// Builds the matcher from (id, steps) bindings. A binding that is a prefix of
+// another, or has one as a prefix, conflicts and the first one wins.
+
+void compile_matcher(Matcher &m, const std::vector<int> &ids, const std::vector<unsigned short> &steps, const std::vector<int> &counts)
+{
+	m.symbols.assign(1 << 12, 0);
+	m.symbol_count = 1;
+	m.state = 0;
+	m.last_time = 0;
+
+	for (size_t i = 0; i < steps.size(); i++)
+	{
+		if (m.symbols[steps[i]] == 0)
+			m.symbols[steps[i]] = (unsigned short)m.symbol_count++;
+	}
+
+	m.next.assign(m.symbol_count, -1);
+	m.accept.assign(1, 0);
+
+	size_t first = 0;
+
+	for (size_t i = 0; i < ids.size(); first += counts[i], i++)
+	{
+		int state = 0;
+		bool conflict = false;
+
+		for (int j = 0; j < counts[i] && !conflict; j++)
+		{
+			int &next = m.next[state * m.symbol_count + m.symbols[steps[first + j]]];
+
+			if (next < 0)
+			{
+				next = (int)m.accept.size();
+				m.next.resize(m.next.size() + m.symbol_count, -1);
+				m.accept.push_back(0);
+			}
+
+			state = m.next[state * m.symbol_count + m.symbols[steps[first + j]]];
+			conflict = m.accept[state] != 0;
+		}
+
+		if (conflict || state == 0)
+			continue;
+
+		// a state with children can't accept, the longer binding got there first
+		bool leaf = true;
+
+		for (int x = 0; x < m.symbol_count && leaf; x++)
+			leaf = m.next[state * m.symbol_count + x] < 0;
+
+		if (leaf)
+			m.accept[state] = ids[i];
+	}
+
+	int states = (int)m.accept.size();
+
+	for (int x = 0; x < m.symbol_count; x++)
+	{
+		if (m.next[x] < 0)
+			m.next[x] = 0;
+	}
+
+	for (int s = 1; s < states; s++)
+	{
+		for (int x = 0; x < m.symbol_count; x++)
+		{
+			if (m.next[s * m.symbol_count + x] < 0)
+				m.next[s * m.symbol_count + x] = m.next[x];
+		}
+	}
+}
+
+// Feeds one key press. Returns the id of a completed binding, -1 if the key
+// is part of a sequence in progress, or 0 if it matched nothing.
+
+int match_key(Matcher &m, UINT modifiers, UINT vk, unsigned time)
+{
+	if (m.symbols.empty() || vk > 0xFF)
+		return 0;
+
+	if (m.state != 0 && time - m.last_time > sequence_timeout)
+		m.state = 0;
+
+	m.last_time = time;
+
+	int symbol = m.symbols[((modifiers & 0xF) << 8) | vk];
+	int state = m.next[m.state * m.symbol_count + symbol];
+	int id = m.accept[state];
+
+	m.state = (id != 0) ? 0 : state;
+
+	return (id != 0) ? id : (state != 0 ? -1 : 0);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "bindings.h"
+
+// Everything the hotkey logic needs from the OS goes through a Platform, so
+// reload and dispatch can be driven without a desktop session.
+
+struct Platform
+{
+	bool (*register_hotkey)(int id, UINT modifiers, UINT vk);
+	void (*unregister_hotkey)(int id);
+	void (*find_files)(const wchar_t *directory, void (*found)(const wchar_t *name, bool directory, unsigned long long mtime, void *context), void *context);
+	bool (*read_file)(const wchar_t *filename, std::vector<unsigned char> &data);
+	bool (*write_file)(const wchar_t *filename, const std::vector<unsigned char> &data);
+	const unsigned char *(*map_file)(const wchar_t *filename, size_t *size);
+	void (*unmap_file)(const unsigned char *data);
+	bool (*directory_stamp)(const wchar_t *directory, unsigned long long *stamp);
+	HANDLE (*open_watch)(const wchar_t *directory);
+	void (*next_watch)(HANDLE watch);
+	void (*close_watch)(HANDLE watch);
+	bool (*create_process)(const Shortcut &link);
+	bool (*launch)(const wchar_t *filename, const wchar_t *parameters);
+	bool (*focus_running)(const Shortcut &link);
+	unsigned long long (*read_ahead)(const wchar_t *filename, unsigned long long limit);
+	std::wstring (*expand)(const std::wstring &s);
+	void (*thread_init)();
+	void (*thread_exit)();
+};
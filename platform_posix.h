@@ -0,0 +1,460 @@
+#pragma once
+
+#include <windows.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "platform.h"
+
+// The Platform for Linux, headless: there's no system wide hotkey service to
+// register with, so registrations are accepted and nothing posts WM_HOTKEY
+// but the synthetic session. Files, directory watches and launches are real.
+// Paths go through compat_path (UTF-8, slashes), stamps and mtimes are
+// nanoseconds since the epoch.
+
+extern char **environ;
+
+unsigned long long posix_mtime(const struct stat &st)
+{
+	return (unsigned long long)st.st_mtim.tv_sec * 1000000000ull + (unsigned long long)st.st_mtim.tv_nsec;
+}
+
+bool posix_register_hotkey(int id, UINT modifiers, UINT vk)
+{
+	return true;
+}
+
+void posix_unregister_hotkey(int id)
+{
+}
+
+void posix_find_files(const wchar_t *directory, void (*found)(const wchar_t *name, bool directory, unsigned long long mtime, void *context), void *context)
+{
+	DIR *dir = opendir(compat_path(directory).c_str());
+
+	if (dir == 0)
+		return;
+
+	while (dirent *entry = readdir(dir))
+	{
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+
+		struct stat st;
+
+		if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+			continue;
+
+		// a link to a file counts as the file; links to directories aren't
+		// followed out of the tree, like junctions on Windows
+		if (S_ISLNK(st.st_mode) && (fstatat(dirfd(dir), entry->d_name, &st, 0) != 0 || S_ISDIR(st.st_mode)))
+			continue;
+
+		found(compat_widen(entry->d_name).c_str(), S_ISDIR(st.st_mode), posix_mtime(st), context);
+	}
+
+	closedir(dir);
+}
+
+bool posix_read_file(const wchar_t *filename, std::vector<unsigned char> &data)
+{
+	int fd = open(compat_path(filename).c_str(), O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	bool ok = false;
+
+	// shortcuts are small, anything big isn't worth parsing
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size <= 1024 * 1024)
+	{
+		size_t size = (size_t)st.st_size;
+		size_t done = 0;
+		ssize_t n = 1;
+
+		data.resize(size);
+
+		while (done < size && (n = read(fd, &data[done], size - done)) > 0)
+			done += (size_t)n;
+
+		ok = done == size;
+	}
+
+	close(fd);
+	return ok;
+}
+
+bool posix_write_file(const wchar_t *filename, const std::vector<unsigned char> &data)
+{
+	// write a temporary file and swap it in, so readers never see a partial file
+	std::string path = compat_path(filename);
+	std::string temp = path + ".tmp";
+
+	int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (fd < 0)
+		return false;
+
+	size_t done = 0;
+	ssize_t n = 1;
+
+	while (done < data.size() && (n = write(fd, &data[done], data.size() - done)) > 0)
+		done += (size_t)n;
+
+	bool ok = close(fd) == 0 && done == data.size() && rename(temp.c_str(), path.c_str()) == 0;
+
+	if (!ok)
+		unlink(temp.c_str());
+
+	return ok;
+}
+
+// munmap needs the length back, so the mappings are kept by address
+static std::mutex posix_maps_lock;
+static std::unordered_map<const unsigned char*, size_t> posix_maps;
+
+const unsigned char *posix_map_file(const wchar_t *filename, size_t *size)
+{
+	int fd = open(compat_path(filename).c_str(), O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return 0;
+
+	struct stat st;
+	const unsigned char *data = 0;
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && st.st_size < 0x40000000)
+	{
+		void *view = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (view != MAP_FAILED)
+		{
+			data = (const unsigned char*)view;
+			*size = (size_t)st.st_size;
+
+			std::lock_guard<std::mutex> lock(posix_maps_lock);
+			posix_maps[data] = *size;
+		}
+	}
+
+	close(fd);
+	return data;
+}
+
+void posix_unmap_file(const unsigned char *data)
+{
+	std::lock_guard<std::mutex> lock(posix_maps_lock);
+	std::unordered_map<const unsigned char*, size_t>::iterator it = posix_maps.find(data);
+
+	if (it == posix_maps.end())
+		return;
+
+	munmap((void*)data, it->second);
+	posix_maps.erase(it);
+}
+
+bool posix_directory_stamp(const wchar_t *directory, unsigned long long *stamp)
+{
+	struct stat st;
+
+	if (stat(compat_path(directory).c_str(), &st) != 0)
+		return false;
+
+	*stamp = posix_mtime(st);
+	return true;
+}
+
+// A watch is an inotify descriptor with a watch on every directory of the
+// tree, since inotify only reports a directory's own entries. It polls
+// readable until next_watch drains the events, which also puts watches on
+// directories created or moved in since.
+
+static const uint32_t posix_watch_events = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+	IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW;
+
+struct PosixWatch : CompatObject
+{
+	std::string root;
+	std::unordered_map<int, std::string> directories; // by watch descriptor
+};
+
+void posix_watch_tree(PosixWatch *watch, const std::string &path)
+{
+	int wd = inotify_add_watch(watch->fd, path.c_str(), posix_watch_events);
+
+	if (wd < 0)
+		return;
+
+	watch->directories[wd] = path;
+
+	DIR *dir = opendir(path.c_str());
+
+	if (dir == 0)
+		return;
+
+	while (dirent *entry = readdir(dir))
+	{
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+
+		struct stat st;
+
+		if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode))
+			posix_watch_tree(watch, path + "/" + entry->d_name);
+	}
+
+	closedir(dir);
+}
+
+HANDLE posix_open_watch(const wchar_t *directory)
+{
+	PosixWatch *watch = new PosixWatch();
+	watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	watch->root = compat_path(directory);
+
+	if (watch->fd >= 0)
+		posix_watch_tree(watch, watch->root);
+
+	if (watch->directories.empty())
+	{
+		delete watch;
+		return 0;
+	}
+
+	return watch;
+}
+
+void posix_next_watch(HANDLE handle)
+{
+	PosixWatch *watch = (PosixWatch*)handle;
+	alignas(inotify_event) char buffer[16 * 1024];
+	ssize_t n;
+	bool overflow = false;
+
+	while ((n = read(watch->fd, buffer, sizeof(buffer))) > 0)
+	{
+		for (char *p = buffer; p < buffer + n; p += sizeof(inotify_event) + ((inotify_event*)p)->len)
+		{
+			const inotify_event *event = (const inotify_event*)p;
+
+			if (event->mask & IN_Q_OVERFLOW)
+			{
+				overflow = true;
+			}
+			else if (event->mask & IN_IGNORED)
+			{
+				watch->directories.erase(event->wd);
+			}
+			else if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+			{
+				std::unordered_map<int, std::string>::iterator it = watch->directories.find(event->wd);
+
+				if (it != watch->directories.end())
+					posix_watch_tree(watch, it->second + "/" + event->name);
+			}
+		}
+	}
+
+	// events were lost, directories made in the meantime may be unwatched
+	if (overflow)
+		posix_watch_tree(watch, watch->root);
+}
+
+void posix_close_watch(HANDLE watch)
+{
+	CloseHandle(watch);
+}
+
+// %NAME% is replaced with the variable's value; unknown names are left as
+// they are, like ExpandEnvironmentStrings does.
+
+std::wstring posix_expand(const std::wstring &s)
+{
+	std::wstring out;
+	size_t i = 0;
+
+	while (i < s.size())
+	{
+		size_t start = s.find(L'%', i);
+		size_t end = start != std::wstring::npos ? s.find(L'%', start + 1) : std::wstring::npos;
+
+		if (end == std::wstring::npos)
+			break;
+
+		const char *value = getenv(compat_narrow(&s[start + 1], end - start - 1).c_str());
+
+		out.append(s, i, start - i);
+
+		if (value != 0 && end > start + 1)
+		{
+			out += compat_widen(value);
+			i = end + 1;
+		}
+		else
+		{
+			out += L'%';
+			i = start + 1;
+		}
+	}
+
+	out.append(s, i, std::wstring::npos);
+	return out;
+}
+
+// Splits a command line the way the Windows runtime does for the common
+// cases: blanks separate arguments, double quotes group them, and \" is a
+// literal quote.
+
+std::vector<std::string> posix_split_arguments(const std::wstring &arguments)
+{
+	std::vector<std::string> out;
+	std::wstring current;
+	bool quoted = false;
+	bool any = false;
+
+	for (size_t i = 0; i < arguments.size(); i++)
+	{
+		wchar_t ch = arguments[i];
+
+		if (ch == L'\\' && i + 1 < arguments.size() && arguments[i + 1] == L'"')
+		{
+			current += L'"';
+			any = true;
+			i++;
+		}
+		else if (ch == L'"')
+		{
+			quoted = !quoted;
+			any = true;
+		}
+		else if (!quoted && (ch == L' ' || ch == L'\t'))
+		{
+			if (any)
+				out.push_back(compat_narrow(current.c_str(), current.size()));
+
+			current.clear();
+			any = false;
+		}
+		else
+		{
+			current += ch;
+			any = true;
+		}
+	}
+
+	if (any)
+		out.push_back(compat_narrow(current.c_str(), current.size()));
+
+	return out;
+}
+
+bool posix_spawn_command(const std::string &program, const std::wstring &arguments, const std::string &directory, bool search)
+{
+	std::vector<std::string> args = posix_split_arguments(arguments);
+	std::vector<char*> argv;
+
+	argv.push_back((char*)program.c_str());
+
+	for (size_t i = 0; i < args.size(); i++)
+		argv.push_back(&args[i][0]);
+
+	argv.push_back(0);
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+
+	if (!directory.empty())
+		posix_spawn_file_actions_addchdir_np(&actions, directory.c_str());
+
+	pid_t pid;
+	int error = search ? posix_spawnp(&pid, program.c_str(), &actions, 0, argv.data(), environ) :
+		posix_spawn(&pid, program.c_str(), &actions, 0, argv.data(), environ);
+
+	posix_spawn_file_actions_destroy(&actions);
+	return error == 0;
+}
+
+bool posix_create_process(const Shortcut &link)
+{
+	std::wstring target = link.expand ? posix_expand(link.target) : link.target;
+	std::wstring directory = posix_expand(link.directory);
+
+	return posix_spawn_command(compat_path(target.c_str()), link.arguments, compat_path(directory.c_str()), false);
+}
+
+// Without a shell to open documents with, only programs can be launched
+bool posix_launch(const wchar_t *filename, const wchar_t *parameters)
+{
+	return posix_spawn_command(compat_path(filename), parameters != 0 ? parameters : L"", std::string(), true);
+}
+
+bool posix_focus_running(const Shortcut &link)
+{
+	return false;
+}
+
+// Asks the kernel to read the file (up to limit bytes) into the page cache.
+// The read happens in the background, nothing is copied out, and the
+// returned size is what was asked for rather than what was read.
+
+unsigned long long posix_read_ahead(const wchar_t *filename, unsigned long long limit)
+{
+	int fd = open(compat_path(filename).c_str(), O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return 0;
+
+	struct stat st;
+	unsigned long long size = 0;
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+		size = std::min<unsigned long long>((unsigned long long)st.st_size, limit);
+
+	if (size != 0 && posix_fadvise(fd, 0, (off_t)size, POSIX_FADV_WILLNEED) != 0)
+		size = 0;
+
+	close(fd);
+	return size;
+}
+
+void posix_thread_init()
+{
+}
+
+void posix_thread_exit()
+{
+}
+
+static const Platform posix_platform = {
+	posix_register_hotkey,
+	posix_unregister_hotkey,
+	posix_find_files,
+	posix_read_file,
+	posix_write_file,
+	posix_map_file,
+	posix_unmap_file,
+	posix_directory_stamp,
+	posix_open_watch,
+	posix_next_watch,
+	posix_close_watch,
+	posix_create_process,
+	posix_launch,
+	posix_focus_running,
+	posix_read_ahead,
+	posix_expand,
+	posix_thread_init,
+	posix_thread_exit
+};
@@ -0,0 +1,256 @@
+#pragma once
+
+#include "bindings.h"
+
+// Minimal reader for the MS-SHLLINK (.lnk) format. Only links that point at
+// a local file are resolved, everything else is left to the shell.
+
+static const unsigned link_has_id_list      = 0x0001;
+static const unsigned link_has_link_info    = 0x0002;
+static const unsigned link_has_name         = 0x0004;
+static const unsigned link_has_relative     = 0x0008;
+static const unsigned link_has_working_dir  = 0x0010;
+static const unsigned link_has_arguments    = 0x0020;
+static const unsigned link_has_icon         = 0x0040;
+static const unsigned link_is_unicode       = 0x0080;
+static const unsigned link_has_exp_string   = 0x0200;
+static const unsigned link_run_as_user      = 0x2000;
+
+static const unsigned char link_clsid[16] = {
+	0x01, 0x14, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46
+};
+
+// null terminated string at data[offset], limited to data[end]
+
+bool read_cstring(const unsigned char *data, size_t offset, size_t end, bool unicode, std::wstring &out)
+{
+	size_t width = unicode ? 2 : 1;
+
+	for (size_t i = offset; i + width <= end; i += width)
+	{
+		unsigned ch = unicode ? read_u16(data + i) : data[i];
+
+		if (ch == 0)
+			return true;
+
+		// ANSI strings are in the system code page, only ASCII is safe to widen
+		if (!unicode && ch >= 0x80)
+			return false;
+
+		out += (wchar_t)ch;
+	}
+
+	return false;
+}
+
+bool parse_shortcut(const unsigned char *data, size_t size, Shortcut *link)
+{
+	if (size < 0x4C || read_u32(data) != 0x4C || memcmp(data + 4, link_clsid, 16) != 0)
+		return false;
+
+	unsigned flags = read_u32(data + 0x14);
+
+	if (flags & link_run_as_user)
+		return false;
+
+	link->target.clear();
+	link->arguments.clear();
+	link->directory.clear();
+	link->expand = false;
+	link->show = read_u32(data + 0x3C);
+
+	if (link->show != SW_SHOWMAXIMIZED && link->show != SW_SHOWMINNOACTIVE)
+		link->show = SW_SHOWNORMAL;
+
+	size_t pos = 0x4C;
+
+	if (flags & link_has_id_list)
+	{
+		if (pos + 2 > size)
+			return false;
+
+		pos += 2 + read_u16(data + pos);
+	}
+
+	if (flags & link_has_link_info)
+	{
+		if (pos + 0x1C > size)
+			return false;
+
+		const unsigned char *info = data + pos;
+		size_t info_size = read_u32(info);
+		size_t header_size = read_u32(info + 4);
+
+		if (info_size < 0x1C || pos + info_size > size)
+			return false;
+
+		// VolumeIDAndLocalBasePath, the target is LocalBasePath + CommonPathSuffix
+		if (read_u32(info + 8) & 1)
+		{
+			bool unicode = header_size >= 0x24;
+
+			// the Unicode offsets sit past the fields every LinkInfo has
+			if (unicode && info_size < 0x24)
+				return false;
+
+			size_t base = unicode ? read_u32(info + 0x1C) : read_u32(info + 0x10);
+			size_t suffix = unicode ? read_u32(info + 0x20) : read_u32(info + 0x18);
+
+			if (!read_cstring(info, base, info_size, unicode, link->target) ||
+				!read_cstring(info, suffix, info_size, unicode, link->target))
+				return false;
+		}
+
+		pos += info_size;
+	}
+
+	static const unsigned strings[] = {
+		link_has_name, link_has_relative, link_has_working_dir, link_has_arguments, link_has_icon
+	};
+
+	size_t width = (flags & link_is_unicode) ? 2 : 1;
+
+	for (int i = 0; i < sizeof(strings) / sizeof(strings[0]); i++)
+	{
+		if ((flags & strings[i]) == 0)
+			continue;
+
+		if (pos + 2 > size)
+			return false;
+
+		size_t count = read_u16(data + pos);
+		pos += 2;
+
+		if (pos + count * width > size)
+			return false;
+
+		std::wstring *out = 0;
+
+		if (strings[i] == link_has_working_dir)
+			out = &link->directory;
+		else if (strings[i] == link_has_arguments)
+			out = &link->arguments;
+
+		if (out != 0)
+		{
+			for (size_t j = 0; j < count; j++)
+			{
+				unsigned ch = (width == 2) ? read_u16(data + pos + j * 2) : data[pos + j];
+
+				if (width == 1 && ch >= 0x80)
+					return false;
+
+				*out += (wchar_t)ch;
+			}
+		}
+
+		pos += count * width;
+	}
+
+	// EnvironmentVariableDataBlock overrides the target with an unexpanded path
+	if (flags & link_has_exp_string)
+	{
+		while (pos + 8 <= size)
+		{
+			size_t block_size = read_u32(data + pos);
+
+			if (block_size < 8 || pos + block_size > size)
+				break;
+
+			if (read_u32(data + pos + 4) == 0xA0000001 && block_size == 0x314)
+			{
+				std::wstring target;
+
+				if (read_cstring(data, pos + 8 + 260, pos + block_size, true, target) && !target.empty())
+				{
+					link->target = target;
+					link->expand = true;
+				}
+
+				break;
+			}
+
+			pos += block_size;
+		}
+	}
+
+	return !link->target.empty();
+}
+
+bool is_executable(const wchar_t *path)
+{
+	size_t len = wcslen(path);
+	return len > 4 && _wcsnicmp(path + len - 4, L".exe", 4) == 0;
+}
+
+// Collects the names of the DLLs a PE image imports, from its import
+// directory. Only ASCII names are kept; anything out of bounds ends the walk.
+
+void parse_imports(const unsigned char *data, size_t size, std::vector<std::wstring> &dlls)
+{
+	if (size < 0x40 || read_u16(data) != 0x5A4D)
+		return;
+
+	size_t pe = read_u32(data + 0x3C);
+
+	if (pe > size || size - pe < 24 || read_u32(data + pe) != 0x00004550)
+		return;
+
+	size_t sections = read_u16(data + pe + 6);
+	size_t optional = pe + 24;
+	size_t optional_size = read_u16(data + pe + 20);
+	size_t table = optional + optional_size;
+
+	if (optional_size < 2 || table > size || (size - table) / 40 < sections)
+		return;
+
+	// data directories follow the 32 or 64 bit specific fields, imports are the second one
+	unsigned magic = read_u16(data + optional);
+	size_t directories = magic == 0x10B ? 96 : magic == 0x20B ? 112 : 0;
+
+	if (directories == 0 || optional_size < directories + 16 || read_u32(data + optional + directories - 4) < 2)
+		return;
+
+	auto offset = [&](unsigned rva, size_t *out) {
+		for (size_t i = 0; i < sections; i++)
+		{
+			const unsigned char *section = data + table + i * 40;
+			unsigned address = read_u32(section + 12);
+			unsigned raw_size = read_u32(section + 16);
+			unsigned long long at = (unsigned long long)read_u32(section + 20) + (rva - address);
+
+			if (rva >= address && rva - address < raw_size)
+			{
+				*out = (size_t)at;
+				return at < size;
+			}
+		}
+
+		return false;
+	};
+
+	size_t descriptor = 0;
+
+	if (!offset(read_u32(data + optional + directories + 8), &descriptor))
+		return;
+
+	for (; size - descriptor >= 20 && dlls.size() < 256; descriptor += 20)
+	{
+		unsigned name_rva = read_u32(data + descriptor + 12);
+		size_t name = 0;
+
+		if (name_rva == 0)
+			break;
+
+		if (!offset(name_rva, &name))
+			continue;
+
+		std::wstring dll;
+
+		for (size_t i = name; i < size && i - name < 256 && data[i] > 0 && data[i] < 0x80; i++)
+			dll += (wchar_t)data[i];
+
+		if (!dll.empty())
+			dlls.push_back(dll);
+	}
+}
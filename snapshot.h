@@ -0,0 +1,228 @@
+#pragma once
+
+#include "bindings.h"
+
+// Binding snapshot, a flat little endian file so startup can skip the scan
+// and .lnk parsing while nothing has changed:
+//
+//   header   magic, version, mode, source count, stamp count, entry count,
+//            blob length
+//   sources  offset/length of each root (then the manifest), in order
+//   stamps   offset/length of each scanned directory and its write time (u64)
+//   entries  id, modifiers, vk, flags, show, root, mtime (u64), and
+//            offset/length pairs for name, target, arguments and directory
+//   blob     UTF-16 code units the strings point into. It starts with the
+//            names arena, so every entry string keeps its offset.
+//
+// The mode is the snapshot_mode_* the bindings were scanned for: the hook
+// mode keeps chords that are bound twice, so neither mode can use the
+// other's table.
+
+static const unsigned snapshot_magic = 0x4E534B48; // "HKSN"
+static const unsigned snapshot_version = 5;
+static const size_t snapshot_header_size = 28;
+static const size_t snapshot_source_size = 8;
+static const size_t snapshot_stamp_size = 16;
+static const size_t snapshot_entry_size = 64;
+static const unsigned snapshot_max_id = 1 << 20;
+
+static const unsigned snapshot_resolved = 1;
+static const unsigned snapshot_expand = 2;
+static const unsigned snapshot_manifest = 4;
+
+static const unsigned snapshot_mode_registered = 0;
+static const unsigned snapshot_mode_hook = 1;
+
+void write_snapshot_string(std::vector<unsigned char> &out, std::vector<unsigned short> &blob, const std::wstring &s)
+{
+	write_u32(out, (unsigned)blob.size());
+	write_u32(out, (unsigned)s.size());
+
+	for (size_t i = 0; i < s.size(); i++)
+		blob.push_back((unsigned short)s[i]);
+}
+
+void write_snapshot(const std::vector<HotKey> &table, const std::vector<wchar_t> &arena, unsigned mode,
+	const std::vector<std::wstring> &sources, const std::vector<DirStamp> &stamps, std::vector<unsigned char> &out)
+{
+	std::vector<unsigned short> blob(arena.begin(), arena.end());
+	unsigned count = 0;
+
+	for (size_t i = 0; i < table.size(); i++)
+	{
+		if (table[i].name != 0)
+			count++;
+	}
+
+	out.clear();
+	write_u32(out, snapshot_magic);
+	write_u32(out, snapshot_version);
+	write_u32(out, mode);
+	write_u32(out, (unsigned)sources.size());
+	write_u32(out, (unsigned)stamps.size());
+	write_u32(out, count);
+
+	size_t blob_length_at = out.size();
+	write_u32(out, 0);
+
+	for (size_t i = 0; i < sources.size(); i++)
+		write_snapshot_string(out, blob, sources[i]);
+
+	for (size_t i = 0; i < stamps.size(); i++)
+	{
+		write_snapshot_string(out, blob, stamps[i].path);
+		write_u64(out, stamps[i].mtime);
+	}
+
+	for (size_t i = 0; i < table.size(); i++)
+	{
+		const HotKey &hk = table[i];
+
+		if (hk.name == 0)
+			continue;
+
+		write_u32(out, hk.id);
+		write_u32(out, hk.modifiers);
+		write_u32(out, hk.vk);
+		write_u32(out, (hk.resolved ? snapshot_resolved : 0) | (hk.expand ? snapshot_expand : 0) | (hk.manifest ? snapshot_manifest : 0));
+		write_u32(out, hk.show);
+		write_u32(out, hk.root);
+		write_u64(out, hk.mtime);
+
+		const unsigned strings[] = { hk.name, hk.target, hk.arguments, hk.directory };
+
+		for (int j = 0; j < 4; j++)
+		{
+			write_u32(out, strings[j]);
+			write_u32(out, (unsigned)wcslen(&arena[strings[j]]));
+		}
+	}
+
+	for (int i = 0; i < 4; i++)
+		out[blob_length_at + i] = (unsigned char)(blob.size() >> (i * 8));
+
+	for (size_t i = 0; i < blob.size(); i++)
+	{
+		out.push_back((unsigned char)blob[i]);
+		out.push_back((unsigned char)(blob[i] >> 8));
+	}
+}
+
+bool read_snapshot_string(const unsigned char *entry, const std::vector<wchar_t> &blob, std::wstring &out)
+{
+	size_t offset = read_u32(entry);
+	size_t length = read_u32(entry + 4);
+
+	if (offset > blob.size() || length > blob.size() - offset)
+		return false;
+
+	out.assign(blob.begin() + offset, blob.begin() + offset + length);
+	return true;
+}
+
+// an entry string stays in the arena, so it has to be null terminated there
+bool read_snapshot_offset(const unsigned char *entry, const std::vector<wchar_t> &arena, unsigned *offset)
+{
+	size_t length = read_u32(entry + 4);
+	*offset = read_u32(entry);
+
+	return *offset < arena.size() && length < arena.size() - *offset && arena[*offset + length] == 0;
+}
+
+// Fills table with the snapshot's bindings placed at their id slots, arena
+// with their names and stamps with the directories to check. Fails on
+// anything malformed or if it was written for a different mode or set of
+// sources.
+
+bool read_snapshot(const unsigned char *data, size_t size, unsigned mode, const std::vector<std::wstring> &sources, int root_count,
+	std::vector<HotKey> &table, std::vector<wchar_t> &arena, std::vector<DirStamp> &stamps)
+{
+	if (size < snapshot_header_size || read_u32(data) != snapshot_magic || read_u32(data + 4) != snapshot_version ||
+		read_u32(data + 8) != mode)
+		return false;
+
+	unsigned long long source_count = read_u32(data + 12);
+	unsigned long long stamp_count = read_u32(data + 16);
+	unsigned long long count = read_u32(data + 20);
+	unsigned long long blob_length = read_u32(data + 24);
+
+	if (source_count != sources.size() || blob_length == 0)
+		return false;
+
+	if (snapshot_header_size + source_count * snapshot_source_size + stamp_count * snapshot_stamp_size +
+		count * snapshot_entry_size + blob_length * 2 != size)
+		return false;
+
+	const unsigned char *p = data + snapshot_header_size;
+	const unsigned char *blob = data + size - blob_length * 2;
+
+	arena.resize((size_t)blob_length);
+
+	for (size_t i = 0; i < blob_length; i++)
+		arena[i] = (wchar_t)read_u16(blob + i * 2);
+
+	if (arena[0] != 0)
+		return false;
+
+	std::wstring s;
+
+	for (size_t i = 0; i < source_count; i++, p += snapshot_source_size)
+	{
+		if (!read_snapshot_string(p, arena, s) || s != sources[i])
+			return false;
+	}
+
+	stamps.resize((size_t)stamp_count);
+
+	for (size_t i = 0; i < stamp_count; i++, p += snapshot_stamp_size)
+	{
+		if (!read_snapshot_string(p, arena, stamps[i].path))
+			return false;
+
+		stamps[i].mtime = read_u64(p + 8);
+	}
+
+	table.clear();
+
+	for (size_t i = 0; i < count; i++, p += snapshot_entry_size)
+	{
+		HotKey hk = {0};
+
+		hk.id = read_u32(p);
+		hk.modifiers = read_u32(p + 4);
+		hk.vk = read_u32(p + 8);
+
+		unsigned flags = read_u32(p + 12);
+
+		hk.resolved = (flags & snapshot_resolved) != 0;
+		hk.expand = (flags & snapshot_expand) != 0;
+		hk.manifest = (flags & snapshot_manifest) != 0;
+		hk.show = read_u32(p + 16);
+		hk.root = read_u32(p + 20);
+		hk.mtime = read_u64(p + 24);
+
+		if (hk.id <= 0 || hk.id > snapshot_max_id || hk.vk == 0 || hk.vk > 0xFF || hk.modifiers > 0xF)
+			return false;
+
+		if (hk.root < 0 || hk.root >= (hk.manifest ? (int)source_count : root_count))
+			return false;
+
+		if (!read_snapshot_offset(p + 32, arena, &hk.name) || !read_snapshot_offset(p + 40, arena, &hk.target) ||
+			!read_snapshot_offset(p + 48, arena, &hk.arguments) || !read_snapshot_offset(p + 56, arena, &hk.directory))
+			return false;
+
+		// names must be non empty
+		if (hk.name == 0 || arena[hk.name] == 0)
+			return false;
+
+		if (table.size() < hk.id)
+			table.resize(hk.id);
+
+		if (table[hk.id - 1].name != 0)
+			return false;
+
+		table[hk.id - 1] = hk;
+	}
+
+	return true;
+}
@@ -0,0 +1,29 @@
+// CHECK reports a failed condition with its line and lets the test go on;
+// main returns check_result().
+
+#pragma once
+
+#include <stdio.h>
+
+static int check_failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+bool check(bool ok, const char *text, const char *file, int line)
+{
+	if (!ok)
+	{
+		fprintf(stderr, "%s:%d: failed: %s\n", file, line, text);
+		check_failures++;
+	}
+
+	return ok;
+}
+
+int check_result()
+{
+	if (check_failures != 0)
+		fprintf(stderr, "%d checks failed\n", check_failures);
+
+	return check_failures != 0 ? 1 : 0;
+}
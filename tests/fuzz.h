@@ -0,0 +1,53 @@
+// Fuzz targets define LLVMFuzzerTestOneInput. Built with -DFUZZ=ON (clang)
+// libFuzzer brings its own main; otherwise FUZZ_REPLAY is defined and this
+// main feeds it every file in the corpus directories on the command line,
+// which is how ctest runs them.
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <filesystem>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size);
+
+#ifdef FUZZ_REPLAY
+
+int main(int argc, char **argv)
+{
+	int count = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		for (const auto &entry : std::filesystem::directory_iterator(argv[i]))
+		{
+			FILE *file = fopen(entry.path().string().c_str(), "rb");
+
+			if (file == 0)
+				continue;
+
+			std::vector<unsigned char> data;
+			unsigned char buffer[4096];
+			size_t read;
+
+			while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+				data.insert(data.end(), buffer, buffer + read);
+
+			fclose(file);
+
+			// an exact size heap copy, so reads past the end are caught
+			unsigned char *copy = (unsigned char*)malloc(data.empty() ? 1 : data.size());
+			memcpy(copy, data.data(), data.size());
+			LLVMFuzzerTestOneInput(copy, data.size());
+			free(copy);
+			count++;
+		}
+	}
+
+	printf("%d inputs\n", count);
+	return count != 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,42 @@
+#define UNICODE
+#define NOMINMAX
+
+#include <windows.h>
+#include <vector>
+#include <algorithm>
+
+#include "manifest.h"
+#include "fuzz.h"
+
+// Manifest parser fuzz target, seeded from tests/corpus/manifest. Besides
+// what the sanitizers catch, every entry has to come back as spans inside
+// the arena, and every error has to point into a line that exists.
+
+extern "C" int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size)
+{
+	std::vector<HotKey> found;
+	std::vector<wchar_t> arena(1, 0);
+	std::vector<ManifestError> errors;
+
+	parse_manifest(data, size, found, arena, errors);
+
+	for (size_t i = 0; i < found.size(); i++)
+	{
+		const HotKey &hk = found[i];
+
+		if (hk.vk == 0 || hk.name == 0 || hk.name >= arena.size() || hk.arguments >= arena.size() ||
+			wmemchr(&arena[hk.name], 0, arena.size() - hk.name) == 0 || arena[hk.name] == 0 ||
+			wmemchr(&arena[hk.arguments], 0, arena.size() - hk.arguments) == 0)
+			abort();
+	}
+
+	size_t lines = std::count(data, data + size, '\n') + 1;
+
+	for (size_t i = 0; i < errors.size(); i++)
+	{
+		if (errors[i].line < 1 || (size_t)errors[i].line > lines || errors[i].column < 1 || errors[i].message == 0)
+			abort();
+	}
+
+	return 0;
+}
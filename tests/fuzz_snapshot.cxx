@@ -0,0 +1,61 @@
+#define UNICODE
+#define NOMINMAX
+
+#include <windows.h>
+#include <string>
+#include <vector>
+
+#include "snapshot_sample.h"
+#include "fuzz.h"
+
+// Snapshot reader fuzz target, seeded from tests/corpus/snapshot (snapshots
+// of the sample table). An accepted snapshot has to hold a usable table:
+// ids at their slots and every string terminated inside the arena. Writing
+// it again and reading that back has to give the same table.
+
+extern "C" int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size)
+{
+	static const std::vector<std::wstring> sources = sample_sources();
+
+	for (unsigned mode = snapshot_mode_registered; mode <= snapshot_mode_hook; mode++)
+	{
+		std::vector<HotKey> table;
+		std::vector<wchar_t> arena;
+		std::vector<DirStamp> stamps;
+
+		if (!read_snapshot(data, size, mode, sources, 1, table, arena, stamps))
+			continue;
+
+		for (size_t i = 0; i < table.size(); i++)
+		{
+			const HotKey &hk = table[i];
+
+			if (hk.name == 0)
+				continue;
+
+			if (hk.id != (int)i + 1 || arena[hk.name] == 0)
+				abort();
+
+			const unsigned strings[] = { hk.name, hk.target, hk.arguments, hk.directory };
+
+			for (int k = 0; k < 4; k++)
+			{
+				if (strings[k] >= arena.size() || wmemchr(&arena[strings[k]], 0, arena.size() - strings[k]) == 0)
+					abort();
+			}
+		}
+
+		std::vector<unsigned char> again;
+		write_snapshot(table, arena, mode, sources, stamps, again);
+
+		std::vector<HotKey> read_table;
+		std::vector<wchar_t> read_arena;
+		std::vector<DirStamp> read_stamps;
+
+		if (!read_snapshot(again.data(), again.size(), mode, sources, 1, read_table, read_arena, read_stamps) ||
+			!same_table(table, read_table) || !same_stamps(stamps, read_stamps))
+			abort();
+	}
+
+	return 0;
+}
@@ -0,0 +1,105 @@
+// A small binding table for the snapshot test and the snapshot fuzz corpus:
+// a resolved link, a link left to the shell, a manifest binding and a free
+// slot, over one root and a manifest.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "snapshot.h"
+
+static const wchar_t *sample_root = L"C:\\Users\\me\\Hotkeys";
+static const wchar_t *sample_manifest = L"C:\\Users\\me\\hotkeys.txt";
+
+std::vector<std::wstring> sample_sources()
+{
+	std::vector<std::wstring> sources;
+	sources.push_back(sample_root);
+	sources.push_back(sample_manifest);
+	return sources;
+}
+
+void make_sample(std::vector<HotKey> &table, std::vector<wchar_t> &arena, std::vector<DirStamp> &stamps)
+{
+	const wchar_t *terminal = L"ctrl+alt+t Terminal.lnk";
+
+	arena.assign(1, 0);
+	table.assign(4, HotKey());
+
+	HotKey &link = table[0];
+	link.id = 1;
+	link.modifiers = MOD_CONTROL | MOD_ALT;
+	link.vk = 'T';
+	link.name = add_string(arena, terminal, wcslen(terminal));
+	link.mtime = 0x01DA00001234ABCDull;
+	link.resolved = true;
+	link.show = SW_SHOWMAXIMIZED;
+	link.target = add_string(arena, L"C:\\Windows\\System32\\cmd.exe", 27);
+	link.arguments = add_string(arena, L"/k", 2);
+	link.directory = add_string(arena, L"", 0);
+
+	HotKey &shell = table[1];
+	shell.id = 2;
+	shell.modifiers = MOD_WIN;
+	shell.vk = 0x7C;
+	shell.name = add_string(arena, L"Tools\\win+f13 Settings.lnk", 26);
+	shell.mtime = 0x01DA00005678ull;
+	shell.show = SW_SHOWNORMAL;
+
+	// table[2] is a free slot
+
+	HotKey &manifest = table[3];
+	manifest.id = 4;
+	manifest.modifiers = MOD_SHIFT;
+	manifest.vk = 'K';
+	manifest.root = 1;
+	manifest.manifest = true;
+	manifest.expand = true;
+	manifest.show = SW_SHOWNORMAL;
+	manifest.name = add_string(arena, L"%SystemRoot%\\notepad.exe", 24);
+	manifest.arguments = add_string(arena, L"notes.txt", 9);
+
+	stamps.clear();
+	stamps.push_back(DirStamp());
+	stamps[0].path = sample_root;
+	stamps[0].mtime = 0x01DA0000ABCDull;
+	stamps.push_back(DirStamp());
+	stamps[1].path = std::wstring(sample_root) + L"\\Tools";
+	stamps[1].mtime = 0x01DA0000EF01ull;
+}
+
+bool same_hotkey(const HotKey &a, const HotKey &b)
+{
+	return a.id == b.id && a.modifiers == b.modifiers && a.vk == b.vk && a.root == b.root && a.name == b.name &&
+		a.mtime == b.mtime && a.resolved == b.resolved && a.manifest == b.manifest && a.expand == b.expand &&
+		a.show == b.show && a.target == b.target && a.arguments == b.arguments && a.directory == b.directory;
+}
+
+bool same_table(const std::vector<HotKey> &a, const std::vector<HotKey> &b)
+{
+	if (a.size() != b.size())
+		return false;
+
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		if (!same_hotkey(a[i], b[i]))
+			return false;
+	}
+
+	return true;
+}
+
+bool same_stamps(const std::vector<DirStamp> &a, const std::vector<DirStamp> &b)
+{
+	if (a.size() != b.size())
+		return false;
+
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		if (a[i].path != b[i].path || a[i].mtime != b[i].mtime)
+			return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,156 @@
+#define UNICODE
+#define NOMINMAX
+
+#include <windows.h>
+#include <vector>
+
+#include "check.h"
+
+// The parts of compat/windows.h volumeicon leans on beyond what hotkeys
+// uses: windows, timers aimed at them, threads and GDI accounting.
+
+struct Seen
+{
+	std::vector<UINT> messages;
+	std::vector<WPARAM> timers;
+};
+
+static Seen seen;
+
+LRESULT record_proc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
+{
+	seen.messages.push_back(message);
+
+	if (message == WM_TIMER)
+		seen.timers.push_back(wParam);
+
+	if (message == WM_DESTROY)
+		PostQuitMessage(3);
+
+	return DefWindowProc(hwnd, message, wParam, lParam);
+}
+
+HWND make_window()
+{
+	WNDCLASSEX wc = { sizeof(wc) };
+	wc.lpfnWndProc = record_proc;
+	wc.lpszClassName = L"test";
+	RegisterClassEx(&wc);
+
+	return CreateWindowEx(0, L"test", L"", 0, 0, 0, 0, 0, 0, 0, GetModuleHandle(0), 0);
+}
+
+void test_window()
+{
+	DWORD user = GetGuiResources(GetCurrentProcess(), GR_USEROBJECTS);
+	HWND hwnd = make_window();
+
+	if (!CHECK(hwnd != 0))
+		return;
+
+	CHECK(GetGuiResources(GetCurrentProcess(), GR_USEROBJECTS) == user + 1);
+	CHECK(CreateWindowEx(0, L"missing", L"", 0, 0, 0, 0, 0, 0, 0, 0, 0) == 0);
+
+	// posted messages reach the window procedure through DispatchMessage
+	CHECK(PostMessage(hwnd, WM_USER, 1, 2));
+	MSG msg;
+	CHECK(PeekMessage(&msg, hwnd, 0, 0, PM_REMOVE) && msg.hwnd == hwnd && msg.message == WM_USER);
+	DispatchMessage(&msg);
+	CHECK(seen.messages.size() == 1 && seen.messages[0] == WM_USER);
+
+	// window timers keep the id they're given, apart from the thread's
+	CHECK(SetTimer(hwnd, 7, 10, 0) == 7);
+	UINT_PTR thread_timer = SetTimer(0, 7, 10, 0);
+	CHECK(thread_timer != 0);
+	Sleep(30);
+
+	int ticks = 0;
+
+	while (PeekMessage(&msg, hwnd, 0, 0, PM_REMOVE))
+	{
+		CHECK(msg.message == WM_TIMER && msg.hwnd == hwnd);
+		DispatchMessage(&msg);
+		ticks++;
+	}
+
+	CHECK(ticks == 1 && seen.timers.size() == 1 && seen.timers[0] == 7);
+	CHECK(PeekMessage(&msg, 0, 0, 0, PM_REMOVE) && msg.message == WM_TIMER && msg.hwnd == 0);
+	CHECK(KillTimer(hwnd, 7) && !KillTimer(hwnd, 7) && KillTimer(0, thread_timer));
+
+	// WM_CLOSE destroys it, and then it's gone for posts and timers
+	PostMessage(hwnd, WM_CLOSE, 0, 0);
+
+	while (GetMessage(&msg, 0, 0, 0))
+		DispatchMessage(&msg);
+
+	CHECK(msg.wParam == 3 && seen.messages.back() == WM_DESTROY);
+	CHECK(!PostMessage(hwnd, WM_USER, 0, 0) && SetTimer(hwnd, 1, 10, 0) == 0);
+	CHECK(GetGuiResources(GetCurrentProcess(), GR_USEROBJECTS) == user);
+}
+
+DWORD WINAPI worker(LPVOID parameter)
+{
+	InterlockedIncrement((volatile LONG*)parameter);
+	Sleep(20);
+	return 0;
+}
+
+void test_thread()
+{
+	volatile LONG count = 0;
+	DWORD id = 0;
+	HANDLE thread = CreateThread(0, 0, worker, (LPVOID)&count, 0, &id);
+
+	if (!CHECK(thread != 0))
+		return;
+
+	CHECK(id != 0 && id != GetCurrentThreadId());
+	CHECK(WaitForSingleObject(thread, 2000) == WAIT_OBJECT_0 && count == 1);
+	CHECK(WaitForSingleObject(thread, 0) == WAIT_OBJECT_0);
+	CloseHandle(thread);
+}
+
+void test_gdi()
+{
+	DWORD gdi = GetGuiResources(GetCurrentProcess(), GR_GDIOBJECTS);
+	DWORD user = GetGuiResources(GetCurrentProcess(), GR_USEROBJECTS);
+
+	BITMAPINFO info = {};
+	info.bmiHeader.biSize = sizeof(info.bmiHeader);
+	info.bmiHeader.biWidth = 3;
+	info.bmiHeader.biHeight = -2;
+	info.bmiHeader.biPlanes = 1;
+	info.bmiHeader.biBitCount = 32;
+
+	void *bits = 0;
+	HDC hdc = GetDC(0);
+	HBITMAP color = CreateDIBSection(hdc, &info, DIB_RGB_COLORS, &bits, 0, 0);
+	ReleaseDC(0, hdc);
+	HBITMAP mask = CreateBitmap(3, 2, 1, 1, 0);
+
+	CHECK(color != 0 && bits != 0 && mask != 0);
+	memset(bits, 0xFF, 3 * 2 * 4);
+
+	// the icon holds copies, so the bitmaps can go right away
+	ICONINFO ii = { TRUE, 0, 0, mask, color };
+	HICON icon = CreateIconIndirect(&ii);
+	CHECK(icon != 0);
+	CHECK(GetGuiResources(GetCurrentProcess(), GR_GDIOBJECTS) == gdi + 4);
+
+	DeleteObject(mask);
+	DeleteObject(color);
+	CHECK(GetGuiResources(GetCurrentProcess(), GR_GDIOBJECTS) == gdi + 2);
+	CHECK(GetGuiResources(GetCurrentProcess(), GR_USEROBJECTS) == user + 1);
+
+	DestroyIcon(icon);
+	CHECK(GetGuiResources(GetCurrentProcess(), GR_GDIOBJECTS) == gdi);
+	CHECK(GetGuiResources(GetCurrentProcess(), GR_USEROBJECTS) == user);
+}
+
+int main()
+{
+	test_window();
+	test_thread();
+	test_gdi();
+	return check_result();
+}
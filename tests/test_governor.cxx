@@ -0,0 +1,100 @@
+#include <vector>
+
+#include "governor.h"
+#include "check.h"
+
+Governor make_governor(unsigned burst, unsigned refill, unsigned max_pending, int ids)
+{
+	Governor g = { burst, refill, max_pending };
+	g.empty_at.assign(ids, 0);
+	return g;
+}
+
+void test_burst()
+{
+	Governor g = make_governor(3, 1000, 8, 1);
+
+	// a full bucket takes burst presses at once, then one per refill
+	CHECK(govern(g, 0, 0, 0) == governor_launch);
+	CHECK(govern(g, 0, 0, 0) == governor_launch);
+	CHECK(govern(g, 0, 0, 0) == governor_launch);
+	CHECK(govern(g, 0, 0, 0) == governor_rate_limited);
+	CHECK(govern(g, 0, 999, 0) == governor_rate_limited);
+	CHECK(govern(g, 0, 1000, 0) == governor_launch);
+	CHECK(govern(g, 0, 1000, 0) == governor_rate_limited);
+
+	// idle long enough and the bucket is full again, but no fuller
+	CHECK(govern(g, 0, 100000, 0) == governor_launch);
+	CHECK(govern(g, 0, 100000, 0) == governor_launch);
+	CHECK(govern(g, 0, 100000, 0) == governor_launch);
+	CHECK(govern(g, 0, 100000, 0) == governor_rate_limited);
+
+	CHECK(g.launched == 7 && g.rate_limited == 4 && g.capped == 0);
+}
+
+void test_steady_rate()
+{
+	Governor g = make_governor(3, 1000, 8, 1);
+
+	// holding a key at autorepeat rate settles at one launch per refill
+	unsigned launches = 0;
+
+	for (unsigned long long now = 0; now < 60000; now += 33)
+		launches += govern(g, 0, now, 0) == governor_launch;
+
+	CHECK(launches >= 60 && launches <= 63);
+}
+
+void test_bindings_independent()
+{
+	Governor g = make_governor(1, 1000, 8, 2);
+
+	CHECK(govern(g, 0, 0, 0) == governor_launch);
+	CHECK(govern(g, 0, 0, 0) == governor_rate_limited);
+	CHECK(govern(g, 1, 0, 0) == governor_launch);
+	CHECK(govern(g, 1, 0, 0) == governor_rate_limited);
+}
+
+void test_pending_cap()
+{
+	Governor g = make_governor(3, 1000, 2, 1);
+
+	CHECK(govern(g, 0, 0, 1) == governor_launch);
+	CHECK(govern(g, 0, 0, 2) == governor_capped);
+	CHECK(govern(g, 0, 0, 5) == governor_capped);
+
+	// a capped press doesn't spend a token
+	CHECK(govern(g, 0, 0, 0) == governor_launch);
+	CHECK(govern(g, 0, 0, 0) == governor_launch);
+	CHECK(govern(g, 0, 0, 0) == governor_rate_limited);
+
+	CHECK(g.launched == 3 && g.rate_limited == 1 && g.capped == 2);
+}
+
+void test_unlimited()
+{
+	// a burst of 0 turns the rate limit off, and ids past the table (a
+	// press racing a reload) aren't limited either
+	Governor g = make_governor(0, 1000, 8, 1);
+
+	for (int i = 0; i < 100; i++)
+		CHECK(govern(g, 0, 0, 0) == governor_launch);
+
+	Governor h = make_governor(1, 1000, 8, 1);
+
+	for (int i = 0; i < 100; i++)
+		CHECK(govern(h, 5, 0, 0) == governor_launch);
+
+	CHECK(govern(h, 5, 0, 8) == governor_capped);
+}
+
+int main()
+{
+	test_burst();
+	test_steady_rate();
+	test_bindings_independent();
+	test_pending_cap();
+	test_unlimited();
+
+	return check_result();
+}
@@ -0,0 +1,166 @@
+#define UNICODE
+#define NOMINMAX
+
+#include <windows.h>
+#include <stdio.h>
+#include <vector>
+
+#include "icons.h"
+#include "check.h"
+
+// Icons drawn by hand from the glyph tables, '#' for fore and '.' for back.
+// They pin the layout (digit positions, baseline, meter columns, the
+// rounding at fractional scales) independently of ReferencePixel.
+
+static const char *golden_42[] = {
+	"................",
+	"................",
+	"................",
+	"....#..#.####...",
+	"....#..#....#...",
+	"....#..#....#...",
+	"....#..#....#...",
+	"....####.####...",
+	".......#.#......",
+	".......#.#......",
+	".......#.#......",
+	".......#.####...",
+	"................",
+	"................",
+	"................",
+	"................"
+};
+
+// mute with a full meter
+static const char *golden_mute[] = {
+	"................",
+	"................",
+	"................",
+	".....#........##",
+	"....##........##",
+	".####.#..#...###",
+	".#....#...#.#.##",
+	".#....#....#..##",
+	".#....#...#.#.##",
+	".####.#..#...###",
+	"....##........##",
+	".....#........##",
+	"................",
+	"................",
+	"................",
+	"................"
+};
+
+// 125%, where some grid rows and columns take two pixels
+static const char *golden_7_at_20[] = {
+	"....................",
+	"....................",
+	"....................",
+	"....................",
+	"...........#####....",
+	"...............#....",
+	"...............#....",
+	"...............#....",
+	"...............#....",
+	"...............#....",
+	"...............#....",
+	"...............#.###",
+	"...............#.###",
+	"...............#.###",
+	"...............#.###",
+	"....................",
+	"....................",
+	"....................",
+	"....................",
+	"...................."
+};
+
+bool matches(const DWORD *buffer, int size, const char **golden)
+{
+	for (int y = 0; y < size; y++)
+	{
+		for (int x = 0; x < size; x++)
+		{
+			if (buffer[y * size + x] != (golden[y][x] == '#' ? fore : back))
+			{
+				fprintf(stderr, "differs at %d,%d\n", x, y);
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+void test_golden(int path)
+{
+	std::vector<DWORD> buffer(20 * 20);
+
+	raster_path = path;
+
+	RenderIcon(buffer.data(), 16, 42);
+	CHECK(matches(buffer.data(), 16, golden_42));
+
+	RenderIcon(buffer.data(), 16, 101, METER_STEPS);
+	CHECK(matches(buffer.data(), 16, golden_mute));
+
+	RenderIcon(buffer.data(), 20, 7, 3);
+	CHECK(matches(buffer.data(), 20, golden_7_at_20));
+}
+
+// Every span length from every starting offset, against the scalar loop,
+// with a guard pixel either side to catch the vector stores running over.
+void test_spans(int path)
+{
+	const DWORD guard = 0x12345678;
+	BYTE mask[ICON_MAX_SIZE / 8];
+
+	for (int j = 0; j < (int)sizeof(mask); j++)
+		mask[j] = (BYTE)(j * 0x9D + 0x35);
+
+	for (int offset = 0; offset < 8; offset++)
+	{
+		for (int n = 0; n <= 70; n++)
+		{
+			std::vector<DWORD> expected(n), actual(offset + n + 2, guard);
+
+			ExpandSpanScalar(expected.data(), mask, 0, n);
+
+			raster_path = path;
+			ExpandSpan(&actual[offset + 1], mask, n);
+
+			bool same = actual[offset] == guard && actual[offset + n + 1] == guard;
+
+			for (int x = 0; x < n; x++)
+				same = same && actual[offset + 1 + x] == expected[x];
+
+			if (!CHECK(same))
+				fprintf(stderr, "path %d, offset %d, %d pixels\n", path, offset, n);
+		}
+	}
+}
+
+int main()
+{
+	const int paths = DetectRasterPath() + 1;
+
+	for (int path = 0; path < paths; path++)
+	{
+		for (int t = 0; t < 4; t++)
+		{
+			fore = icon_themes[t][0];
+			back = icon_themes[t][1];
+			test_golden(path);
+		}
+
+		test_spans(path);
+	}
+
+	fore = icon_themes[0][0];
+	back = icon_themes[0][1];
+
+	// the full comparison against ReferencePixel and the golden hashes
+	CHECK(RunVerify() == 0);
+
+	return check_result();
+}
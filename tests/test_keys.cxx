@@ -0,0 +1,122 @@
+#define UNICODE
+#define NOMINMAX
+
+#include <windows.h>
+#include <string>
+#include <vector>
+
+#include "keys.h"
+#include "check.h"
+
+int map_name(const std::wstring &name)
+{
+	return map_key(name.c_str(), (int)name.size());
+}
+
+// the table lookup against the linear scan it replaced, for every name in
+// upper and lower case and with a character added or missing
+void test_map_key()
+{
+	for (int i = 0; i < key_count; i++)
+	{
+		std::wstring name = key_map[i].name + 3;
+		std::wstring lower = name;
+
+		for (size_t j = 0; j < lower.size(); j++)
+			lower[j] = towlower(lower[j]);
+
+		CHECK(map_name(name) == key_map[i].code);
+		CHECK(map_name(lower) == key_map[i].code);
+
+		std::wstring variants[] = { name + L"X", name.substr(0, name.size() - 1), L"VK_" + name };
+
+		for (int j = 0; j < 3; j++)
+			CHECK(map_name(variants[j]) == map_key_linear(variants[j].c_str(), (int)variants[j].size()));
+	}
+
+	CHECK(map_name(L"a") == 'A');
+	CHECK(map_name(L"Z") == 'Z');
+	CHECK(map_name(L"7") == '7');
+	CHECK(map_name(L"!") == 0);
+	CHECK(map_name(L"") == 0);
+	CHECK(map_name(L"f25") == 0);
+}
+
+void test_key_name()
+{
+	for (UINT vk = 0; vk < 256; vk++)
+	{
+		const wchar_t *name = 0;
+		int length = key_name(vk, &name);
+
+		if (length != 0)
+			CHECK(map_key(name, length) == (int)vk);
+		else
+			CHECK(name == 0);
+	}
+
+	const wchar_t *name = 0;
+	CHECK(key_name(0x7C, &name) == 3 && wcsncmp(name, L"F13", 3) == 0);
+	CHECK(key_name(0x07, &name) == 0);
+}
+
+bool chord(const wchar_t *text, UINT *modifiers, UINT *vk)
+{
+	// not terminated, the way manifest lines sit in the arena
+	std::vector<wchar_t> line(text, text + wcslen(text));
+	return parse_chord(line.data(), line.data() + line.size(), modifiers, vk);
+}
+
+void test_parse_chord()
+{
+	UINT modifiers = 0, vk = 0;
+
+	CHECK(chord(L"ctrl+a", &modifiers, &vk) && modifiers == MOD_CONTROL && vk == 'A');
+	CHECK(chord(L"Win+Alt+Ctrl+Shift+F24", &modifiers, &vk) && modifiers == (MOD_WIN | MOD_ALT | MOD_CONTROL | MOD_SHIFT) && vk == 0x87);
+	CHECK(chord(L"x", &modifiers, &vk) && modifiers == 0 && vk == 'X');
+	CHECK(chord(L"a=b", &modifiers, &vk) == false);
+	CHECK(chord(L"ctrl+", &modifiers, &vk) == false);
+	CHECK(chord(L"ctrl+ctrl+a", &modifiers, &vk) == false);
+	CHECK(chord(L"hyper+a", &modifiers, &vk) == false);
+	CHECK(chord(L"+", &modifiers, &vk) == false);
+	CHECK(chord(L"", &modifiers, &vk) == false);
+}
+
+void test_parse_filename()
+{
+	UINT modifiers = 0, vk = 0;
+
+	CHECK(parse_filename(L"ctrl+alt+t Terminal.lnk", &modifiers, &vk) && modifiers == (MOD_CONTROL | MOD_ALT) && vk == 'T');
+	CHECK(parse_filename(L"shift+f13.LNK", &modifiers, &vk) && modifiers == MOD_SHIFT && vk == 0x7C);
+	CHECK(parse_filename(L"win+space Launcher (2).lnk", &modifiers, &vk) && modifiers == MOD_WIN && vk == 0x20);
+	CHECK(parse_filename(L"ctrl+alt+t Terminal.txt", &modifiers, &vk) == false);
+	CHECK(parse_filename(L".lnk", &modifiers, &vk) == false);
+	CHECK(parse_filename(L"Terminal.lnk", &modifiers, &vk) == false);
+	CHECK(parse_filename(L" ctrl+a.lnk", &modifiers, &vk) == false);
+}
+
+void test_parse_sequence()
+{
+	unsigned short steps[4] = {};
+
+	CHECK(parse_sequence(L"ctrl+k ctrl+c Comment.lnk", steps, 4) == 2);
+	CHECK(steps[0] == ((MOD_CONTROL << 8) | 'K') && steps[1] == ((MOD_CONTROL << 8) | 'C'));
+
+	// later steps need a modifier, so this is one chord and a title
+	CHECK(parse_sequence(L"ctrl+a x.lnk", steps, 4) == 1);
+
+	CHECK(parse_sequence(L"alt+1 alt+2 alt+3 alt+4 alt+5.lnk", steps, 4) == 4);
+	CHECK(parse_sequence(L"ctrl+k ctrl+c.txt", steps, 4) == 0);
+	CHECK(parse_sequence(L"nothing.lnk", steps, 4) == 0);
+}
+
+int main()
+{
+	test_map_key();
+	test_key_name();
+	test_parse_chord();
+	test_parse_filename();
+	test_parse_sequence();
+
+	return check_result();
+}
@@ -0,0 +1,179 @@
+#define UNICODE
+#define NOMINMAX
+
+#include <windows.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "manifest.h"
+#include "check.h"
+
+struct Parsed
+{
+	std::vector<HotKey> found;
+	std::vector<wchar_t> arena;
+	std::vector<ManifestError> errors;
+
+	std::wstring target(size_t i) const { return &arena[found[i].name]; }
+	std::wstring arguments(size_t i) const { return &arena[found[i].arguments]; }
+};
+
+// parses a copy of the bytes, allocated at exactly their size
+Parsed parse(const std::string &text)
+{
+	Parsed p;
+	std::vector<unsigned char> data(text.begin(), text.end());
+
+	p.arena.assign(1, 0);
+	parse_manifest(data.data(), data.size(), p.found, p.arena, p.errors);
+	return p;
+}
+
+std::string utf16(const std::u16string &text)
+{
+	std::string out("\xFF\xFE");
+
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		out += (char)(text[i] & 0xFF);
+		out += (char)(text[i] >> 8);
+	}
+
+	return out;
+}
+
+bool has_error(const Parsed &p, int line, int column, const wchar_t *message)
+{
+	for (size_t i = 0; i < p.errors.size(); i++)
+	{
+		if (p.errors[i].line == line && p.errors[i].column == column && wcscmp(p.errors[i].message, message) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+void test_minimal()
+{
+	Parsed p = parse("a=b");
+
+	CHECK(p.errors.empty() && p.found.size() == 1);
+	CHECK(p.found[0].modifiers == 0 && p.found[0].vk == 'A' && p.found[0].manifest);
+	CHECK(p.target(0) == L"b" && p.found[0].arguments == 0);
+	CHECK(!p.found[0].resolved && !p.found[0].expand);
+}
+
+void test_lines()
+{
+	Parsed p = parse(
+		"# launchers\n"
+		"ctrl+alt+t = \"C:\\Program Files\\Terminal\\term.exe\" --new-tab\r\n"
+		"\twin+e=explorer.exe\n"
+		"\n"
+		"; old\n"
+		"shift+f13 = %SystemRoot%\\notepad.exe  notes.txt  \n");
+
+	CHECK(p.errors.empty() && p.found.size() == 3);
+
+	CHECK(p.found[0].modifiers == (MOD_CONTROL | MOD_ALT) && p.found[0].vk == 'T');
+	CHECK(p.target(0) == L"C:\\Program Files\\Terminal\\term.exe" && p.arguments(0) == L"--new-tab");
+	CHECK(p.found[0].resolved && !p.found[0].expand && p.found[0].show == SW_SHOWNORMAL);
+
+	CHECK(p.found[1].modifiers == MOD_WIN && p.found[1].vk == 'E');
+	CHECK(p.target(1) == L"explorer.exe" && p.found[1].arguments == 0);
+
+	CHECK(p.found[2].modifiers == MOD_SHIFT && p.found[2].vk == 0x7C);
+	CHECK(p.target(2) == L"%SystemRoot%\\notepad.exe" && p.arguments(2) == L"notes.txt");
+	CHECK(p.found[2].expand && p.found[2].resolved);
+
+	// the lines are rewritten in place, the arena holds no more than the file
+	CHECK(p.arena.size() <= 1 + 127);
+}
+
+void test_errors()
+{
+	Parsed p = parse(
+		"ctrl+a\n"
+		"ctrl+ctrl+a = x.exe\n"
+		"  hyper+a = x.exe\n"
+		"ctrl+b = \"C:\\unterminated\n"
+		"ctrl+c =   \n"
+		"ctrl+d = x.exe\n");
+
+	CHECK(p.found.size() == 1 && p.found[0].vk == 'D');
+	CHECK(p.errors.size() == 5);
+	CHECK(has_error(p, 1, 7, L"expected '='"));
+	CHECK(has_error(p, 2, 1, L"invalid chord"));
+	CHECK(has_error(p, 3, 3, L"invalid chord"));
+	CHECK(has_error(p, 4, 10, L"unterminated quote"));
+	CHECK(has_error(p, 5, 12, L"missing target"));
+}
+
+void test_encodings()
+{
+	// UTF-8 with a byte order mark, a two and a four byte sequence
+	Parsed p = parse("\xEF\xBB\xBF" "alt+1 = C:\\caf\xC3\xA9.exe \xF0\x9F\x8E\xB5");
+
+	CHECK(p.errors.empty() && p.found.size() == 1);
+	CHECK(p.target(0) == L"C:\\caf\x00E9.exe" && p.arguments(0) == L"\xD83C\xDFB5");
+
+	// UTF-16 with a surrogate pair, kept as two code units
+	p = parse(utf16(u"ctrl+k = x.exe \U0001F3B5\r\nalt+2=y.exe"));
+
+	CHECK(p.errors.empty() && p.found.size() == 2);
+	CHECK(p.arguments(0) == L"\xD83C\xDFB5" && p.target(1) == L"y.exe");
+
+	const char *bad[] = {
+		"a = \xC0\xAF.exe",         // overlong
+		"a = \xED\xA0\x80.exe",     // UTF-16 surrogate in UTF-8
+		"a = \xF4\x90\x80\x80.exe", // past U+10FFFF
+		"a = \x80.exe",             // continuation without a lead
+		"a = x.exe \xE2\x82",       // cut short at the end of the file
+	};
+
+	for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+	{
+		p = parse(bad[i]);
+
+		if (!CHECK(p.found.empty() && p.errors.size() == 1 && wcscmp(p.errors[0].message, L"invalid text encoding") == 0))
+			fprintf(stderr, "input %zu\n", i);
+	}
+
+	// a null would end the target early in the arena
+	p = parse(std::string("a = x\0y.exe\nb = z.exe", 21));
+	CHECK(p.found.size() == 1 && p.found[0].vk == 'B' && has_error(p, 1, 6, L"invalid text encoding"));
+
+	// a lone surrogate, then an odd byte at the end
+	p = parse(utf16(u"a = x.exe\nb = \xD800y.exe") + "z");
+	CHECK(p.found.size() == 1 && p.errors.size() == 1 && p.errors[0].line == 2);
+}
+
+void test_prefixes()
+{
+	// every prefix parses without reading past its end, and lines before the
+	// cut come out the same
+	const std::string text =
+		"ctrl+alt+t = \"C:\\Program Files\\Terminal\\term.exe\" --new-tab\r\n"
+		"alt+1 = C:\\caf\xC3\xA9.exe \xF0\x9F\x8E\xB5\n";
+
+	for (size_t size = 0; size <= text.size(); size++)
+	{
+		Parsed p = parse(text.substr(0, size));
+
+		if (size > text.find('\n'))
+			CHECK(p.found.size() >= 1 && p.arguments(0) == L"--new-tab");
+	}
+}
+
+int main()
+{
+	test_minimal();
+	test_lines();
+	test_errors();
+	test_encodings();
+	test_prefixes();
+
+	return check_result();
+}
@@ -0,0 +1,235 @@
+#define UNICODE
+#define NOMINMAX
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "platform_posix.h"
+#include "check.h"
+
+// a fresh directory under TMPDIR, removed again by remove_tree
+std::string make_temp()
+{
+	const char *base = getenv("TMPDIR");
+	std::string path = std::string(base != 0 && *base != 0 ? base : "/tmp") + "/hotkeys-test-XXXXXX";
+
+	return mkdtemp(&path[0]) != 0 ? path : std::string();
+}
+
+void remove_tree(const std::string &path)
+{
+	DIR *dir = opendir(path.c_str());
+
+	while (dirent *entry = dir != 0 ? readdir(dir) : 0)
+	{
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+
+		std::string child = path + "/" + entry->d_name;
+		struct stat st;
+
+		if (lstat(child.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+			remove_tree(child);
+		else
+			unlink(child.c_str());
+	}
+
+	if (dir != 0)
+		closedir(dir);
+
+	rmdir(path.c_str());
+}
+
+bool write_text(const std::string &path, const char *text)
+{
+	std::vector<unsigned char> data(text, text + strlen(text));
+	return posix_write_file(compat_widen(path.c_str()).c_str(), data);
+}
+
+struct Found
+{
+	std::vector<std::wstring> files;
+	std::vector<std::wstring> directories;
+};
+
+void found(const wchar_t *name, bool directory, unsigned long long mtime, void *context)
+{
+	Found *f = (Found*)context;
+	(directory ? f->directories : f->files).push_back(name);
+}
+
+void test_files(const std::string &temp)
+{
+	std::wstring root = compat_widen(temp.c_str());
+
+	CHECK(mkdir((temp + "/sub").c_str(), 0755) == 0);
+	CHECK(write_text(temp + "/ctrl+a caf\xC3\xA9.lnk", "abc"));
+	CHECK(symlink((temp + "/ctrl+a caf\xC3\xA9.lnk").c_str(), (temp + "/link.lnk").c_str()) == 0);
+	CHECK(symlink(temp.c_str(), (temp + "/loop").c_str()) == 0);
+
+	// the write leaves no temporary file behind
+	Found f;
+	posix_find_files(root.c_str(), found, &f);
+	std::sort(f.files.begin(), f.files.end());
+
+	CHECK(f.files.size() == 2 && f.files[0] == L"ctrl+a caf\x00E9.lnk" && f.files[1] == L"link.lnk");
+	CHECK(f.directories.size() == 1 && f.directories[0] == L"sub");
+
+	// backslashes are separators, as in the paths the bindings carry
+	std::vector<unsigned char> data;
+	CHECK(posix_read_file((root + L"\\link.lnk").c_str(), data) && data.size() == 3 && data[2] == 'c');
+	CHECK(!posix_read_file((root + L"/missing").c_str(), data));
+	CHECK(!posix_read_file((root + L"/sub").c_str(), data));
+
+	size_t size = 0;
+	const unsigned char *view = posix_map_file((root + L"/link.lnk").c_str(), &size);
+	CHECK(view != 0 && size == 3 && view[0] == 'a');
+	posix_unmap_file(view);
+	CHECK(posix_map_file((root + L"/missing").c_str(), &size) == 0);
+
+	unsigned long long before = 0, after = 0;
+	CHECK(posix_directory_stamp(root.c_str(), &before) && before != 0);
+	usleep(10000);
+	CHECK(write_text(temp + "/new.lnk", "x"));
+	CHECK(posix_directory_stamp(root.c_str(), &after) && after > before);
+	CHECK(!posix_directory_stamp((root + L"/missing").c_str(), &after));
+}
+
+void test_read_ahead(const std::string &temp)
+{
+	std::wstring root = compat_widen(temp.c_str());
+	std::vector<unsigned char> data(300 * 1024, 'x');
+
+	CHECK(posix_write_file((root + L"/big.exe").c_str(), data));
+	CHECK(write_text(temp + "/empty.exe", ""));
+
+	// the size asked for, capped by the limit
+	CHECK(posix_read_ahead((root + L"/big.exe").c_str(), 1ull << 40) == data.size());
+	CHECK(posix_read_ahead((root + L"/big.exe").c_str(), 4096) == 4096);
+	CHECK(posix_read_ahead((root + L"/big.exe").c_str(), 0) == 0);
+
+	CHECK(posix_read_ahead((root + L"/empty.exe").c_str(), 4096) == 0);
+	CHECK(posix_read_ahead((root + L"/sub").c_str(), 4096) == 0);
+	CHECK(posix_read_ahead((root + L"/missing.exe").c_str(), 4096) == 0);
+}
+
+bool signaled(HANDLE watch)
+{
+	return WaitForSingleObject(watch, 2000) == WAIT_OBJECT_0;
+}
+
+void test_watch(const std::string &temp)
+{
+	HANDLE watch = posix_open_watch(compat_widen(temp.c_str()).c_str());
+
+	if (!CHECK(watch != 0))
+		return;
+
+	CHECK(WaitForSingleObject(watch, 0) == WAIT_TIMEOUT);
+
+	// a directory made after the watch opened is watched once the event for
+	// it is drained
+	CHECK(mkdir((temp + "/later").c_str(), 0755) == 0);
+	CHECK(signaled(watch));
+	posix_next_watch(watch);
+	CHECK(WaitForSingleObject(watch, 0) == WAIT_TIMEOUT);
+
+	CHECK(write_text(temp + "/later/ctrl+b x.lnk", "x"));
+	CHECK(signaled(watch));
+	posix_next_watch(watch);
+
+	CHECK(rename((temp + "/later/ctrl+b x.lnk").c_str(), (temp + "/later/ctrl+c x.lnk").c_str()) == 0);
+	CHECK(signaled(watch));
+	posix_next_watch(watch);
+
+	// and so is a tree moved in from outside
+	std::string outside = make_temp();
+	CHECK(mkdir((outside + "/inner").c_str(), 0755) == 0);
+	CHECK(rename(outside.c_str(), (temp + "/moved").c_str()) == 0);
+	CHECK(signaled(watch));
+	posix_next_watch(watch);
+
+	CHECK(write_text(temp + "/moved/inner/ctrl+d x.lnk", "x"));
+	CHECK(signaled(watch));
+	posix_next_watch(watch);
+
+	// a removed directory takes its watch with it
+	CHECK(unlink((temp + "/moved/inner/ctrl+d x.lnk").c_str()) == 0);
+	CHECK(rmdir((temp + "/moved/inner").c_str()) == 0);
+	CHECK(signaled(watch));
+	posix_next_watch(watch);
+	CHECK(WaitForSingleObject(watch, 100) == WAIT_TIMEOUT);
+
+	posix_close_watch(watch);
+
+	CHECK(posix_open_watch(L"/nonexistent/hotkeys") == 0);
+}
+
+void test_expand()
+{
+	setenv("HOTKEYS_TEST", "/opt/x", 1);
+	unsetenv("HOTKEYS_UNSET");
+
+	CHECK(posix_expand(L"%HOTKEYS_TEST%/bin") == L"/opt/x/bin");
+	CHECK(posix_expand(L"a%HOTKEYS_TEST%b%HOTKEYS_TEST%") == L"a/opt/xb/opt/x");
+	CHECK(posix_expand(L"%HOTKEYS_UNSET%/%HOTKEYS_TEST%") == L"%HOTKEYS_UNSET%//opt/x");
+	CHECK(posix_expand(L"100%") == L"100%" && posix_expand(L"%%") == L"%%" && posix_expand(L"") == L"");
+}
+
+void test_split()
+{
+	std::vector<std::string> args = posix_split_arguments(L"  -a \"b c\"\td\\\"e \"\" f\"g\"h ");
+
+	CHECK(args.size() == 5);
+	CHECK(args.size() == 5 && args[0] == "-a" && args[1] == "b c" && args[2] == "d\"e" && args[3].empty() && args[4] == "fgh");
+	CHECK(posix_split_arguments(L"").empty() && posix_split_arguments(L" \t ").empty());
+	CHECK(posix_split_arguments(L"caf\x00E9")[0] == "caf\xC3\xA9");
+}
+
+void test_launch(const std::string &temp)
+{
+	Shortcut link;
+	link.target = L"/bin/sh";
+	link.arguments = L"-c \"echo ok > out.txt\"";
+	link.directory = compat_widen(temp.c_str());
+	link.show = SW_SHOWNORMAL;
+	link.expand = false;
+
+	CHECK(posix_create_process(link));
+	CHECK(posix_launch(L"true", 0));
+
+	link.target = L"/nonexistent/program";
+	CHECK(!posix_create_process(link));
+
+	// the child writes in its working directory
+	std::vector<unsigned char> data;
+
+	for (int i = 0; i < 200 && !(posix_read_file(compat_widen((temp + "/out.txt").c_str()).c_str(), data) && data.size() == 3); i++)
+		usleep(10000);
+
+	CHECK(data.size() == 3 && data[0] == 'o');
+}
+
+int main()
+{
+	signal(SIGCHLD, SIG_IGN);
+
+	std::string temp = make_temp();
+
+	if (!CHECK(!temp.empty()))
+		return check_result();
+
+	test_files(temp);
+	test_read_ahead(temp);
+	test_watch(temp);
+	test_expand();
+	test_split();
+	test_launch(temp);
+
+	remove_tree(temp);
+	return check_result();
+}
@@ -0,0 +1,151 @@
+#define UNICODE
+#define NOMINMAX
+
+#include <windows.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "shortcut.h"
+#include "check.h"
+
+// Runs parse_shortcut over the links in tests/fixtures (the directory is the
+// first argument). Each file is read into a buffer of exactly its size, so
+// the sanitizers catch any read past the end, and every valid link is also
+// parsed at every shorter length.
+
+struct Fixture
+{
+	const char *name;
+	bool ok;
+	const wchar_t *target;
+	const wchar_t *arguments;
+	const wchar_t *directory;
+	unsigned show;
+	bool expand;
+	size_t strings_end; // a valid link cut short of this is rejected
+};
+
+static const Fixture fixtures[] = {
+	// Unicode LinkInfo, name, working directory and arguments, maximized
+	{ "unicode.lnk", true, L"C:\\Windows\\notepad.exe", L"/A notes.txt", L"C:\\Users\\me", SW_SHOWMAXIMIZED, false, 244 },
+	// ANSI LinkInfo behind an item ID list, minimized
+	{ "ansi.lnk", true, L"C:\\Tools\\run.exe", L"--quiet", L"", SW_SHOWMINNOACTIVE, false, 169 },
+	// an EnvironmentVariableDataBlock after an unrelated block
+	{ "expand.lnk", true, L"%SystemRoot%\\System32\\cmd.exe", L"", L"%USERPROFILE%", SW_SHOWNORMAL, true, 216 },
+
+	{ "header_only.lnk", false },
+	{ "bad_clsid.lnk", false },
+	{ "run_as_user.lnk", false },
+	// the ID list size runs past the end of the file
+	{ "id_list_past_end.lnk", false },
+	// LinkInfoSize smaller than its own header
+	{ "info_size_too_small.lnk", false },
+	// a 0x24 byte header in a 0x1C byte LinkInfo, the Unicode offsets would be read past it
+	{ "unicode_offsets_past_info.lnk", false },
+	// LocalBasePathOffset past LinkInfoSize
+	{ "base_past_info.lnk", false },
+	// CommonPathSuffix runs to the end of LinkInfo without a terminator
+	{ "unterminated_base.lnk", false },
+	// an ANSI path outside ASCII, which would need the system code page
+	{ "ansi_high_byte.lnk", false },
+	// a network path only, no VolumeIDAndLocalBasePath
+	{ "network_only.lnk", false },
+	// CommandLineArguments claims more characters than the file has
+	{ "string_past_end.lnk", false }
+};
+
+bool read_fixture(const std::string &path, std::vector<unsigned char> &data)
+{
+	FILE *file = fopen(path.c_str(), "rb");
+
+	if (file == 0)
+		return false;
+
+	unsigned char buffer[4096];
+	size_t count;
+
+	while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		data.insert(data.end(), buffer, buffer + count);
+
+	fclose(file);
+	return true;
+}
+
+// parses a copy of the first size bytes, allocated at exactly that size
+bool parse_prefix(const std::vector<unsigned char> &data, size_t size, Shortcut *link)
+{
+	std::vector<unsigned char> copy(data.begin(), data.begin() + size);
+	*link = Shortcut();
+	return parse_shortcut(copy.data(), copy.size(), link);
+}
+
+void test_fixture(const std::string &directory, const Fixture &f)
+{
+	std::vector<unsigned char> data;
+
+	if (!CHECK(read_fixture(directory + "/" + f.name, data)))
+	{
+		fprintf(stderr, "can't read %s\n", f.name);
+		return;
+	}
+
+	Shortcut link;
+
+	if (!CHECK(parse_prefix(data, data.size(), &link) == f.ok))
+		fprintf(stderr, "%s\n", f.name);
+
+	if (!f.ok)
+		return;
+
+	if (!CHECK(link.target == f.target && link.arguments == f.arguments && link.directory == f.directory &&
+		link.show == f.show && link.expand == f.expand))
+		fprintf(stderr, "%s: \"%ls\" \"%ls\" \"%ls\" %u %d\n", f.name, link.target.c_str(), link.arguments.c_str(),
+			link.directory.c_str(), link.show, (int)link.expand);
+
+	for (size_t size = 0; size < data.size(); size++)
+	{
+		bool ok = parse_prefix(data, size, &link);
+
+		// past the strings only trailing blocks are cut, the link still resolves
+		if (!CHECK(ok == (size >= f.strings_end)))
+			fprintf(stderr, "%s cut to %zu bytes\n", f.name, size);
+
+		if (ok)
+			CHECK(link.arguments == f.arguments && link.directory == f.directory);
+	}
+}
+
+void test_corrupt(const std::string &directory)
+{
+	// a bit flip anywhere in a valid link must not read out of bounds
+	std::vector<unsigned char> data;
+
+	if (!CHECK(read_fixture(directory + "/unicode.lnk", data)))
+		return;
+
+	for (size_t i = 0; i < data.size() * 8; i++)
+	{
+		std::vector<unsigned char> copy = data;
+		copy[i / 8] ^= (unsigned char)(1 << (i % 8));
+
+		Shortcut link;
+		parse_shortcut(copy.data(), copy.size(), &link);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: test_shortcut <fixtures>\n");
+		return 2;
+	}
+
+	for (size_t i = 0; i < sizeof(fixtures) / sizeof(fixtures[0]); i++)
+		test_fixture(argv[1], fixtures[i]);
+
+	test_corrupt(argv[1]);
+
+	return check_result();
+}
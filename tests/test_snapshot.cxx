@@ -0,0 +1,178 @@
+#define UNICODE
+#define NOMINMAX
+
+#include <windows.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "snapshot_sample.h"
+#include "check.h"
+
+// reads a copy of data's first size bytes, allocated at exactly that size
+bool read_copy(const std::vector<unsigned char> &data, size_t size, unsigned mode, const std::vector<std::wstring> &sources,
+	std::vector<HotKey> &table, std::vector<wchar_t> &arena, std::vector<DirStamp> &stamps)
+{
+	std::vector<unsigned char> copy(data.begin(), data.begin() + size);
+	return read_snapshot(copy.data(), copy.size(), mode, sources, 1, table, arena, stamps);
+}
+
+void test_round_trip()
+{
+	std::vector<HotKey> table, read_table;
+	std::vector<wchar_t> arena, read_arena;
+	std::vector<DirStamp> stamps, read_stamps;
+	std::vector<unsigned char> data;
+
+	make_sample(table, arena, stamps);
+	write_snapshot(table, arena, snapshot_mode_hook, sample_sources(), stamps, data);
+
+	CHECK(data.size() == snapshot_header_size + 2 * snapshot_source_size + 2 * snapshot_stamp_size + 3 * snapshot_entry_size +
+		(arena.size() + wcslen(sample_root) + wcslen(sample_manifest) + stamps[0].path.size() + stamps[1].path.size()) * 2);
+
+	CHECK(read_copy(data, data.size(), snapshot_mode_hook, sample_sources(), read_table, read_arena, read_stamps));
+	CHECK(same_table(table, read_table));
+	CHECK(same_stamps(stamps, read_stamps));
+
+	// the names arena comes back first, so every offset still points at its string
+	CHECK(read_arena.size() >= arena.size() && std::equal(arena.begin(), arena.end(), read_arena.begin()));
+
+	// writing what was read, less the source and stamp strings after the
+	// names, gives the same bytes
+	std::vector<unsigned char> again;
+	read_arena.resize(arena.size());
+	write_snapshot(read_table, read_arena, snapshot_mode_hook, sample_sources(), read_stamps, again);
+	CHECK(again == data);
+}
+
+void test_mismatch()
+{
+	std::vector<HotKey> table;
+	std::vector<wchar_t> arena;
+	std::vector<DirStamp> stamps;
+	std::vector<unsigned char> data;
+
+	make_sample(table, arena, stamps);
+	write_snapshot(table, arena, snapshot_mode_registered, sample_sources(), stamps, data);
+
+	std::vector<std::wstring> sources = sample_sources();
+
+	CHECK(read_copy(data, data.size(), snapshot_mode_registered, sources, table, arena, stamps));
+	CHECK(!read_copy(data, data.size(), snapshot_mode_hook, sources, table, arena, stamps));
+
+	sources[1] = L"C:\\Users\\me\\other.txt";
+	CHECK(!read_copy(data, data.size(), snapshot_mode_registered, sources, table, arena, stamps));
+
+	sources.pop_back();
+	CHECK(!read_copy(data, data.size(), snapshot_mode_registered, sources, table, arena, stamps));
+
+	// an older version is rebuilt from a scan rather than read
+	std::vector<unsigned char> old = data;
+	old[4] = (unsigned char)(snapshot_version - 1);
+	CHECK(!read_copy(old, old.size(), snapshot_mode_registered, sample_sources(), table, arena, stamps));
+}
+
+// patches one u32 of the first entry and checks the snapshot is rejected
+bool rejects_entry(unsigned field, unsigned value)
+{
+	std::vector<HotKey> table;
+	std::vector<wchar_t> arena;
+	std::vector<DirStamp> stamps;
+	std::vector<unsigned char> data;
+
+	make_sample(table, arena, stamps);
+	write_snapshot(table, arena, snapshot_mode_registered, sample_sources(), stamps, data);
+
+	size_t at = snapshot_header_size + 2 * snapshot_source_size + 2 * snapshot_stamp_size + field;
+
+	for (int i = 0; i < 4; i++)
+		data[at + i] = (unsigned char)(value >> (i * 8));
+
+	return !read_copy(data, data.size(), snapshot_mode_registered, sample_sources(), table, arena, stamps);
+}
+
+void test_bad_entries()
+{
+	CHECK(rejects_entry(0, 0));                   // id 0
+	CHECK(rejects_entry(0, snapshot_max_id + 1)); // id past the limit
+	CHECK(rejects_entry(0, 2));                   // id bound twice
+	CHECK(rejects_entry(4, 0x10));                // modifiers
+	CHECK(rejects_entry(8, 0));                   // no key
+	CHECK(rejects_entry(8, 0x100));               // key past the table
+	CHECK(rejects_entry(20, 1));                  // root past root_count for a link
+	CHECK(rejects_entry(20, 0xFFFFFFFF));         // negative root
+	CHECK(rejects_entry(32, 0));                  // empty name
+	CHECK(rejects_entry(32, 0x7FFFFFFF));         // name past the blob
+	CHECK(rejects_entry(36, 0xFFFFFFFF));         // name length past the blob
+	CHECK(rejects_entry(36, 3));                  // name not terminated at its length
+	CHECK(rejects_entry(44, 0xFFFFFFF0));         // target length wrapping the blob
+}
+
+void test_truncated()
+{
+	std::vector<HotKey> table;
+	std::vector<wchar_t> arena;
+	std::vector<DirStamp> stamps;
+	std::vector<unsigned char> data;
+
+	make_sample(table, arena, stamps);
+	write_snapshot(table, arena, snapshot_mode_registered, sample_sources(), stamps, data);
+
+	for (size_t size = 0; size < data.size(); size++)
+	{
+		if (!CHECK(!read_copy(data, size, snapshot_mode_registered, sample_sources(), table, arena, stamps)))
+			fprintf(stderr, "read %zu of %zu bytes\n", size, data.size());
+	}
+
+	// and one byte too many
+	data.push_back(0);
+	CHECK(!read_copy(data, data.size(), snapshot_mode_registered, sample_sources(), table, arena, stamps));
+}
+
+void test_bit_flips()
+{
+	std::vector<HotKey> table;
+	std::vector<wchar_t> arena;
+	std::vector<DirStamp> stamps;
+	std::vector<unsigned char> data;
+
+	make_sample(table, arena, stamps);
+	write_snapshot(table, arena, snapshot_mode_registered, sample_sources(), stamps, data);
+
+	// whatever a flip does, an accepted table has to be usable: every string
+	// of every binding terminated inside the arena
+	for (size_t i = 0; i < data.size() * 8; i++)
+	{
+		std::vector<unsigned char> copy = data;
+		copy[i / 8] ^= (unsigned char)(1 << (i % 8));
+
+		if (!read_copy(copy, copy.size(), snapshot_mode_registered, sample_sources(), table, arena, stamps))
+			continue;
+
+		for (size_t j = 0; j < table.size(); j++)
+		{
+			const HotKey &hk = table[j];
+
+			if (hk.name == 0)
+				continue;
+
+			const unsigned strings[] = { hk.name, hk.target, hk.arguments, hk.directory };
+
+			for (int k = 0; k < 4; k++)
+				CHECK(strings[k] < arena.size() && wmemchr(&arena[strings[k]], 0, arena.size() - strings[k]) != 0);
+
+			CHECK(hk.id == (int)j + 1 && arena[hk.name] != 0);
+		}
+	}
+}
+
+int main()
+{
+	test_round_trip();
+	test_mismatch();
+	test_bad_entries();
+	test_truncated();
+	test_bit_flips();
+
+	return check_result();
+}
@@ -3,96 +3,625 @@
 #define NOMINMAX
 #define WM_VOLUMECHANGE     (WM_USER + 12)
 #define WM_ENDPOINTCHANGE   (WM_USER + 13)
+#define WM_ENDPOINTSTATE    (WM_USER + 14)
+#define WM_TRAYICON         (WM_USER + 15)
+#define WM_WHEELLEAVE       (WM_USER + 16)
+#define WM_METERWAKE        (WM_USER + 17)
+#define WM_METERSESSION     (WM_USER + 18)
+#define WM_METERSESSIONEND  (WM_USER + 19)
+#define WM_WHEELSCROLL      (WM_USER + 20)
+#define WM_WHEELHOOK        (WM_USER + 21)
+#define TIMER_TRIM_ENDPOINTS 1
+#define TIMER_FLUSH_WHEEL   2
+#define TIMER_METER         3
 
 #pragma comment(lib, "Gdi32.lib")
+#pragma comment(lib, "Advapi32.lib")
+#pragma comment(lib, "Wtsapi32.lib")
 
 #include <windows.h>
 #include <shellapi.h>
+#include <wtsapi32.h>
 #include <atlbase.h>
-#include <atlsync.h>
 #include <mmdeviceapi.h>
 #include <endpointvolume.h>
+#include <audiopolicy.h>
 #include <algorithm>
+#include <string>
+#include <vector>
+
+#include "icons.h"
 
 struct VOLUME_INFO
 {
-    UINT nStep;
-    UINT cSteps;
+    float fLevel;
     BOOL bMuted;
 };
 
-class VolumeMonitor : IMMNotificationClient, IAudioEndpointVolumeCallback
+// Level shown in the icon, 0-100 or 101 when muted.
+int LevelFromInfo(float fLevel, BOOL bMuted)
+{
+    if (bMuted)
+        return 101;
+
+    return std::max<int>(0, std::min<int>(100, (int)(fLevel * 100.0f + 0.5f)));
+}
+
+// Event context of the volume writes made here, which tells their
+// notifications apart from changes made elsewhere.
+static const GUID volume_write_context = { 0xf5ef91d9, 0x3a02, 0x4be7, { 0xbf, 0x78, 0x7a, 0xb1, 0xb4, 0xaf, 0xcc, 0x77 } };
+
+// Opt-in phase tracing (--trace <file>). Scopes record into chunks of one
+// buffer allocated when tracing starts; a thread claims a chunk and fills it
+// without locking. Written as Chrome trace JSON (chrome://tracing, Perfetto)
+// at exit, at the end of the session or on Ctrl+C.
+
+#define TRACE_CHUNK_EVENTS  256
+#define TRACE_CHUNK_COUNT   64
+
+struct TRACE_EVENT
+{
+    const char* pszName;
+    LONGLONG llStart;
+    LONGLONG llDuration;
+};
+
+struct TRACE_CHUNK
+{
+    volatile LONG cEvents;
+    DWORD dwThreadId;
+    TRACE_EVENT events[TRACE_CHUNK_EVENTS];
+};
+
+static BOOL trace_enabled = FALSE;
+static const wchar_t *trace_path = NULL;
+static TRACE_CHUNK *trace_chunks = NULL;
+static volatile LONG trace_next = 0;
+static volatile LONG trace_written = 0;
+static LONGLONG trace_origin = 0;
+static __declspec(thread) TRACE_CHUNK *trace_chunk = NULL;
+
+// Set by a host process that owns the trace (host.cxx), scopes then record
+// into its buffer instead of this one.
+static LONGLONG (*trace_host_now)() = NULL;
+static void (*trace_host_record)(const char*, LONGLONG) = NULL;
+
+void StartTrace(const wchar_t *path)
+{
+    trace_chunks = (TRACE_CHUNK*)calloc(TRACE_CHUNK_COUNT, sizeof(TRACE_CHUNK));
+
+    if (trace_chunks != NULL)
+    {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+
+        trace_path = path;
+        trace_origin = now.QuadPart;
+        trace_enabled = TRUE;
+    }
+}
+
+void TraceRecord(const char* pszName, LONGLONG llStart)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    TRACE_CHUNK *chunk = trace_chunk;
+
+    if (chunk == NULL || chunk->cEvents == TRACE_CHUNK_EVENTS)
+    {
+        LONG index = trace_next < TRACE_CHUNK_COUNT ? InterlockedIncrement(&trace_next) - 1 : TRACE_CHUNK_COUNT;
+
+        if (index >= TRACE_CHUNK_COUNT)
+            return;
+
+        chunk = &trace_chunks[index];
+        chunk->dwThreadId = GetCurrentThreadId();
+        trace_chunk = chunk;
+    }
+
+    TRACE_EVENT &event = chunk->events[chunk->cEvents];
+    event.pszName = pszName;
+    event.llStart = llStart;
+    event.llDuration = now.QuadPart - llStart;
+
+    // publishes the event to WriteTrace
+    InterlockedIncrement(&chunk->cEvents);
+}
+
+class TraceScope
 {
 private:
-    HWND                            m_hWnd;
-    BOOL                            m_bRegisteredForEndpointNotifications;
-    BOOL                            m_bRegisteredForVolumeNotifications;
-    CComPtr<IMMDeviceEnumerator>    m_spEnumerator;
-    CComPtr<IMMDevice>              m_spAudioEndpoint;
+    const char* m_pszName;
+    LONGLONG m_llStart;
+
+public:
+    TraceScope(const char* pszName) : m_pszName(pszName), m_llStart(0)
+    {
+        if (trace_enabled)
+        {
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            m_llStart = now.QuadPart;
+        }
+        else if (trace_host_record != NULL)
+        {
+            m_llStart = trace_host_now();
+        }
+    }
+
+    ~TraceScope()
+    {
+        if (trace_enabled)
+            TraceRecord(m_pszName, m_llStart);
+        else if (trace_host_record != NULL)
+            trace_host_record(m_pszName, m_llStart);
+    }
+};
+
+void WriteTrace()
+{
+    if (!trace_enabled || InterlockedExchange(&trace_written, 1) != 0)
+        return;
+
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+
+    std::string json = "{\"traceEvents\":[";
+    const char *separator = "\n";
+    char line[256];
+    LONG cChunks = std::min<LONG>((LONG)trace_next, TRACE_CHUNK_COUNT);
+
+    for (LONG c = 0; c < cChunks; c++)
+    {
+        const TRACE_CHUNK &chunk = trace_chunks[c];
+        LONG cEvents = chunk.cEvents;
+
+        for (LONG i = 0; i < cEvents; i++)
+        {
+            const TRACE_EVENT &event = chunk.events[i];
+
+            sprintf_s(line, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%lu,\"tid\":%lu,\"ts\":%lld,\"dur\":%lld}",
+                separator, event.pszName, (unsigned long)GetCurrentProcessId(), (unsigned long)chunk.dwThreadId,
+                (event.llStart - trace_origin) * 1000000 / freq.QuadPart, event.llDuration * 1000000 / freq.QuadPart);
+
+            json += line;
+            separator = ",\n";
+        }
+    }
+
+    json += "\n]}\n";
+
+    HANDLE hFile = CreateFile(trace_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        DWORD cbWritten = 0;
+        WriteFile(hFile, json.data(), (DWORD)json.size(), &cbWritten, NULL);
+        CloseHandle(hFile);
+    }
+}
+
+BOOL WINAPI TraceConsoleHandler(DWORD dwCtrlType)
+{
+    WriteTrace();
+    return FALSE;
+}
+
+// Every active render endpoint is kept activated, registered for volume
+// notifications and with its level cached, so switching the default device
+// is a lookup. The table is capped and endpoints that haven't been the
+// default for a while are released.
+
+#define ENDPOINT_TABLE_SIZE     8
+#define ENDPOINT_ID_MAX         128
+#define ENDPOINT_IDLE_MS        (30 * 60 * 1000)
+
+class VolumeMonitor;
+
+// An endpoint device together with its volume control. It's fully set up
+// before VolumeMonitor publishes it and never changes afterwards; readers
+// hold a reference for as long as they use it.
+class AudioEndpoint : public IAudioEndpointVolumeCallback
+{
+private:
+    VolumeMonitor*                  m_pMonitor;
+    CComPtr<IMMDevice>              m_spDevice;
     CComPtr<IAudioEndpointVolume>   m_spVolumeControl;
-    CCriticalSection                m_csEndpoint;
+    BOOL                            m_bRegisteredForVolumeNotifications;
+    volatile LONG                   m_nLevel;
+    ULONGLONG                       m_tLastUsed;
+    WCHAR                           m_szId[ENDPOINT_ID_MAX];
     long                            m_cRef;
 
-    ~VolumeMonitor() {}
+    AudioEndpoint(VolumeMonitor *pMonitor) :
+        m_pMonitor(pMonitor),
+        m_bRegisteredForVolumeNotifications(FALSE),
+        m_nLevel(-1),
+        m_tLastUsed(0),
+        m_cRef(1)
+    {
+        m_szId[0] = 0;
+    }
+
+    ~AudioEndpoint() {}
 
-    HRESULT AttachToDefaultEndpoint()
+public:
+    static HRESULT Create(IMMDeviceEnumerator *pEnumerator, LPCWSTR pwstrId, VolumeMonitor *pMonitor, AudioEndpoint **ppEndpoint)
     {
-        m_csEndpoint.Enter();
+        TraceScope scope("AudioEndpoint::Create");
+
+        *ppEndpoint = NULL;
+
+        // Ids that don't fit are left empty, which keeps them out of the table.
+        AudioEndpoint *pEndpoint = new AudioEndpoint(pMonitor);
+
+        if (wcslen(pwstrId) < ENDPOINT_ID_MAX)
+            wcscpy_s(pEndpoint->m_szId, pwstrId);
 
-        HRESULT hr = m_spEnumerator->GetDefaultAudioEndpoint(eRender, eMultimedia, &m_spAudioEndpoint);
+        HRESULT hr = pEnumerator->GetDevice(pwstrId, &pEndpoint->m_spDevice);
 
         if (SUCCEEDED(hr))
         {
-            hr = m_spAudioEndpoint->Activate(__uuidof(m_spVolumeControl), CLSCTX_INPROC_SERVER, NULL, (void**)&m_spVolumeControl);
+            hr = pEndpoint->m_spDevice->Activate(__uuidof(IAudioEndpointVolume), CLSCTX_INPROC_SERVER, NULL, (void**)&pEndpoint->m_spVolumeControl);
 
             if (SUCCEEDED(hr))
             {
-                hr = m_spVolumeControl->RegisterControlChangeNotify(this);
-                m_bRegisteredForVolumeNotifications = SUCCEEDED(hr);
+                hr = pEndpoint->m_spVolumeControl->RegisterControlChangeNotify(pEndpoint);
+                pEndpoint->m_bRegisteredForVolumeNotifications = SUCCEEDED(hr);
             }
         }
 
-        m_csEndpoint.Leave();
-        return hr;
+        if (SUCCEEDED(hr))
+        {
+            VOLUME_INFO info = {0};
+            hr = pEndpoint->m_spVolumeControl->GetMute(&info.bMuted);
+
+            if (SUCCEEDED(hr))
+                hr = pEndpoint->m_spVolumeControl->GetMasterVolumeLevelScalar(&info.fLevel);
+
+            // A notification that came in meanwhile is newer than what was read.
+            if (SUCCEEDED(hr))
+                InterlockedCompareExchange(&pEndpoint->m_nLevel, LevelFromInfo(info.fLevel, info.bMuted), -1);
+        }
+
+        if (FAILED(hr))
+        {
+            pEndpoint->Unregister();
+            pEndpoint->Release();
+            return hr;
+        }
+
+        *ppEndpoint = pEndpoint;
+        return S_OK;
+    }
+
+    // Called once, by whoever drops the endpoint from use.
+    void Unregister()
+    {
+        if (m_bRegisteredForVolumeNotifications)
+        {
+            m_spVolumeControl->UnregisterControlChangeNotify(this);
+            m_bRegisteredForVolumeNotifications = FALSE;
+        }
+    }
+
+    IMMDevice* GetDevice()
+    {
+        return m_spDevice;
+    }
+
+    IAudioEndpointVolume* GetVolumeControl()
+    {
+        return m_spVolumeControl;
+    }
+
+    LPCWSTR GetId()
+    {
+        return m_szId;
+    }
+
+    // Level from the latest notification, -1 if unknown.
+    int GetCachedLevel()
+    {
+        return InterlockedCompareExchange(&m_nLevel, -1, -1);
+    }
+
+    // UI thread only.
+    ULONGLONG GetLastUsed()
+    {
+        return m_tLastUsed;
+    }
+
+    void SetLastUsed(ULONGLONG tNow)
+    {
+        m_tLastUsed = tNow;
+    }
+
+    IFACEMETHODIMP OnNotify(PAUDIO_VOLUME_NOTIFICATION_DATA pNotify);
+
+    IFACEMETHODIMP QueryInterface(const IID& iid, void** ppUnk)
+    {
+        if ((iid == __uuidof(IUnknown)) || (iid == __uuidof(IAudioEndpointVolumeCallback)))
+        {
+            *ppUnk = static_cast<IAudioEndpointVolumeCallback*>(this);
+        }
+        else
+        {
+            *ppUnk = NULL;
+            return E_NOINTERFACE;
+        }
+
+        AddRef();
+        return S_OK;
+    }
+
+    IFACEMETHODIMP_(ULONG) AddRef()
+    {
+        return InterlockedIncrement(&m_cRef);
+    }
+
+    IFACEMETHODIMP_(ULONG) Release()
+    {
+        long lRef = InterlockedDecrement(&m_cRef);
+
+        if (lRef == 0)
+            delete this;
+
+        return lRef;
+    }
+};
+
+// Hands a device id to the UI thread, which owns the copy once it's posted.
+void PostDeviceId(HWND hWnd, UINT message, LPCWSTR pwstrId)
+{
+    LPWSTR pwstrCopy = NULL;
+
+    if (pwstrId != NULL)
+    {
+        size_t cch = wcslen(pwstrId) + 1;
+        pwstrCopy = new WCHAR[cch];
+        wcscpy_s(pwstrCopy, cch, pwstrId);
+    }
+
+    if (hWnd == NULL || !PostMessage(hWnd, message, 0, (LPARAM)pwstrCopy))
+        delete[] pwstrCopy;
+}
+
+class VolumeMonitor : IMMNotificationClient
+{
+private:
+    HWND                            m_hWnd;
+    BOOL                            m_bRegisteredForEndpointNotifications;
+    CComPtr<IMMDeviceEnumerator>    m_spEnumerator;
+    AudioEndpoint* volatile         m_pEndpoint;
+    volatile LONG                   m_cEndpointReaders[2];
+    volatile LONG                   m_nReaderEpoch;
+    AudioEndpoint*                  m_endpoints[ENDPOINT_TABLE_SIZE];
+    volatile LONG                   m_nLevel;
+    volatile LONG                   m_bChangePosted;
+    volatile LONG                   m_cNotifications;
+    volatile LONG                   m_nWrittenLevel;
+    volatile LONG                   m_cEchoes;
+    LONG                            m_cWrites;
+    long                            m_cRef;
+
+    ~VolumeMonitor() {}
+
+    // Readers never wait: they announce themselves in the reader count of the
+    // current epoch only for the instant between loading the pointer and
+    // taking a reference. A reader that stalled between reading the epoch and
+    // counting itself may be counted in an epoch publishers are no longer
+    // waiting on, so it checks the epoch didn't move and starts over if it
+    // did.
+    AudioEndpoint* AcquireEndpoint()
+    {
+        LONG nEpoch;
+
+        for (;;)
+        {
+            nEpoch = InterlockedCompareExchange(&m_nReaderEpoch, 0, 0);
+            InterlockedIncrement(&m_cEndpointReaders[nEpoch & 1]);
+
+            if (InterlockedCompareExchange(&m_nReaderEpoch, 0, 0) == nEpoch)
+                break;
+
+            InterlockedDecrement(&m_cEndpointReaders[nEpoch & 1]);
+        }
+
+        AudioEndpoint *pEndpoint = (AudioEndpoint*)InterlockedCompareExchangePointer((void* volatile*)&m_pEndpoint, NULL, NULL);
+
+        if (pEndpoint != NULL)
+            pEndpoint->AddRef();
+
+        InterlockedDecrement(&m_cEndpointReaders[nEpoch & 1]);
+        return pEndpoint;
+    }
+
+    // Swaps in another endpoint (or NULL), taking a reference to it. A reader
+    // that loaded the old pointer before the swap may not have referenced it
+    // yet, so the old reference is only dropped once the readers of the
+    // epoch before the swap are done; after that the last holder frees it.
+    // Readers arriving after the swap count in the other epoch, so the wait
+    // is bounded by the few already inside and a steady stream of readers
+    // can't hold the UI thread here. An old endpoint that isn't in the table
+    // stops getting notifications here. Only the UI thread publishes.
+    void PublishEndpoint(AudioEndpoint *pEndpoint)
+    {
+        ULONGLONG tNow = GetTickCount64();
+
+        if (pEndpoint != NULL)
+        {
+            pEndpoint->AddRef();
+            pEndpoint->SetLastUsed(tNow);
+        }
+
+        AudioEndpoint *pOld = (AudioEndpoint*)InterlockedExchangePointer((void* volatile*)&m_pEndpoint, pEndpoint);
+
+        if (pOld == NULL)
+            return;
+
+        pOld->SetLastUsed(tNow);
+
+        if (FindEndpoint(pOld->GetId()) < 0)
+            pOld->Unregister();
+
+        LONG epoch = (InterlockedIncrement(&m_nReaderEpoch) - 1) & 1;
+
+        while (InterlockedCompareExchange(&m_cEndpointReaders[epoch], 0, 0) != 0)
+            YieldProcessor();
+
+        pOld->Release();
+    }
+
+    int FindEndpoint(LPCWSTR pwstrId)
+    {
+        if (pwstrId[0] == 0)
+            return -1;
+
+        for (int i = 0; i < ENDPOINT_TABLE_SIZE; i++)
+        {
+            if (m_endpoints[i] != NULL && wcscmp(m_endpoints[i]->GetId(), pwstrId) == 0)
+                return i;
+        }
+
+        return -1;
+    }
+
+    void RemoveEndpoint(int i)
+    {
+        AudioEndpoint *pEndpoint = m_endpoints[i];
+        m_endpoints[i] = NULL;
+
+        // The current endpoint keeps its registration until it's swapped out.
+        if (pEndpoint != m_pEndpoint)
+            pEndpoint->Unregister();
+
+        pEndpoint->Release();
     }
 
-    void DetachFromEndpoint()
+    // Returns a referenced endpoint for the device, from the table or newly
+    // activated and added to it. When the table is full, the endpoint used
+    // least recently (other than the current one) makes room.
+    AudioEndpoint* WarmEndpoint(LPCWSTR pwstrId)
     {
-        m_csEndpoint.Enter();
+        int i = FindEndpoint(pwstrId);
 
-        if (m_spVolumeControl != NULL)
+        if (i >= 0)
         {
-            if (m_bRegisteredForVolumeNotifications)
+            m_endpoints[i]->AddRef();
+            return m_endpoints[i];
+        }
+
+        AudioEndpoint *pEndpoint = NULL;
+
+        if (FAILED(AudioEndpoint::Create(m_spEnumerator, pwstrId, this, &pEndpoint)))
+            return NULL;
+
+        pEndpoint->SetLastUsed(GetTickCount64());
+
+        if (pEndpoint->GetId()[0] == 0)
+            return pEndpoint;
+
+        int iFree = -1;
+
+        for (i = 0; i < ENDPOINT_TABLE_SIZE; i++)
+        {
+            if (m_endpoints[i] == NULL)
             {
-                m_spVolumeControl->UnregisterControlChangeNotify(this);
-                m_bRegisteredForVolumeNotifications = FALSE;
+                iFree = i;
+                break;
             }
 
-            m_spVolumeControl.Release();
+            if (m_endpoints[i] != m_pEndpoint && (iFree < 0 || m_endpoints[i]->GetLastUsed() < m_endpoints[iFree]->GetLastUsed()))
+                iFree = i;
         }
 
-        if (m_spAudioEndpoint != NULL)
-            m_spAudioEndpoint.Release();
+        if (m_endpoints[iFree] != NULL)
+            RemoveEndpoint(iFree);
 
-        m_csEndpoint.Leave();
+        pEndpoint->AddRef();
+        m_endpoints[iFree] = pEndpoint;
+
+        return pEndpoint;
     }
 
-    IFACEMETHODIMP OnDefaultDeviceChanged(EDataFlow flow, ERole role, LPCWSTR pwstrDefaultDeviceId)
+    // COM calls on a device that isn't in the table yet happen before
+    // anything is published, so a slow device (Bluetooth) doesn't hold up
+    // readers of the current one.
+    HRESULT AttachToEndpoint(LPCWSTR pwstrId)
     {
-        if (flow == eRender)
+        TraceScope scope("AttachToEndpoint");
+
+        LPWSTR pwstrDefault = NULL;
+
+        if (pwstrId == NULL)
+        {
+            CComPtr<IMMDevice> spDevice;
+
+            if (SUCCEEDED(m_spEnumerator->GetDefaultAudioEndpoint(eRender, eMultimedia, &spDevice)))
+                spDevice->GetId(&pwstrDefault);
+
+            pwstrId = pwstrDefault;
+        }
+
+        AudioEndpoint *pEndpoint = pwstrId != NULL ? WarmEndpoint(pwstrId) : NULL;
+
+        PublishEndpoint(pEndpoint);
+
+        // From here on its notifications publish their level themselves, and
+        // one landing between reading the cached level and storing it would
+        // be overwritten. An endpoint caches before it publishes, so storing
+        // until the cache reads the same after the store leaves the newest.
+        if (pEndpoint != NULL)
+        {
+            LONG level = pEndpoint->GetCachedLevel();
+            LONG stored;
+
+            do
+            {
+                stored = level;
+                InterlockedExchange(&m_nLevel, stored);
+                level = pEndpoint->GetCachedLevel();
+            } while (level != stored);
+        }
+        else
         {
-            if (m_hWnd != NULL)
-                PostMessage(m_hWnd, WM_ENDPOINTCHANGE, 0, 0);
+            InterlockedExchange(&m_nLevel, -1);
         }
 
+        if (pEndpoint != NULL)
+            pEndpoint->Release();
+
+        CoTaskMemFree(pwstrDefault);
+        return pEndpoint != NULL ? S_OK : E_FAIL;
+    }
+
+    // Device callbacks may not call back into the device API, so they only
+    // pass the device id on to the UI thread.
+    IFACEMETHODIMP OnDefaultDeviceChanged(EDataFlow flow, ERole role, LPCWSTR pwstrDefaultDeviceId)
+    {
+        if (flow == eRender && role == eMultimedia)
+            PostDeviceId(m_hWnd, WM_ENDPOINTCHANGE, pwstrDefaultDeviceId);
+
+        return S_OK;
+    }
+
+    IFACEMETHODIMP OnDeviceStateChanged(LPCWSTR pwstrDeviceId, DWORD dwNewState)
+    {
+        PostDeviceId(m_hWnd, WM_ENDPOINTSTATE, pwstrDeviceId);
         return S_OK;
     }
 
-    IFACEMETHODIMP OnNotify(PAUDIO_VOLUME_NOTIFICATION_DATA pNotify)
+    IFACEMETHODIMP OnDeviceAdded(LPCWSTR pwstrDeviceId)
     {
-        if (m_hWnd != NULL)
-            PostMessage(m_hWnd, WM_VOLUMECHANGE, 0, 0);
+        PostDeviceId(m_hWnd, WM_ENDPOINTSTATE, pwstrDeviceId);
+        return S_OK;
+    }
 
+    IFACEMETHODIMP OnDeviceRemoved(LPCWSTR pwstrDeviceId)
+    {
+        PostDeviceId(m_hWnd, WM_ENDPOINTSTATE, pwstrDeviceId);
         return S_OK;
     }
 
@@ -102,10 +631,6 @@ private:
         {
             *ppUnk = static_cast<IMMNotificationClient*>(this);
         }
-        else if (iid == __uuidof(IAudioEndpointVolumeCallback))
-        {
-            *ppUnk = static_cast<IAudioEndpointVolumeCallback*>(this);
-        }
         else
         {
             *ppUnk = NULL;
@@ -116,9 +641,6 @@ private:
         return S_OK;
     }
 
-    IFACEMETHODIMP OnDeviceStateChanged(LPCWSTR pwstrDeviceId, DWORD dwNewState) { return S_OK; }
-    IFACEMETHODIMP OnDeviceAdded(LPCWSTR pwstrDeviceId) { return S_OK; }
-    IFACEMETHODIMP OnDeviceRemoved(LPCWSTR pwstrDeviceId) { return S_OK; }
     IFACEMETHODIMP OnPropertyValueChanged(LPCWSTR pwstrDeviceId, const PROPERTYKEY key) { return S_OK; }
     IFACEMETHODIMP OnDeviceQueryRemove() { return S_OK; }
     IFACEMETHODIMP OnDeviceQueryRemoveFailed() { return S_OK; }
@@ -128,68 +650,1799 @@ public:
     VolumeMonitor() :
         m_hWnd(NULL),
         m_bRegisteredForEndpointNotifications(FALSE),
-        m_bRegisteredForVolumeNotifications(FALSE),
+        m_pEndpoint(NULL),
+        m_nReaderEpoch(0),
+        m_nLevel(-1),
+        m_bChangePosted(FALSE),
+        m_cNotifications(0),
+        m_nWrittenLevel(-1),
+        m_cEchoes(0),
+        m_cWrites(0),
         m_cRef(1)
-    {}
+    {
+        ZeroMemory((void*)m_cEndpointReaders, sizeof(m_cEndpointReaders));
+        ZeroMemory(m_endpoints, sizeof(m_endpoints));
+    }
+
+    // Uses pEnumerator instead of the system's one when given.
+    HRESULT Initialize(IMMDeviceEnumerator *pEnumerator = NULL)
+    {
+        HRESULT hr = S_OK;
+
+        if (pEnumerator != NULL)
+        {
+            m_spEnumerator = pEnumerator;
+        }
+        else
+        {
+            TraceScope scope("CoCreateInstance");
+            hr = m_spEnumerator.CoCreateInstance(__uuidof(MMDeviceEnumerator));
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = m_spEnumerator->RegisterEndpointNotificationCallback(this);
+
+            if (SUCCEEDED(hr))
+            {
+                m_bRegisteredForEndpointNotifications = TRUE;
+                WarmActiveEndpoints();
+                hr = AttachToEndpoint(NULL);
+            }
+        }
+
+        return hr;
+    }
+
+    void Dispose()
+    {
+        if (m_bRegisteredForEndpointNotifications)
+        {
+            m_spEnumerator->UnregisterEndpointNotificationCallback(this);
+            m_bRegisteredForEndpointNotifications = FALSE;
+        }
+
+        PublishEndpoint(NULL);
+
+        for (int i = 0; i < ENDPOINT_TABLE_SIZE; i++)
+        {
+            if (m_endpoints[i] != NULL)
+                RemoveEndpoint(i);
+        }
+    }
+
+    void SetWindow(HWND hWnd)
+    {
+        m_hWnd = hWnd;
+    }
+
+    HWND GetWindow()
+    {
+        return m_hWnd;
+    }
+
+    HRESULT GetLevelInfo(VOLUME_INFO* pInfo)
+    {
+        HRESULT hr = E_FAIL;
+        AudioEndpoint *pEndpoint = AcquireEndpoint();
+
+        if (pEndpoint != NULL)
+        {
+            hr = pEndpoint->GetVolumeControl()->GetMute(&pInfo->bMuted);
+
+            if (SUCCEEDED(hr))
+                hr = pEndpoint->GetVolumeControl()->GetMasterVolumeLevelScalar(&pInfo->fLevel);
+
+            pEndpoint->Release();
+        }
+
+        return hr;
+    }
+
+    HRESULT GetDevice(IMMDevice **ppDevice)
+    {
+        *ppDevice = NULL;
+
+        AudioEndpoint *pEndpoint = AcquireEndpoint();
+
+        if (pEndpoint == NULL)
+            return E_FAIL;
+
+        *ppDevice = pEndpoint->GetDevice();
+        (*ppDevice)->AddRef();
+
+        pEndpoint->Release();
+        return S_OK;
+    }
+
+    // Returns the level last published by a notification, querying the
+    // endpoint only when there's none yet.
+    int GetLevel()
+    {
+        LONG level = InterlockedCompareExchange(&m_nLevel, -1, -1);
+
+        if (level >= 0)
+            return level;
+
+        VOLUME_INFO info = {0};
+
+        if (FAILED(GetLevelInfo(&info)))
+            return 0;
+
+        // A notification that came in meanwhile is newer than what was read.
+        level = LevelFromInfo(info.fLevel, info.bMuted);
+        LONG published = InterlockedCompareExchange(&m_nLevel, level, -1);
+
+        return published >= 0 ? published : level;
+    }
+
+    // Dragging a volume slider fires hundreds of notifications per second.
+    // Only the latest level is kept, and a WM_VOLUMECHANGE is posted only
+    // when none is pending; the UI thread reads whatever is newest when it
+    // gets to it. Endpoints other than the current one only cache theirs.
+    //
+    // Our own writes publish their level up front, so their echoes are
+    // dropped: the one of the latest write when that level is still the
+    // published one, and those of earlier writes since a newer one follows.
+    // An echo only gets through when a change from elsewhere was published
+    // in between.
+    void OnEndpointNotify(AudioEndpoint *pEndpoint, int level, BOOL bEcho)
+    {
+        InterlockedIncrement(&m_cNotifications);
+
+        if (pEndpoint != InterlockedCompareExchangePointer((void* volatile*)&m_pEndpoint, NULL, NULL))
+            return;
+
+        if (bEcho && (level == InterlockedCompareExchange(&m_nLevel, -1, -1) ||
+            level != InterlockedCompareExchange(&m_nWrittenLevel, -1, -1)))
+        {
+            InterlockedIncrement(&m_cEchoes);
+            return;
+        }
+
+        InterlockedExchange(&m_nLevel, level);
+
+        if (m_hWnd != NULL && InterlockedExchange(&m_bChangePosted, TRUE) == FALSE)
+        {
+            if (!PostMessage(m_hWnd, WM_VOLUMECHANGE, 0, 0))
+                InterlockedExchange(&m_bChangePosted, FALSE);
+        }
+    }
+
+    // Called by the UI thread when it takes a WM_VOLUMECHANGE, before reading
+    // the level, so a notification arriving after the read posts again.
+    void AcknowledgeChange()
+    {
+        InterlockedExchange(&m_bChangePosted, FALSE);
+    }
+
+    LONG GetNotificationCount()
+    {
+        return InterlockedCompareExchange(&m_cNotifications, 0, 0);
+    }
+
+    LONG GetEchoCount()
+    {
+        return InterlockedCompareExchange(&m_cEchoes, 0, 0);
+    }
+
+    // UI thread only.
+    LONG GetWriteCount()
+    {
+        return m_cWrites;
+    }
+
+    // One endpoint write, of the level or (bMute) of the mute state, tagged
+    // with volume_write_context. pInfo is the whole resulting state, which
+    // is published before the write so the echo finds it there. UI thread
+    // only.
+    HRESULT SetVolume(const VOLUME_INFO *pInfo, BOOL bMute)
+    {
+        TraceScope scope("SetVolume");
+
+        AudioEndpoint *pEndpoint = AcquireEndpoint();
+
+        if (pEndpoint == NULL)
+            return E_FAIL;
+
+        LONG level = LevelFromInfo(pInfo->fLevel, pInfo->bMuted);
+
+        InterlockedExchange(&m_nWrittenLevel, level);
+        InterlockedExchange(&m_nLevel, level);
+
+        HRESULT hr = bMute ?
+            pEndpoint->GetVolumeControl()->SetMute(pInfo->bMuted, &volume_write_context) :
+            pEndpoint->GetVolumeControl()->SetMasterVolumeLevelScalar(pInfo->fLevel, &volume_write_context);
+
+        m_cWrites++;
+
+        // Unknown again; the next GetLevel asks the endpoint.
+        if (FAILED(hr))
+            InterlockedExchange(&m_nLevel, -1);
+
+        pEndpoint->Release();
+        return hr;
+    }
+
+    // pwstrId is the new default, or NULL to look it up.
+    void ChangeEndpoint(LPCWSTR pwstrId)
+    {
+        TraceScope scope("ChangeEndpoint");
+
+        AttachToEndpoint(pwstrId);
+    }
+
+    void WarmActiveEndpoints()
+    {
+        TraceScope scope("WarmActiveEndpoints");
+
+        CComPtr<IMMDeviceCollection> spDevices;
+        UINT cDevices = 0;
+
+        if (FAILED(m_spEnumerator->EnumAudioEndpoints(eRender, DEVICE_STATE_ACTIVE, &spDevices)) || FAILED(spDevices->GetCount(&cDevices)))
+            return;
+
+        for (UINT i = 0; i < cDevices && i < ENDPOINT_TABLE_SIZE; i++)
+        {
+            CComPtr<IMMDevice> spDevice;
+            LPWSTR pwstrId = NULL;
+
+            if (SUCCEEDED(spDevices->Item(i, &spDevice)) && SUCCEEDED(spDevice->GetId(&pwstrId)))
+            {
+                AudioEndpoint *pEndpoint = WarmEndpoint(pwstrId);
+
+                if (pEndpoint != NULL)
+                    pEndpoint->Release();
+
+                CoTaskMemFree(pwstrId);
+            }
+        }
+    }
+
+    // A device was added, removed or changed state: keep it warm while it's an
+    // active render endpoint, drop it otherwise.
+    void RefreshEndpoint(LPCWSTR pwstrId)
+    {
+        TraceScope scope("RefreshEndpoint");
+
+        CComPtr<IMMDevice> spDevice;
+        CComPtr<IMMEndpoint> spEndpoint;
+        DWORD dwState = 0;
+        EDataFlow flow = eCapture;
+
+        BOOL bActive = SUCCEEDED(m_spEnumerator->GetDevice(pwstrId, &spDevice)) &&
+            SUCCEEDED(spDevice->GetState(&dwState)) && dwState == DEVICE_STATE_ACTIVE &&
+            SUCCEEDED(spDevice->QueryInterface(__uuidof(IMMEndpoint), (void**)&spEndpoint)) &&
+            SUCCEEDED(spEndpoint->GetDataFlow(&flow)) && flow == eRender;
+
+        if (bActive)
+        {
+            AudioEndpoint *pEndpoint = WarmEndpoint(pwstrId);
+
+            if (pEndpoint != NULL)
+                pEndpoint->Release();
+        }
+        else
+        {
+            int i = FindEndpoint(pwstrId);
+
+            if (i >= 0)
+                RemoveEndpoint(i);
+        }
+    }
+
+    // Releases endpoints that haven't been the default for ENDPOINT_IDLE_MS.
+    void TrimEndpoints()
+    {
+        ULONGLONG tNow = GetTickCount64();
+
+        for (int i = 0; i < ENDPOINT_TABLE_SIZE; i++)
+        {
+            if (m_endpoints[i] != NULL && m_endpoints[i] != m_pEndpoint && tNow - m_endpoints[i]->GetLastUsed() > ENDPOINT_IDLE_MS)
+                RemoveEndpoint(i);
+        }
+    }
+
+    IFACEMETHODIMP_(ULONG) AddRef()
+    {
+        return InterlockedIncrement(&m_cRef);
+    }
+
+    IFACEMETHODIMP_(ULONG) Release()
+    {
+        long lRef = InterlockedDecrement(&m_cRef);
+
+        if (lRef == 0)
+            delete this;
+
+        return lRef;
+    }
+};
+
+STDMETHODIMP AudioEndpoint::OnNotify(PAUDIO_VOLUME_NOTIFICATION_DATA pNotify)
+{
+    TraceScope scope("OnNotify");
+
+    int level = LevelFromInfo(pNotify->fMasterVolume, pNotify->bMuted);
+
+    InterlockedExchange(&m_nLevel, level);
+    m_pMonitor->OnEndpointNotify(this, level, pNotify->guidEventContext == volume_write_context);
+
+    return S_OK;
+}
+
+static VolumeMonitor *vol = NULL;
+
+// Icons are rendered the first time a level (and meter step) is shown and
+// kept in a small LRU, which holds every step of a meter playing at one
+// level. Each entry remembers the colors it was drawn with, so after a theme
+// switch the old entries just stop matching and age out.
+
+#define ICON_CACHE_SIZE 12
+
+struct ICON_ENTRY
+{
+    HICON hIcon;
+    int nLevel;
+    int nMeter;
+    DWORD dwFore;
+    DWORD dwBack;
+    ULONG nLastUse;
+};
+
+class IconCache
+{
+private:
+    ICON_ENTRY  m_entries[ICON_CACHE_SIZE];
+    ULONG       m_nClock;
+    int         m_nSize;
+    DWORD*      m_pBits;
+    HBITMAP     m_hBitmap;
+    HBITMAP     m_hMask;
+
+public:
+    IconCache() : m_nClock(0), m_nSize(ICON_GRID), m_pBits(NULL), m_hBitmap(NULL), m_hMask(NULL)
+    {
+        ZeroMemory(m_entries, sizeof(m_entries));
+    }
+
+    BOOL Initialize(int nSize)
+    {
+        const int d = std::min(std::max(nSize, (int)ICON_GRID), (int)ICON_MAX_SIZE);
+
+        m_nSize = d;
+
+        BITMAPV5HEADER bi = {};
+        bi.bV5Size        = sizeof(BITMAPV5HEADER);
+        bi.bV5Width       = d;
+        bi.bV5Height      = -d;
+        bi.bV5Planes      = 1;
+        bi.bV5BitCount    = 32;
+        bi.bV5Compression = BI_BITFIELDS;
+        bi.bV5RedMask     = 0x00FF0000;
+        bi.bV5GreenMask   = 0x0000FF00;
+        bi.bV5BlueMask    = 0x000000FF;
+        bi.bV5AlphaMask   = 0xFF000000;
+
+        HDC hdc = GetDC(NULL);
+        m_hBitmap = CreateDIBSection(hdc, (BITMAPINFO*)&bi, DIB_RGB_COLORS, (void**)&m_pBits, NULL, (DWORD)0);
+        m_hMask = CreateBitmap(d, d, 1, 1, NULL);
+
+        ReleaseDC(NULL, hdc);
+
+        return m_hBitmap != NULL && m_hMask != NULL;
+    }
+
+    void Dispose()
+    {
+        for (int i = 0; i < ICON_CACHE_SIZE; i++)
+        {
+            if (m_entries[i].hIcon != NULL)
+                DestroyIcon(m_entries[i].hIcon);
+        }
+
+        ZeroMemory(m_entries, sizeof(m_entries));
+
+        if (m_hMask != NULL)
+            DeleteObject(m_hMask);
+
+        if (m_hBitmap != NULL)
+            DeleteObject(m_hBitmap);
+
+        m_hMask = NULL;
+        m_hBitmap = NULL;
+        m_pBits = NULL;
+    }
+
+    // The returned icon stays valid until ICON_CACHE_SIZE other icons were
+    // requested; the shell keeps its own copy once it's been set.
+    HICON GetIcon(int nLevel, int nMeter = 0)
+    {
+        ICON_ENTRY *pVictim = &m_entries[0];
+
+        for (int i = 0; i < ICON_CACHE_SIZE; i++)
+        {
+            ICON_ENTRY &entry = m_entries[i];
+
+            if (entry.hIcon != NULL && entry.nLevel == nLevel && entry.nMeter == nMeter && entry.dwFore == fore && entry.dwBack == back)
+            {
+                entry.nLastUse = ++m_nClock;
+                return entry.hIcon;
+            }
+
+            if (pVictim->hIcon != NULL && (entry.hIcon == NULL || entry.nLastUse < pVictim->nLastUse))
+                pVictim = &entry;
+        }
+
+        if (m_pBits == NULL)
+            return NULL;
+
+        TraceScope scope("CreateIconIndirect");
+
+        RenderIcon(m_pBits, m_nSize, nLevel, nMeter);
+
+        ICONINFO ii = {};
+        ii.fIcon = TRUE;
+        ii.hbmMask = m_hMask;
+        ii.hbmColor = m_hBitmap;
+
+        HICON hIcon = CreateIconIndirect(&ii);
+
+        if (hIcon == NULL)
+            return NULL;
+
+        if (pVictim->hIcon != NULL)
+            DestroyIcon(pVictim->hIcon);
+
+        pVictim->hIcon = hIcon;
+        pVictim->nLevel = nLevel;
+        pVictim->nMeter = nMeter;
+        pVictim->dwFore = fore;
+        pVictim->dwBack = back;
+        pVictim->nLastUse = ++m_nClock;
+
+        return hIcon;
+    }
+};
+
+static IconCache icons;
+
+// Dark digits on a light taskbar, light ones on a dark taskbar. Without the
+// setting (before Windows 10) the digits stay dark.
+BOOL UpdateThemeColors()
+{
+    DWORD dwLight = 1;
+    DWORD cbData = sizeof(dwLight);
+
+    RegGetValue(HKEY_CURRENT_USER, L"Software\\Microsoft\\Windows\\CurrentVersion\\Themes\\Personalize",
+        L"SystemUsesLightTheme", RRF_RT_REG_DWORD, NULL, &dwLight, &cbData);
+
+    DWORD dwFore = dwLight ? 0xFF000000 : 0xFFFFFFFF;
+    BOOL bChanged = dwFore != fore;
+
+    fore = dwFore;
+    return bChanged;
+}
+
+void FormatTip(wchar_t *pszTip, int level)
+{
+    if (level == 101)
+        swprintf(pszTip, 64, L"Volumen: silenciado");
+    else
+        swprintf(pszTip, 64, L"Volumen: %d%%", level);
+}
+
+// What the shell currently shows; the tooltip follows from the level too.
+static int shown_level = -1;
+static int shown_meter = 0;
+
+// Meter step to show, kept at 0 unless the meter runs (--meter).
+static int meter_level = 0;
+static LONG icon_updates = 0;
+static LONG icon_updates_skipped = 0;
+
+// What StartVolumeIcon measured: its time and the GDI and USER objects the
+// process held when it was done.
+static double startup_ms = 0.0;
+static DWORD startup_gdi_objects = 0;
+static DWORD startup_user_objects = 0;
+
+// Shell_NotifyIcon, or a recorder when the audio side is simulated.
+static BOOL (WINAPI *notify_icon)(DWORD, PNOTIFYICONDATA) = Shell_NotifyIcon;
+
+void UpdateNotificationIcon(BOOL bForce = FALSE)
+{
+    int level = vol->GetLevel();
+
+    if (level == shown_level && meter_level == shown_meter && !bForce)
+    {
+        icon_updates_skipped++;
+        return;
+    }
+
+    TraceScope scope("UpdateNotificationIcon");
+
+    shown_level = level;
+    shown_meter = meter_level;
+    icon_updates++;
+
+    NOTIFYICONDATA notif = { sizeof(notif) };
+    notif.hWnd = vol->GetWindow();
+    notif.uID = 1;
+    notif.uFlags = NIF_ICON | NIF_TIP;
+    notif.uVersion = NOTIFYICON_VERSION_4;
+    notif.hIcon = icons.GetIcon(level, meter_level);
+    FormatTip(notif.szTip, level);
+
+    notify_icon(NIM_MODIFY, &notif);
+}
+
+// Scrolling over the icon changes the volume by WHEEL_PERCENT a notch and a
+// click toggles mute. The shell doesn't pass the wheel on to tray icons, so
+// while the pointer is over the icon a low level mouse hook takes it, and
+// it's removed once the pointer leaves. Wheel deltas add up and are written
+// in one go every WHEEL_FLUSH_MS, which caps the endpoint writes at about
+// 60 a second however fast the wheel spins.
+//
+// The hook lives on a thread of its own that only pumps messages, so the
+// pointer never waits on whatever the window's thread is busy with (in the
+// host that's the hotkeys reloads too). The window asks it to install and
+// remove the hook with WM_WHEELHOOK; the hook adds up the deltas and posts
+// WM_WHEELSCROLL and WM_WHEELLEAVE back, each once until it's handled.
+
+#define WHEEL_PERCENT   2
+#define WHEEL_FLUSH_MS  16
+
+static HANDLE wheel_thread = NULL;
+static DWORD wheel_thread_id = 0;
+static BOOL wheel_tracking = FALSE; // window thread: the hook is installed or on its way
+static RECT wheel_rect = {0}; // hook thread only
+static volatile LONG wheel_delta = 0;
+static volatile LONG wheel_scroll_posted = FALSE;
+static volatile LONG wheel_leave_posted = FALSE;
+static BOOL wheel_flush_pending = FALSE;
+
+// The volume as last read or written here, kept until a change from
+// elsewhere comes in, so a flush doesn't have to read it back first.
+static VOLUME_INFO control_info = {0};
+static BOOL control_info_valid = FALSE;
+
+BOOL GetControlInfo()
+{
+    if (!control_info_valid)
+        control_info_valid = SUCCEEDED(vol->GetLevelInfo(&control_info));
+
+    return control_info_valid;
+}
+
+void WriteControlInfo(const VOLUME_INFO *pInfo, BOOL bMute)
+{
+    control_info = *pInfo;
+    control_info_valid = SUCCEEDED(vol->SetVolume(pInfo, bMute));
+
+    UpdateNotificationIcon();
+}
+
+void PostWheelOnce(volatile LONG *pPosted, UINT message)
+{
+    if (InterlockedExchange(pPosted, TRUE) == FALSE)
+    {
+        if (!PostMessage(vol->GetWindow(), message, 0, 0))
+            InterlockedExchange(pPosted, FALSE);
+    }
+}
+
+LRESULT CALLBACK WheelHookProc(int nCode, WPARAM wParam, LPARAM lParam)
+{
+    if (nCode == HC_ACTION)
+    {
+        const MSLLHOOKSTRUCT *pHook = (const MSLLHOOKSTRUCT*)lParam;
+
+        // The hook is only removed once the window got to the message and
+        // passed that on, so events keep coming until then; it's posted
+        // once.
+        if (!PtInRect(&wheel_rect, pHook->pt))
+        {
+            PostWheelOnce(&wheel_leave_posted, WM_WHEELLEAVE);
+        }
+        else if (wParam == WM_MOUSEWHEEL)
+        {
+            InterlockedExchangeAdd(&wheel_delta, (short)HIWORD(pHook->mouseData));
+            PostWheelOnce(&wheel_scroll_posted, WM_WHEELSCROLL);
+            return 1;
+        }
+    }
+
+    return CallNextHookEx(NULL, nCode, wParam, lParam);
+}
+
+// WM_WHEELHOOK with an icon RECT (which it frees) installs the hook, without
+// one removes it.
+DWORD WINAPI WheelThread(LPVOID pParam)
+{
+    MSG msg;
+    HHOOK hHook = NULL;
+
+    // the queue has to exist before the window posts to it
+    PeekMessage(&msg, NULL, WM_USER, WM_USER, PM_NOREMOVE);
+    SetEvent((HANDLE)pParam);
+
+    while (GetMessage(&msg, NULL, 0, 0) > 0)
+    {
+        if (msg.message != WM_WHEELHOOK)
+            continue;
+
+        RECT *pRect = (RECT*)msg.lParam;
+
+        if (pRect != NULL && hHook == NULL)
+        {
+            wheel_rect = *pRect;
+            hHook = SetWindowsHookEx(WH_MOUSE_LL, WheelHookProc, GetModuleHandle(NULL), 0);
+
+            // lets the window try again on the next move over the icon
+            if (hHook == NULL)
+                PostWheelOnce(&wheel_leave_posted, WM_WHEELLEAVE);
+        }
+        else if (pRect == NULL && hHook != NULL)
+        {
+            UnhookWindowsHookEx(hHook);
+            hHook = NULL;
+        }
+
+        delete pRect;
+    }
+
+    if (hHook != NULL)
+        UnhookWindowsHookEx(hHook);
+
+    return 0;
+}
+
+BOOL StartWheelThread()
+{
+    if (wheel_thread != NULL)
+        return TRUE;
+
+    HANDLE hReady = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    if (hReady == NULL)
+        return FALSE;
+
+    wheel_thread = CreateThread(NULL, 0, WheelThread, hReady, 0, &wheel_thread_id);
+
+    if (wheel_thread != NULL)
+        WaitForSingleObject(hReady, INFINITE);
+
+    CloseHandle(hReady);
+    return wheel_thread != NULL;
+}
+
+void StopWheelThread()
+{
+    if (wheel_thread == NULL)
+        return;
+
+    PostThreadMessage(wheel_thread_id, WM_QUIT, 0, 0);
+    WaitForSingleObject(wheel_thread, INFINITE);
+    CloseHandle(wheel_thread);
+
+    wheel_thread = NULL;
+    wheel_tracking = FALSE;
+}
+
+// The pointer moved over the icon.
+void TrackWheel(HWND hWnd)
+{
+    if (wheel_tracking)
+        return;
+
+    NOTIFYICONIDENTIFIER nii = { sizeof(nii) };
+    nii.hWnd = hWnd;
+    nii.uID = 1;
+
+    RECT *pRect = new RECT;
+
+    if (SUCCEEDED(Shell_NotifyIconGetRect(&nii, pRect)) && StartWheelThread())
+    {
+        InterlockedExchange(&wheel_leave_posted, FALSE);
+        wheel_tracking = PostThreadMessage(wheel_thread_id, WM_WHEELHOOK, 0, (LPARAM)pRect);
+    }
+
+    if (!wheel_tracking)
+        delete pRect;
+}
+
+// The pointer left the icon.
+void UntrackWheel()
+{
+    if (wheel_tracking)
+        PostThreadMessage(wheel_thread_id, WM_WHEELHOOK, 0, 0);
+
+    wheel_tracking = FALSE;
+}
+
+// Notches came in; the hook can't start the window's timer itself.
+void ScrollWheel(HWND hWnd)
+{
+    InterlockedExchange(&wheel_scroll_posted, FALSE);
+
+    if (!wheel_flush_pending)
+        wheel_flush_pending = SetTimer(hWnd, TIMER_FLUSH_WHEEL, WHEEL_FLUSH_MS, NULL) != 0;
+}
+
+// The timer runs while the wheel does and stops on the first tick with
+// nothing to write. Touchpads scroll in fractions of a notch; what doesn't
+// add up to a whole percent carries over, and notches the hook adds
+// meanwhile aren't lost.
+void FlushWheel(HWND hWnd)
+{
+    int percent = InterlockedCompareExchange(&wheel_delta, 0, 0) * WHEEL_PERCENT / WHEEL_DELTA;
+
+    if (percent == 0)
+    {
+        KillTimer(hWnd, TIMER_FLUSH_WHEEL);
+        wheel_flush_pending = FALSE;
+        return;
+    }
+
+    InterlockedExchangeAdd(&wheel_delta, -percent * WHEEL_DELTA / WHEEL_PERCENT);
+
+    if (!GetControlInfo())
+        return;
+
+    VOLUME_INFO info = control_info;
+    int level = std::max(0, std::min(100, (int)(info.fLevel * 100.0f + 0.5f) + percent));
+    info.fLevel = level / 100.0f;
+
+    if (info.fLevel != control_info.fLevel)
+        WriteControlInfo(&info, FALSE);
+}
+
+void ToggleMute()
+{
+    if (!GetControlInfo())
+        return;
+
+    VOLUME_INFO info = control_info;
+    info.bMuted = !info.bMuted;
+
+    WriteControlInfo(&info, TRUE);
+}
+
+// Simulated audio backend and notification storm (--storm <results>
+// [--storm-load <notifications> <mute_every> <flap_every>]). VolumeMonitor
+// only talks to the MMDevice interfaces, so the simulation implements those:
+// two render devices whose volume and mute are changed from a separate
+// thread, with the default device flipping between them now and then. The
+// tray icon is replaced by a recorder, and the run writes one "name value"
+// line per measurement: percentiles of the time from a change to an icon
+// showing it or something newer, how many changes were coalesced, whether
+// the last one was lost, and CPU time per 1000 notifications. The simulated
+// objects live for the whole run, so they don't track references.
+//
+// Each device also has a peak meter and one audio session for --meter.
+// --meter-sim <results> [--meter-sim-phase <ms>] runs the meter instead of
+// the storm: the session plays sound for a phase, stays open but silent
+// for one, and stops for one. The results are the time, wakeups per minute
+// and CPU share of each meter state.
+
+#define SIM_DEVICES     2
+#define SIM_CALLBACKS   4
+
+struct STORM_CONFIG
+{
+    LONG cNotifications;
+    LONG nMuteEvery;
+    LONG nFlapEvery;
+};
+
+static STORM_CONFIG storm_config = { 100000, 50, 5000 };
+
+class SimVolume : public IAudioEndpointVolume
+{
+private:
+    CRITICAL_SECTION                m_cs;
+    IAudioEndpointVolumeCallback*   m_callbacks[SIM_CALLBACKS];
+    float                           m_fLevel;
+    BOOL                            m_bMuted;
+
+    // Callbacks are invoked with the lock held, so once Unregister returns
+    // none is running, like with the real endpoint.
+    void Notify(LPCGUID pguidEventContext)
+    {
+        AUDIO_VOLUME_NOTIFICATION_DATA data = {};
+
+        if (pguidEventContext != NULL)
+            data.guidEventContext = *pguidEventContext;
+
+        data.bMuted = m_bMuted;
+        data.fMasterVolume = m_fLevel;
+        data.nChannels = 1;
+        data.afChannelVolumes[0] = m_fLevel;
+
+        for (int i = 0; i < SIM_CALLBACKS; i++)
+        {
+            if (m_callbacks[i] != NULL)
+                m_callbacks[i]->OnNotify(&data);
+        }
+    }
+
+public:
+    SimVolume() : m_fLevel(0.5f), m_bMuted(FALSE)
+    {
+        InitializeCriticalSection(&m_cs);
+        ZeroMemory(m_callbacks, sizeof(m_callbacks));
+    }
+
+    ~SimVolume()
+    {
+        DeleteCriticalSection(&m_cs);
+    }
+
+    int GetLevel()
+    {
+        EnterCriticalSection(&m_cs);
+        int level = LevelFromInfo(m_fLevel, m_bMuted);
+        LeaveCriticalSection(&m_cs);
+
+        return level;
+    }
+
+    IFACEMETHODIMP RegisterControlChangeNotify(IAudioEndpointVolumeCallback *pNotify)
+    {
+        HRESULT hr = E_OUTOFMEMORY;
+        EnterCriticalSection(&m_cs);
+
+        for (int i = 0; i < SIM_CALLBACKS && FAILED(hr); i++)
+        {
+            if (m_callbacks[i] == NULL)
+            {
+                m_callbacks[i] = pNotify;
+                hr = S_OK;
+            }
+        }
+
+        LeaveCriticalSection(&m_cs);
+        return hr;
+    }
+
+    IFACEMETHODIMP UnregisterControlChangeNotify(IAudioEndpointVolumeCallback *pNotify)
+    {
+        EnterCriticalSection(&m_cs);
+
+        for (int i = 0; i < SIM_CALLBACKS; i++)
+        {
+            if (m_callbacks[i] == pNotify)
+                m_callbacks[i] = NULL;
+        }
+
+        LeaveCriticalSection(&m_cs);
+        return S_OK;
+    }
+
+    IFACEMETHODIMP SetMasterVolumeLevelScalar(float fLevel, LPCGUID pguidEventContext)
+    {
+        EnterCriticalSection(&m_cs);
+        m_fLevel = fLevel;
+        Notify(pguidEventContext);
+        LeaveCriticalSection(&m_cs);
+
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetMasterVolumeLevelScalar(float *pfLevel)
+    {
+        EnterCriticalSection(&m_cs);
+        *pfLevel = m_fLevel;
+        LeaveCriticalSection(&m_cs);
+
+        return S_OK;
+    }
+
+    IFACEMETHODIMP SetMute(BOOL bMute, LPCGUID pguidEventContext)
+    {
+        EnterCriticalSection(&m_cs);
+        m_bMuted = bMute;
+        Notify(pguidEventContext);
+        LeaveCriticalSection(&m_cs);
+
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetMute(BOOL *pbMute)
+    {
+        EnterCriticalSection(&m_cs);
+        *pbMute = m_bMuted;
+        LeaveCriticalSection(&m_cs);
+
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetVolumeStepInfo(UINT *pnStep, UINT *pnStepCount)
+    {
+        EnterCriticalSection(&m_cs);
+        *pnStep = (UINT)(m_fLevel * 50.0f + 0.5f);
+        *pnStepCount = 51;
+        LeaveCriticalSection(&m_cs);
+
+        return S_OK;
+    }
+
+    IFACEMETHODIMP VolumeStepUp(LPCGUID pguidEventContext)
+    {
+        return SetMasterVolumeLevelScalar(std::min(1.0f, m_fLevel + 0.02f), pguidEventContext);
+    }
+
+    IFACEMETHODIMP VolumeStepDown(LPCGUID pguidEventContext)
+    {
+        return SetMasterVolumeLevelScalar(std::max(0.0f, m_fLevel - 0.02f), pguidEventContext);
+    }
+
+    IFACEMETHODIMP GetChannelCount(UINT *pnChannelCount) { *pnChannelCount = 1; return S_OK; }
+    IFACEMETHODIMP SetMasterVolumeLevel(float fLevelDB, LPCGUID pguidEventContext) { return E_NOTIMPL; }
+    IFACEMETHODIMP GetMasterVolumeLevel(float *pfLevelDB) { return E_NOTIMPL; }
+    IFACEMETHODIMP SetChannelVolumeLevel(UINT nChannel, float fLevelDB, LPCGUID pguidEventContext) { return E_NOTIMPL; }
+    IFACEMETHODIMP SetChannelVolumeLevelScalar(UINT nChannel, float fLevel, LPCGUID pguidEventContext) { return E_NOTIMPL; }
+    IFACEMETHODIMP GetChannelVolumeLevel(UINT nChannel, float *pfLevelDB) { return E_NOTIMPL; }
+    IFACEMETHODIMP GetChannelVolumeLevelScalar(UINT nChannel, float *pfLevel) { return E_NOTIMPL; }
+    IFACEMETHODIMP QueryHardwareSupport(DWORD *pdwHardwareSupportMask) { *pdwHardwareSupportMask = 0; return S_OK; }
+    IFACEMETHODIMP GetVolumeRange(float *pflVolumeMindB, float *pflVolumeMaxdB, float *pflVolumeIncrementdB) { return E_NOTIMPL; }
+
+    IFACEMETHODIMP QueryInterface(const IID& iid, void** ppUnk)
+    {
+        if ((iid == __uuidof(IUnknown)) || (iid == __uuidof(IAudioEndpointVolume)))
+        {
+            *ppUnk = static_cast<IAudioEndpointVolume*>(this);
+            return S_OK;
+        }
+
+        *ppUnk = NULL;
+        return E_NOINTERFACE;
+    }
+
+    IFACEMETHODIMP_(ULONG) AddRef() { return 2; }
+    IFACEMETHODIMP_(ULONG) Release() { return 1; }
+};
+
+// The peak of a device. While it's sounding the level wanders with the
+// clock, worked out when it's asked for, so the simulation doesn't wake up
+// on its own.
+class SimMeter : public IAudioMeterInformation
+{
+private:
+    volatile LONG   m_bSounding;
+
+public:
+    SimMeter() : m_bSounding(FALSE)
+    {
+    }
+
+    void SetSounding(BOOL bSounding)
+    {
+        InterlockedExchange(&m_bSounding, bSounding);
+    }
+
+    IFACEMETHODIMP GetPeakValue(float *pfPeak)
+    {
+        *pfPeak = 0.0f;
+
+        if (InterlockedCompareExchange(&m_bSounding, 0, 0))
+            *pfPeak = 0.2f + 0.6f * (float)(GetTickCount64() % 1000) / 1000.0f;
+
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetMeteringChannelCount(UINT *pnChannelCount) { *pnChannelCount = 1; return S_OK; }
+    IFACEMETHODIMP GetChannelsPeakValues(UINT32 u32ChannelCount, float *afPeakValues) { return u32ChannelCount == 1 ? GetPeakValue(afPeakValues) : E_INVALIDARG; }
+    IFACEMETHODIMP QueryHardwareSupport(DWORD *pdwHardwareSupportMask) { *pdwHardwareSupportMask = 0; return S_OK; }
+
+    IFACEMETHODIMP QueryInterface(const IID& iid, void** ppUnk)
+    {
+        if ((iid == __uuidof(IUnknown)) || (iid == __uuidof(IAudioMeterInformation)))
+        {
+            *ppUnk = static_cast<IAudioMeterInformation*>(this);
+            return S_OK;
+        }
+
+        *ppUnk = NULL;
+        return E_NOINTERFACE;
+    }
+
+    IFACEMETHODIMP_(ULONG) AddRef() { return 2; }
+    IFACEMETHODIMP_(ULONG) Release() { return 1; }
+};
+
+// The one audio session of a device, along with the session manager and
+// enumerator that hand it out. No other session ever shows up.
+class SimSession : public IAudioSessionControl, public IAudioSessionEnumerator, public IAudioSessionManager2
+{
+private:
+    CRITICAL_SECTION        m_cs;
+    IAudioSessionEvents*    m_pEvents;
+    AudioSessionState       m_state;
+
+public:
+    SimSession() : m_pEvents(NULL), m_state(AudioSessionStateInactive)
+    {
+        InitializeCriticalSection(&m_cs);
+    }
+
+    ~SimSession()
+    {
+        DeleteCriticalSection(&m_cs);
+    }
+
+    BOOL HasEvents()
+    {
+        EnterCriticalSection(&m_cs);
+        BOOL bEvents = m_pEvents != NULL;
+        LeaveCriticalSection(&m_cs);
+
+        return bEvents;
+    }
+
+    // The event is sent with the lock held, as in SimVolume.
+    void SetState(AudioSessionState state)
+    {
+        EnterCriticalSection(&m_cs);
+        m_state = state;
+
+        if (m_pEvents != NULL)
+            m_pEvents->OnStateChanged(state);
+
+        LeaveCriticalSection(&m_cs);
+    }
+
+    IFACEMETHODIMP GetState(AudioSessionState *pRetVal)
+    {
+        EnterCriticalSection(&m_cs);
+        *pRetVal = m_state;
+        LeaveCriticalSection(&m_cs);
+
+        return S_OK;
+    }
+
+    IFACEMETHODIMP RegisterAudioSessionNotification(IAudioSessionEvents *NewNotifications)
+    {
+        EnterCriticalSection(&m_cs);
+        HRESULT hr = m_pEvents == NULL ? S_OK : E_OUTOFMEMORY;
+
+        if (SUCCEEDED(hr))
+            m_pEvents = NewNotifications;
+
+        LeaveCriticalSection(&m_cs);
+        return hr;
+    }
+
+    IFACEMETHODIMP UnregisterAudioSessionNotification(IAudioSessionEvents *NewNotifications)
+    {
+        EnterCriticalSection(&m_cs);
+        HRESULT hr = m_pEvents == NewNotifications ? S_OK : E_NOTFOUND;
+
+        if (SUCCEEDED(hr))
+            m_pEvents = NULL;
+
+        LeaveCriticalSection(&m_cs);
+        return hr;
+    }
+
+    IFACEMETHODIMP GetDisplayName(LPWSTR *pRetVal) { return E_NOTIMPL; }
+    IFACEMETHODIMP SetDisplayName(LPCWSTR Value, LPCGUID EventContext) { return E_NOTIMPL; }
+    IFACEMETHODIMP GetIconPath(LPWSTR *pRetVal) { return E_NOTIMPL; }
+    IFACEMETHODIMP SetIconPath(LPCWSTR Value, LPCGUID EventContext) { return E_NOTIMPL; }
+    IFACEMETHODIMP GetGroupingParam(GUID *pRetVal) { return E_NOTIMPL; }
+    IFACEMETHODIMP SetGroupingParam(LPCGUID Override, LPCGUID EventContext) { return E_NOTIMPL; }
+
+    IFACEMETHODIMP GetCount(int *SessionCount) { *SessionCount = 1; return S_OK; }
+
+    IFACEMETHODIMP GetSession(int SessionCount, IAudioSessionControl **Session)
+    {
+        if (SessionCount != 0)
+            return E_INVALIDARG;
+
+        *Session = static_cast<IAudioSessionControl*>(this);
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetSessionEnumerator(IAudioSessionEnumerator **SessionEnum)
+    {
+        *SessionEnum = static_cast<IAudioSessionEnumerator*>(this);
+        return S_OK;
+    }
+
+    IFACEMETHODIMP RegisterSessionNotification(IAudioSessionNotification *SessionNotification) { return S_OK; }
+    IFACEMETHODIMP UnregisterSessionNotification(IAudioSessionNotification *SessionNotification) { return S_OK; }
+    IFACEMETHODIMP GetAudioSessionControl(LPCGUID AudioSessionGuid, DWORD StreamFlags, IAudioSessionControl **SessionControl) { return E_NOTIMPL; }
+    IFACEMETHODIMP GetSimpleAudioVolume(LPCGUID AudioSessionGuid, DWORD StreamFlags, ISimpleAudioVolume **AudioVolume) { return E_NOTIMPL; }
+    IFACEMETHODIMP RegisterDuckNotification(LPCWSTR sessionID, IAudioVolumeDuckNotification *duckNotification) { return E_NOTIMPL; }
+    IFACEMETHODIMP UnregisterDuckNotification(IAudioVolumeDuckNotification *duckNotification) { return E_NOTIMPL; }
+
+    IFACEMETHODIMP QueryInterface(const IID& iid, void** ppUnk)
+    {
+        if ((iid == __uuidof(IUnknown)) || (iid == __uuidof(IAudioSessionControl)))
+        {
+            *ppUnk = static_cast<IAudioSessionControl*>(this);
+        }
+        else if (iid == __uuidof(IAudioSessionManager2))
+        {
+            *ppUnk = static_cast<IAudioSessionManager2*>(this);
+        }
+        else
+        {
+            *ppUnk = NULL;
+            return E_NOINTERFACE;
+        }
+
+        return S_OK;
+    }
+
+    IFACEMETHODIMP_(ULONG) AddRef() { return 2; }
+    IFACEMETHODIMP_(ULONG) Release() { return 1; }
+};
+
+class SimDevice : public IMMDevice, public IMMEndpoint
+{
+private:
+    WCHAR       m_szId[16];
+    SimVolume   m_volume;
+    SimMeter    m_meter;
+    SimSession  m_session;
+
+public:
+    void SetId(LPCWSTR pwstrId)
+    {
+        wcscpy_s(m_szId, pwstrId);
+    }
+
+    LPCWSTR GetIdString()
+    {
+        return m_szId;
+    }
+
+    SimVolume* GetVolume()
+    {
+        return &m_volume;
+    }
+
+    SimMeter* GetMeter()
+    {
+        return &m_meter;
+    }
+
+    SimSession* GetSession()
+    {
+        return &m_session;
+    }
+
+    IFACEMETHODIMP Activate(REFIID iid, DWORD dwClsCtx, PROPVARIANT *pActivationParams, void **ppInterface)
+    {
+        if (iid == __uuidof(IAudioMeterInformation))
+            return m_meter.QueryInterface(iid, ppInterface);
+
+        if (iid == __uuidof(IAudioSessionManager2))
+            return m_session.QueryInterface(iid, ppInterface);
+
+        return m_volume.QueryInterface(iid, ppInterface);
+    }
+
+    IFACEMETHODIMP GetId(LPWSTR *ppstrId)
+    {
+        size_t cb = (wcslen(m_szId) + 1) * sizeof(WCHAR);
+        *ppstrId = (LPWSTR)CoTaskMemAlloc(cb);
+
+        if (*ppstrId == NULL)
+            return E_OUTOFMEMORY;
+
+        memcpy(*ppstrId, m_szId, cb);
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetState(DWORD *pdwState) { *pdwState = DEVICE_STATE_ACTIVE; return S_OK; }
+    IFACEMETHODIMP GetDataFlow(EDataFlow *pDataFlow) { *pDataFlow = eRender; return S_OK; }
+    IFACEMETHODIMP OpenPropertyStore(DWORD stgmAccess, IPropertyStore **ppProperties) { return E_NOTIMPL; }
+
+    IFACEMETHODIMP QueryInterface(const IID& iid, void** ppUnk)
+    {
+        if ((iid == __uuidof(IUnknown)) || (iid == __uuidof(IMMDevice)))
+        {
+            *ppUnk = static_cast<IMMDevice*>(this);
+        }
+        else if (iid == __uuidof(IMMEndpoint))
+        {
+            *ppUnk = static_cast<IMMEndpoint*>(this);
+        }
+        else
+        {
+            *ppUnk = NULL;
+            return E_NOINTERFACE;
+        }
+
+        return S_OK;
+    }
+
+    IFACEMETHODIMP_(ULONG) AddRef() { return 2; }
+    IFACEMETHODIMP_(ULONG) Release() { return 1; }
+};
+
+class SimAudio : public IMMDeviceEnumerator, public IMMDeviceCollection
+{
+private:
+    SimDevice                   m_devices[SIM_DEVICES];
+    IMMNotificationClient*      m_pClient;
+    volatile LONG               m_iDefault;
+
+public:
+    SimAudio() : m_pClient(NULL), m_iDefault(0)
+    {
+        m_devices[0].SetId(L"sim.speakers");
+        m_devices[1].SetId(L"sim.headset");
+    }
+
+    SimDevice* GetDefaultDevice()
+    {
+        return &m_devices[InterlockedCompareExchange(&m_iDefault, 0, 0)];
+    }
+
+    SimVolume* GetDefaultVolume()
+    {
+        return GetDefaultDevice()->GetVolume();
+    }
+
+    // Switches the default device and tells the client for every role, like
+    // the real enumerator does.
+    void FlipDefault()
+    {
+        LONG iDefault = (InterlockedCompareExchange(&m_iDefault, 0, 0) + 1) % SIM_DEVICES;
+        InterlockedExchange(&m_iDefault, iDefault);
+
+        if (m_pClient != NULL)
+        {
+            m_pClient->OnDefaultDeviceChanged(eRender, eConsole, m_devices[iDefault].GetIdString());
+            m_pClient->OnDefaultDeviceChanged(eRender, eMultimedia, m_devices[iDefault].GetIdString());
+            m_pClient->OnDefaultDeviceChanged(eRender, eCommunications, m_devices[iDefault].GetIdString());
+        }
+    }
+
+    IFACEMETHODIMP EnumAudioEndpoints(EDataFlow dataFlow, DWORD dwStateMask, IMMDeviceCollection **ppDevices)
+    {
+        *ppDevices = static_cast<IMMDeviceCollection*>(this);
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetDefaultAudioEndpoint(EDataFlow dataFlow, ERole role, IMMDevice **ppEndpoint)
+    {
+        *ppEndpoint = &m_devices[InterlockedCompareExchange(&m_iDefault, 0, 0)];
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetDevice(LPCWSTR pwstrId, IMMDevice **ppDevice)
+    {
+        for (int i = 0; i < SIM_DEVICES; i++)
+        {
+            if (wcscmp(m_devices[i].GetIdString(), pwstrId) == 0)
+            {
+                *ppDevice = &m_devices[i];
+                return S_OK;
+            }
+        }
+
+        *ppDevice = NULL;
+        return E_NOTFOUND;
+    }
+
+    IFACEMETHODIMP RegisterEndpointNotificationCallback(IMMNotificationClient *pClient)
+    {
+        m_pClient = pClient;
+        return S_OK;
+    }
+
+    IFACEMETHODIMP UnregisterEndpointNotificationCallback(IMMNotificationClient *pClient)
+    {
+        m_pClient = NULL;
+        return S_OK;
+    }
+
+    IFACEMETHODIMP GetCount(UINT *pcDevices)
+    {
+        *pcDevices = SIM_DEVICES;
+        return S_OK;
+    }
+
+    IFACEMETHODIMP Item(UINT nDevice, IMMDevice **ppDevice)
+    {
+        if (nDevice >= SIM_DEVICES)
+            return E_INVALIDARG;
+
+        *ppDevice = &m_devices[nDevice];
+        return S_OK;
+    }
+
+    IFACEMETHODIMP QueryInterface(const IID& iid, void** ppUnk)
+    {
+        if ((iid == __uuidof(IUnknown)) || (iid == __uuidof(IMMDeviceEnumerator)))
+        {
+            *ppUnk = static_cast<IMMDeviceEnumerator*>(this);
+            return S_OK;
+        }
+
+        *ppUnk = NULL;
+        return E_NOINTERFACE;
+    }
+
+    IFACEMETHODIMP_(ULONG) AddRef() { return 2; }
+    IFACEMETHODIMP_(ULONG) Release() { return 1; }
+};
+
+static SimAudio *storm_audio = NULL;
+static LONGLONG *storm_times = NULL;        // QPC at each change, then its latency
+static volatile LONG storm_sent = 0;
+static LONG storm_served = 0;
+static LONGLONG storm_last_update = 0;
+
+// Stands in for Shell_NotifyIcon. An update covers every change sent before
+// it, so all of them get their latency filled in here.
+BOOL WINAPI RecordNotifyIcon(DWORD dwMessage, PNOTIFYICONDATA pData)
+{
+    if (dwMessage != NIM_MODIFY)
+        return TRUE;
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    LONG cSent = InterlockedCompareExchange(&storm_sent, 0, 0);
+
+    for (; storm_served < cSent; storm_served++)
+        storm_times[storm_served] = now.QuadPart - storm_times[storm_served];
+
+    storm_last_update = now.QuadPart;
+    return TRUE;
+}
+
+DWORD WINAPI StormThread(LPVOID pParam)
+{
+    HWND hWnd = (HWND)pParam;
+    BOOL bMuted = FALSE;
+
+    for (LONG i = 0; i < storm_config.cNotifications; i++)
+    {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        storm_times[i] = now.QuadPart;
+
+        if (storm_config.nFlapEvery > 0 && i % storm_config.nFlapEvery == storm_config.nFlapEvery - 1)
+        {
+            storm_audio->FlipDefault();
+        }
+        else if (storm_config.nMuteEvery > 0 && i % storm_config.nMuteEvery == storm_config.nMuteEvery - 1)
+        {
+            bMuted = !bMuted;
+            storm_audio->GetDefaultVolume()->SetMute(bMuted, NULL);
+        }
+        else
+        {
+            storm_audio->GetDefaultVolume()->SetMasterVolumeLevelScalar((float)(i % 101) / 100.0f, NULL);
+        }
+
+        InterlockedExchange(&storm_sent, i + 1);
+    }
+
+    // Lands behind whatever the storm left in the queue.
+    PostMessage(hWnd, WM_CLOSE, 0, 0);
+    return 0;
+}
+
+ULONGLONG ProcessCpuTime()
+{
+    FILETIME ftCreation, ftExit, ftKernel, ftUser;
+    GetProcessTimes(GetCurrentProcess(), &ftCreation, &ftExit, &ftKernel, &ftUser);
+
+    return ((ULONGLONG)ftKernel.dwHighDateTime << 32 | ftKernel.dwLowDateTime) +
+        ((ULONGLONG)ftUser.dwHighDateTime << 32 | ftUser.dwLowDateTime);
+}
+
+// Prints the "name value" lines and writes them to the results file.
+int WriteResults(const wchar_t *pszResults, const std::string &text)
+{
+    fputs(text.c_str(), stdout);
+
+    HANDLE hFile = CreateFile(pszResults, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (hFile == INVALID_HANDLE_VALUE)
+        return 1;
+
+    DWORD cbWritten = 0;
+    WriteFile(hFile, text.data(), (DWORD)text.size(), &cbWritten, NULL);
+    CloseHandle(hFile);
+
+    return 0;
+}
+
+int WriteStormResults(const wchar_t *pszResults, ULONGLONG cpu100ns, int finalLevel)
+{
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+
+    // The last changes may have been shown before the storm thread counted
+    // them as sent. If the icon ended up right, the last update covered them.
+    if (shown_level == finalLevel)
+    {
+        for (; storm_served < storm_config.cNotifications; storm_served++)
+            storm_times[storm_served] = std::max<LONGLONG>(0, storm_last_update - storm_times[storm_served]);
+    }
+
+    LONG cServed = storm_served;
+    std::sort(storm_times, storm_times + cServed);
+
+    const double usPerTick = 1e6 / (double)freq.QuadPart;
+    const double pcts[] = { 50, 90, 99, 100 };
+    const char* const names[] = { "storm_p50_us", "storm_p90_us", "storm_p99_us", "storm_max_us" };
+
+    std::string text;
+    char line[128];
+
+    for (int i = 0; i < _countof(pcts); i++)
+    {
+        LONG index = cServed > 0 ? std::min<LONG>(cServed - 1, (LONG)(cServed * pcts[i] / 100.0)) : 0;
+        sprintf_s(line, "%s %.1f\n", names[i], cServed > 0 ? storm_times[index] * usPerTick : 0.0);
+        text += line;
+    }
+
+    LONG cNotifications = vol->GetNotificationCount();
+
+    sprintf_s(line, "storm_notifications %ld\n", cNotifications);
+    text += line;
+    sprintf_s(line, "storm_icon_updates %ld\n", icon_updates);
+    text += line;
+    sprintf_s(line, "storm_unchanged %ld\n", icon_updates_skipped);
+    text += line;
+    sprintf_s(line, "storm_coalesced %ld\n", std::max<LONG>(0, cNotifications - icon_updates - icon_updates_skipped));
+    text += line;
+    sprintf_s(line, "storm_dropped %ld\n", storm_config.cNotifications - cServed);
+    text += line;
+    sprintf_s(line, "storm_cpu_ms_per_1000 %.3f\n", cNotifications > 0 ? cpu100ns / 1e4 * 1000.0 / cNotifications : 0.0);
+    text += line;
+
+    // The icon cache is bounded, so the end of the storm shows its peak.
+    sprintf_s(line, "startup_ms %.3f\n", startup_ms);
+    text += line;
+    sprintf_s(line, "startup_gdi_objects %lu\n", (unsigned long)startup_gdi_objects);
+    text += line;
+    sprintf_s(line, "startup_user_objects %lu\n", (unsigned long)startup_user_objects);
+    text += line;
+    sprintf_s(line, "storm_gdi_objects %lu\n", (unsigned long)GetGuiResources(GetCurrentProcess(), GR_GDIOBJECTS));
+    text += line;
+    sprintf_s(line, "storm_user_objects %lu\n", (unsigned long)GetGuiResources(GetCurrentProcess(), GR_USEROBJECTS));
+    text += line;
+
+    return WriteResults(pszResults, text);
+}
+
+// Optional live meter (--meter): the peak of the default endpoint, polled
+// from IAudioMeterInformation on a timer that adapts to what's playing.
+//
+//  - METER_ACTIVE: sound is coming out, the meter is polled at 30 Hz.
+//  - METER_IDLE: a session is playing but has been silent for a moment
+//    (a paused video keeps its stream open), polled once a second.
+//  - METER_STOPPED: nothing is playing or the session is locked, no timer
+//    at all. Audio session events (a session starting, stopping or being
+//    created) and unlocking wake it up again.
+//
+// The icon only changes when the quantized peak does.
+
+#define METER_ACTIVE_MS     33
+#define METER_IDLE_MS       1000
+#define METER_SILENT_TICKS  15
+
+enum
+{
+    METER_STOPPED,
+    METER_IDLE,
+    METER_ACTIVE,
+    METER_STATES
+};
+
+class PeakMeter;
+
+// A session on the metered device, registered for its events by the UI
+// thread. The events come on other threads: changes wake the meter, and a
+// session that expires or is disconnected is posted back to be dropped.
+class MeterSession : public IAudioSessionEvents
+{
+private:
+    PeakMeter*                      m_pMeter;
+    CComPtr<IAudioSessionControl>   m_spSession;
+    long                            m_cRef;
+
+    ~MeterSession();
+
+public:
+    MeterSession(PeakMeter *pMeter, IAudioSessionControl *pSession);
+
+    IAudioSessionControl* GetSession()
+    {
+        return m_spSession;
+    }
+
+    IFACEMETHODIMP OnStateChanged(AudioSessionState NewState);
+    IFACEMETHODIMP OnSessionDisconnected(AudioSessionDisconnectReason DisconnectReason);
+
+    IFACEMETHODIMP OnDisplayNameChanged(LPCWSTR NewDisplayName, LPCGUID EventContext) { return S_OK; }
+    IFACEMETHODIMP OnIconPathChanged(LPCWSTR NewIconPath, LPCGUID EventContext) { return S_OK; }
+    IFACEMETHODIMP OnSimpleVolumeChanged(float NewVolume, BOOL NewMute, LPCGUID EventContext) { return S_OK; }
+    IFACEMETHODIMP OnChannelVolumeChanged(DWORD ChannelCount, float NewChannelVolumeArray[], DWORD ChangedChannel, LPCGUID EventContext) { return S_OK; }
+    IFACEMETHODIMP OnGroupingParamChanged(LPCGUID NewGroupingParam, LPCGUID EventContext) { return S_OK; }
+
+    IFACEMETHODIMP QueryInterface(const IID& iid, void** ppUnk)
+    {
+        if ((iid == __uuidof(IUnknown)) || (iid == __uuidof(IAudioSessionEvents)))
+        {
+            *ppUnk = static_cast<IAudioSessionEvents*>(this);
+        }
+        else
+        {
+            *ppUnk = NULL;
+            return E_NOINTERFACE;
+        }
+
+        AddRef();
+        return S_OK;
+    }
+
+    IFACEMETHODIMP_(ULONG) AddRef()
+    {
+        return InterlockedIncrement(&m_cRef);
+    }
+
+    IFACEMETHODIMP_(ULONG) Release()
+    {
+        long lRef = InterlockedDecrement(&m_cRef);
+
+        if (lRef == 0)
+            delete this;
+
+        return lRef;
+    }
+};
+
+// Meters one device and watches its audio sessions. New sessions are only
+// announced to the multithreaded apartment, so the session manager lives on
+// a watcher thread of its own that enumerates the sessions, registers for
+// new ones and waits to be stopped. It only posts the sessions to the UI
+// thread, which owns the rest; each attach is a new generation, and
+// sessions still queued from an earlier one are let go.
+class PeakMeter : public IAudioSessionNotification
+{
+private:
+    HWND                                m_hWnd;
+    CComPtr<IAudioMeterInformation>     m_spMeter;
+    CComPtr<IMMDevice>                  m_spWatchedDevice;
+    HANDLE                              m_hWatcher;
+    HANDLE                              m_hStopWatching;
+    std::vector<MeterSession*>          m_sessions;
+    volatile LONG                       m_nGeneration;
+    volatile LONG                       m_bWakePosted;
+    long                                m_cRef;
+
+    ~PeakMeter()
+    {
+        CloseHandle(m_hStopWatching);
+    }
+
+    static DWORD WINAPI WatcherThread(LPVOID pParam)
+    {
+        return ((PeakMeter*)pParam)->WatchSessions();
+    }
+
+    DWORD WatchSessions()
+    {
+        if (FAILED(CoInitializeEx(NULL, COINIT_MULTITHREADED)))
+            return 1;
+
+        {
+            LONG generation = InterlockedCompareExchange(&m_nGeneration, 0, 0);
+            CComPtr<IAudioSessionManager2> spSessions;
+
+            if (SUCCEEDED(m_spWatchedDevice->Activate(__uuidof(IAudioSessionManager2), CLSCTX_INPROC_SERVER, NULL, (void**)&spSessions)))
+            {
+                // Session notifications only start once the sessions have
+                // been enumerated.
+                CComPtr<IAudioSessionEnumerator> spEnumerator;
+                int cSessions = 0;
+
+                if (SUCCEEDED(spSessions->GetSessionEnumerator(&spEnumerator)) && SUCCEEDED(spEnumerator->GetCount(&cSessions)))
+                {
+                    for (int i = 0; i < cSessions; i++)
+                    {
+                        CComPtr<IAudioSessionControl> spSession;
+
+                        if (SUCCEEDED(spEnumerator->GetSession(i, &spSession)))
+                            PostSession(spSession, generation);
+                    }
+                }
+
+                BOOL bRegistered = SUCCEEDED(spSessions->RegisterSessionNotification(this));
+
+                WaitForSingleObject(m_hStopWatching, INFINITE);
+
+                if (bRegistered)
+                    spSessions->UnregisterSessionNotification(this);
+            }
+        }
+
+        CoUninitialize();
+        return 0;
+    }
+
+    void PostSession(IAudioSessionControl *pSession, LONG generation)
+    {
+        pSession->AddRef();
+
+        if (!PostMessage(m_hWnd, WM_METERSESSION, (WPARAM)generation, (LPARAM)pSession))
+            pSession->Release();
+    }
+
+public:
+    PeakMeter(HWND hWnd) :
+        m_hWnd(hWnd),
+        m_hWatcher(NULL),
+        m_hStopWatching(CreateEvent(NULL, FALSE, FALSE, NULL)),
+        m_nGeneration(0),
+        m_bWakePosted(FALSE),
+        m_cRef(1)
+    {
+    }
+
+    // Replaces the metered device; NULL only detaches.
+    HRESULT Attach(IMMDevice *pDevice)
+    {
+        TraceScope scope("PeakMeter::Attach");
+
+        Detach();
+
+        if (pDevice == NULL)
+            return E_FAIL;
+
+        HRESULT hr = pDevice->Activate(__uuidof(IAudioMeterInformation), CLSCTX_INPROC_SERVER, NULL, (void**)&m_spMeter);
 
-    HRESULT Initialize()
-    {
-        HRESULT hr = m_spEnumerator.CoCreateInstance(__uuidof(MMDeviceEnumerator));
+        if (SUCCEEDED(hr) && m_hStopWatching == NULL)
+            hr = E_OUTOFMEMORY;
 
         if (SUCCEEDED(hr))
         {
-            hr = m_spEnumerator->RegisterEndpointNotificationCallback(this);
+            m_spWatchedDevice = pDevice;
+            m_hWatcher = CreateThread(NULL, 0, WatcherThread, this, 0, NULL);
 
-            if (SUCCEEDED(hr))
-                hr = AttachToDefaultEndpoint();
+            if (m_hWatcher == NULL)
+                hr = HRESULT_FROM_WIN32(GetLastError());
         }
 
+        if (FAILED(hr))
+            Detach();
+
         return hr;
     }
 
-    void Dispose()
+    void Detach()
     {
-        DetachFromEndpoint();
+        if (m_hWatcher != NULL)
+        {
+            SetEvent(m_hStopWatching);
+            WaitForSingleObject(m_hWatcher, INFINITE);
+            CloseHandle(m_hWatcher);
+            m_hWatcher = NULL;
+        }
 
-        if (m_bRegisteredForEndpointNotifications)
+        InterlockedIncrement(&m_nGeneration);
+
+        for (size_t i = 0; i < m_sessions.size(); i++)
         {
-            m_spEnumerator->UnregisterEndpointNotificationCallback(this);
-            m_bRegisteredForEndpointNotifications = FALSE;
+            m_sessions[i]->GetSession()->UnregisterAudioSessionNotification(m_sessions[i]);
+            m_sessions[i]->Release();
         }
+
+        m_sessions.clear();
+
+        m_spWatchedDevice.Release();
+        m_spMeter.Release();
     }
 
-    void SetWindow(HWND hWnd)
+    // A session posted by the watcher; UI thread only.
+    void WatchSession(IAudioSessionControl *pSession, LONG generation)
     {
-        m_hWnd = hWnd;
+        if (generation != m_nGeneration)
+            return;
+
+        MeterSession *pMeterSession = new MeterSession(this, pSession);
+
+        if (SUCCEEDED(pSession->RegisterAudioSessionNotification(pMeterSession)))
+            m_sessions.push_back(pMeterSession);
+        else
+            pMeterSession->Release();
     }
 
-    HWND GetWindow()
+    // A session that expired or was disconnected; UI thread only. It may
+    // have been dropped already by a detach or an earlier event.
+    void DropSession(MeterSession *pMeterSession)
     {
-        return m_hWnd;
+        for (size_t i = 0; i < m_sessions.size(); i++)
+        {
+            if (m_sessions[i] == pMeterSession)
+            {
+                pMeterSession->GetSession()->UnregisterAudioSessionNotification(pMeterSession);
+                pMeterSession->Release();
+                m_sessions.erase(m_sessions.begin() + i);
+                break;
+            }
+        }
     }
 
-    HRESULT GetLevelInfo(VOLUME_INFO* pInfo)
+    void PostSessionEnd(MeterSession *pMeterSession)
     {
-        HRESULT hr = E_FAIL;
+        pMeterSession->AddRef();
 
-        m_csEndpoint.Enter();
+        if (!PostMessage(m_hWnd, WM_METERSESSIONEND, 0, (LPARAM)pMeterSession))
+            pMeterSession->Release();
+    }
 
-        if (m_spVolumeControl != NULL)
+    void PostWake()
+    {
+        if (InterlockedExchange(&m_bWakePosted, TRUE) == FALSE)
         {
-            hr = m_spVolumeControl->GetMute(&pInfo->bMuted);
+            if (!PostMessage(m_hWnd, WM_METERWAKE, 0, 0))
+                InterlockedExchange(&m_bWakePosted, FALSE);
+        }
+    }
 
-            if (SUCCEEDED(hr))
-                hr = m_spVolumeControl->GetVolumeStepInfo(&pInfo->nStep, &pInfo->cSteps);
+    // Whether any session on the device is playing, silent or not.
+    BOOL IsPlaying()
+    {
+        for (size_t i = 0; i < m_sessions.size(); i++)
+        {
+            AudioSessionState state = AudioSessionStateInactive;
+
+            if (SUCCEEDED(m_sessions[i]->GetSession()->GetState(&state)) && state == AudioSessionStateActive)
+                return TRUE;
         }
 
-        m_csEndpoint.Leave();
-        return hr;
+        return FALSE;
+    }
+
+    HRESULT GetPeak(float *pfPeak)
+    {
+        if (m_spMeter == NULL)
+            return E_FAIL;
+
+        return m_spMeter->GetPeakValue(pfPeak);
+    }
+
+    // Called by the UI thread when it takes a WM_METERWAKE.
+    void AcknowledgeWake()
+    {
+        InterlockedExchange(&m_bWakePosted, FALSE);
+    }
+
+    // New sessions are registered for events by the UI thread; the
+    // callback isn't allowed to.
+    IFACEMETHODIMP OnSessionCreated(IAudioSessionControl *pNewSession)
+    {
+        PostSession(pNewSession, InterlockedCompareExchange(&m_nGeneration, 0, 0));
+        return S_OK;
     }
 
-    void ChangeEndpoint()
+    IFACEMETHODIMP QueryInterface(const IID& iid, void** ppUnk)
     {
-        DetachFromEndpoint();
-        AttachToDefaultEndpoint();
+        if ((iid == __uuidof(IUnknown)) || (iid == __uuidof(IAudioSessionNotification)))
+        {
+            *ppUnk = static_cast<IAudioSessionNotification*>(this);
+        }
+        else
+        {
+            *ppUnk = NULL;
+            return E_NOINTERFACE;
+        }
+
+        AddRef();
+        return S_OK;
     }
 
     IFACEMETHODIMP_(ULONG) AddRef()
@@ -208,119 +2461,230 @@ public:
     }
 };
 
-static const char numbers[][6 * 10 - 1] = {
-    "0000     0  0000  0000  0  0  0000  0     0000  0000  0000",
-    "0  0     0     0     0  0  0  0     0        0  0  0  0  0",
-    "0  0     0     0     0  0  0  0     0        0  0  0  0  0",
-    "0  0     0     0     0  0  0  0     0        0  0  0  0  0",
-    "0  0     0  0000  0000  0000  0000  0000     0  0000  0000",
-    "0  0     0  0        0     0     0  0  0     0  0  0     0",
-    "0  0     0  0        0     0     0  0  0     0  0  0     0",
-    "0  0     0  0        0     0     0  0  0     0  0  0     0",
-    "0000     0  0000  0000     0  0000  0000     0  0000     0"
-};
+// Sessions keep the meter alive, since their events can still come in
+// after it dropped them.
+MeterSession::MeterSession(PeakMeter *pMeter, IAudioSessionControl *pSession) :
+    m_pMeter(pMeter),
+    m_spSession(pSession),
+    m_cRef(1)
+{
+    m_pMeter->AddRef();
+}
 
-static VolumeMonitor *vol = NULL;
-static HICON icons[102] = {};
-static DWORD fore = 0xFF000000;
-static DWORD back = 0x00000000;
+MeterSession::~MeterSession()
+{
+    m_pMeter->Release();
+}
+
+STDMETHODIMP MeterSession::OnStateChanged(AudioSessionState NewState)
+{
+    if (NewState == AudioSessionStateExpired)
+        m_pMeter->PostSessionEnd(this);
+    else
+        m_pMeter->PostWake();
+
+    return S_OK;
+}
+
+STDMETHODIMP MeterSession::OnSessionDisconnected(AudioSessionDisconnectReason DisconnectReason)
+{
+    m_pMeter->PostSessionEnd(this);
+    return S_OK;
+}
 
-void draw_number(DWORD *buffer, int x0, int n)
+static BOOL meter_enabled = FALSE;
+static PeakMeter *meter = NULL;
+static int meter_state = METER_STOPPED;
+static BOOL meter_locked = FALSE;
+static int meter_silent_ticks = 0;
+
+// Wakeups of the UI thread on the meter's account (timer ticks and session
+// events) and the wall and process CPU time spent in each state.
+static LONG meter_wakeups[METER_STATES];
+static ULONGLONG meter_ms[METER_STATES];
+static ULONGLONG meter_cpu[METER_STATES];
+static ULONGLONG meter_since_ms = 0;
+static ULONGLONG meter_since_cpu = 0;
+
+void AccountMeterState()
 {
-    const int d = 16;
-    const int y0 = 3;
-    const int sx0 = n * 6;
+    ULONGLONG tNow = GetTickCount64();
+    ULONGLONG cpuNow = ProcessCpuTime();
 
-    DWORD *p = &buffer[y0 * d + x0];
+    meter_ms[meter_state] += tNow - meter_since_ms;
+    meter_cpu[meter_state] += cpuNow - meter_since_cpu;
+    meter_since_ms = tNow;
+    meter_since_cpu = cpuNow;
+}
 
-    for (int y = 0; y < 9; y++)
-    {
-        for (int x = 0; x < 4; x++)
-            p[x] = (numbers[y][sx0 + x] == '0') ? fore : back;
+void SetMeterState(HWND hWnd, int state)
+{
+    if (state == meter_state)
+        return;
+
+    AccountMeterState();
+
+    meter_state = state;
+    meter_silent_ticks = 0;
+
+    if (state == METER_STOPPED)
+        KillTimer(hWnd, TIMER_METER);
+    else
+        SetTimer(hWnd, TIMER_METER, state == METER_ACTIVE ? METER_ACTIVE_MS : METER_IDLE_MS, NULL);
 
-        p += d;
+    if (state != METER_ACTIVE && meter_level != 0)
+    {
+        meter_level = 0;
+        UpdateNotificationIcon();
     }
 }
 
-void InitializeIcons()
+// Something may have started or stopped playing, or the lock changed. A
+// running meter finds out by itself.
+void WakeMeter(HWND hWnd)
 {
-    const int d = 16;
+    meter->AcknowledgeWake();
+    meter_wakeups[meter_state]++;
+
+    if (meter_locked)
+        SetMeterState(hWnd, METER_STOPPED);
+    else if (meter_state != METER_ACTIVE)
+        SetMeterState(hWnd, meter->IsPlaying() ? METER_ACTIVE : METER_STOPPED);
+}
 
-    BITMAPV5HEADER bi = {};
-    bi.bV5Size        = sizeof(BITMAPV5HEADER);
-    bi.bV5Width       = d;
-    bi.bV5Height      = -d;
-    bi.bV5Planes      = 1;
-    bi.bV5BitCount    = 32;
-    bi.bV5Compression = BI_BITFIELDS;
-    bi.bV5RedMask     = 0x00FF0000;
-    bi.bV5GreenMask   = 0x0000FF00;
-    bi.bV5BlueMask    = 0x000000FF;
-    bi.bV5AlphaMask   = 0xFF000000;
+void TickMeter(HWND hWnd)
+{
+    meter_wakeups[meter_state]++;
 
-    DWORD *buffer = 0;
-    HDC hdc = GetDC(NULL);
-    HBITMAP hBitmap = CreateDIBSection(hdc, (BITMAPINFO*)&bi, DIB_RGB_COLORS, (void**)&buffer, NULL, (DWORD)0);
-    HBITMAP hMask = CreateBitmap(d, d, 1, 1, NULL);
+    float fPeak = 0.0f;
+    int level = 0;
 
-    ReleaseDC(NULL, hdc);
+    if (shown_level != 101 && SUCCEEDED(meter->GetPeak(&fPeak)))
+        level = std::max(0, std::min(METER_STEPS, (int)(fPeak * METER_STEPS + 0.5f)));
 
-    ICONINFO ii = {};
-    ii.fIcon = TRUE;
-    ii.hbmMask = hMask;
-    ii.hbmColor = hBitmap;
+    if (level != 0)
+    {
+        meter_silent_ticks = 0;
+        SetMeterState(hWnd, METER_ACTIVE);
+    }
+    else if (meter_state == METER_ACTIVE && ++meter_silent_ticks >= METER_SILENT_TICKS)
+    {
+        SetMeterState(hWnd, meter->IsPlaying() ? METER_IDLE : METER_STOPPED);
+    }
 
-    for (int i = 0; i < 102; i++)
+    if (level != meter_level)
     {
-        for (int j = 0; j < d*d; j++)
-            buffer[j] = back;
+        meter_level = level;
+        UpdateNotificationIcon();
+    }
+}
 
-        if (i == 101)
-        {
-            // TODO: mute
-        }
-        else
-        {
-            draw_number(buffer, -1 + (4 + 1) * 2, i % 10);
+// Follows the default endpoint.
+void AttachMeter(HWND hWnd)
+{
+    CComPtr<IMMDevice> spDevice;
+    vol->GetDevice(&spDevice);
+
+    meter->Attach(spDevice);
+    WakeMeter(hWnd);
+}
 
-            if (i >= 10)
-                draw_number(buffer, -1 + (4 + 1) * 1, (i / 10) % 10);
+void StartMeter(HWND hWnd)
+{
+    meter = new PeakMeter(hWnd);
+    meter_since_ms = GetTickCount64();
+    meter_since_cpu = ProcessCpuTime();
 
-            if (i >= 100)
-                draw_number(buffer, -1 + (4 + 1) * 0, (i / 100) % 10);
-        }
+    WTSRegisterSessionNotification(hWnd, NOTIFY_FOR_THIS_SESSION);
+    AttachMeter(hWnd);
+}
 
-        icons[i] = CreateIconIndirect(&ii);
+void StopMeter(HWND hWnd)
+{
+    SetMeterState(hWnd, METER_STOPPED);
+    AccountMeterState();
+
+    WTSUnRegisterSessionNotification(hWnd);
+    meter->Detach();
+
+    // nothing posts them after the detach, but what the loop didn't get to
+    // still holds a reference
+    MSG msg;
+
+    while (PeekMessage(&msg, hWnd, WM_METERSESSION, WM_METERSESSIONEND, PM_REMOVE))
+    {
+        if (msg.message == WM_METERSESSION)
+            ((IAudioSessionControl*)msg.lParam)->Release();
+        else
+            ((MeterSession*)msg.lParam)->Release();
     }
 
-    DeleteObject(hMask);
-    DeleteObject(hBitmap);
+    meter->Release();
+    meter = NULL;
+
+    static const wchar_t *names[METER_STATES] = { L"stopped", L"idle", L"active" };
+
+    for (int i = 0; i < METER_STATES; i++)
+    {
+        double minutes = meter_ms[i] / 60000.0;
+
+        wchar_t szMeter[128];
+        swprintf(szMeter, 128, L"volumeicon: meter %ls %.1f min, %.1f wakeups/min, %.3f%% CPU\n", names[i], minutes,
+            minutes > 0 ? meter_wakeups[i] / minutes : 0.0,
+            meter_ms[i] > 0 ? meter_cpu[i] / 100.0 / meter_ms[i] : 0.0);
+
+        OutputDebugString(szMeter);
+    }
 }
 
-int GetVolumeLevel()
+static LONG meter_sim_phase_ms = 20000;
+
+// Plays, goes quiet and stops on the default device for a phase each
+// (--meter-sim). Sound only starts once the meter has registered for the
+// session's events, which it does shortly after attaching.
+DWORD WINAPI MeterSimThread(LPVOID pParam)
 {
-    VOLUME_INFO info = {0};
-    vol->GetLevelInfo(&info);
+    HWND hWnd = (HWND)pParam;
+    SimDevice *pDevice = storm_audio->GetDefaultDevice();
 
-    if (info.bMuted)
-        return 0;
+    for (int i = 0; i < 500 && !pDevice->GetSession()->HasEvents(); i++)
+        Sleep(10);
+
+    pDevice->GetMeter()->SetSounding(TRUE);
+    pDevice->GetSession()->SetState(AudioSessionStateActive);
+    Sleep(meter_sim_phase_ms);
+
+    pDevice->GetMeter()->SetSounding(FALSE);
+    Sleep(meter_sim_phase_ms);
 
-    return std::max<int>(0, std::min<int>(100, 100 * info.nStep / (info.cSteps - 1)));
+    pDevice->GetSession()->SetState(AudioSessionStateInactive);
+    Sleep(meter_sim_phase_ms);
+
+    PostMessage(hWnd, WM_CLOSE, 0, 0);
+    return 0;
 }
 
-void UpdateNotificationIcon()
+// Per meter state, once StopMeter has accounted for the last one.
+int WriteMeterResults(const wchar_t *pszResults)
 {
-    int level = GetVolumeLevel();
+    static const char *names[METER_STATES] = { "stopped", "idle", "active" };
 
-    NOTIFYICONDATA notif = { sizeof(notif) };
-    notif.hWnd = vol->GetWindow();
-    notif.uID = 1;
-    notif.uFlags = NIF_ICON | NIF_TIP;
-    notif.uVersion = NOTIFYICON_VERSION_4;
-    notif.hIcon = icons[level];
-    swprintf(notif.szTip, 64, L"Volumen: %d%%", level);
+    std::string text;
+    char line[128];
+
+    for (int i = 0; i < METER_STATES; i++)
+    {
+        double minutes = meter_ms[i] / 60000.0;
+
+        sprintf_s(line, "meter_%s_min %.3f\n", names[i], minutes);
+        text += line;
+        sprintf_s(line, "meter_%s_wakeups_per_min %.1f\n", names[i], minutes > 0 ? meter_wakeups[i] / minutes : 0.0);
+        text += line;
+        sprintf_s(line, "meter_%s_cpu_pct %.4f\n", names[i], meter_ms[i] > 0 ? meter_cpu[i] / 100.0 / meter_ms[i] : 0.0);
+        text += line;
+    }
 
-    Shell_NotifyIcon(NIM_MODIFY, &notif);
+    return WriteResults(pszResults, text);
 }
 
 LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
@@ -329,14 +2693,123 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
     {
         case WM_VOLUMECHANGE:
         {
+            vol->AcknowledgeChange();
+            control_info_valid = FALSE;
             UpdateNotificationIcon();
             return 0;
         }
 
         case WM_ENDPOINTCHANGE:
         {
-            vol->ChangeEndpoint();
+            LPWSTR pwstrId = (LPWSTR)lParam;
+
+            vol->ChangeEndpoint(pwstrId);
+            control_info_valid = FALSE;
             UpdateNotificationIcon();
+
+            if (meter != NULL)
+                AttachMeter(hWnd);
+
+            delete[] pwstrId;
+            return 0;
+        }
+
+        case WM_ENDPOINTSTATE:
+        {
+            LPWSTR pwstrId = (LPWSTR)lParam;
+
+            vol->RefreshEndpoint(pwstrId);
+
+            delete[] pwstrId;
+            return 0;
+        }
+
+        case WM_TIMER:
+        {
+            if (wParam == TIMER_TRIM_ENDPOINTS)
+                vol->TrimEndpoints();
+            else if (wParam == TIMER_FLUSH_WHEEL)
+                FlushWheel(hWnd);
+            else if (wParam == TIMER_METER && meter != NULL)
+                TickMeter(hWnd);
+
+            return 0;
+        }
+
+        case WM_METERWAKE:
+        {
+            if (meter != NULL)
+                WakeMeter(hWnd);
+
+            return 0;
+        }
+
+        case WM_METERSESSION:
+        {
+            IAudioSessionControl *pSession = (IAudioSessionControl*)lParam;
+
+            if (meter != NULL)
+            {
+                meter->WatchSession(pSession, (LONG)wParam);
+                WakeMeter(hWnd);
+            }
+
+            pSession->Release();
+            return 0;
+        }
+
+        case WM_METERSESSIONEND:
+        {
+            MeterSession *pMeterSession = (MeterSession*)lParam;
+
+            if (meter != NULL)
+            {
+                meter->DropSession(pMeterSession);
+                WakeMeter(hWnd);
+            }
+
+            pMeterSession->Release();
+            return 0;
+        }
+
+        case WM_WTSSESSION_CHANGE:
+        {
+            if (meter != NULL && (wParam == WTS_SESSION_LOCK || wParam == WTS_SESSION_UNLOCK))
+            {
+                meter_locked = wParam == WTS_SESSION_LOCK;
+                WakeMeter(hWnd);
+            }
+
+            return 0;
+        }
+
+        case WM_TRAYICON:
+        {
+            if (LOWORD(lParam) == WM_MOUSEMOVE)
+                TrackWheel(hWnd);
+            else if (LOWORD(lParam) == WM_LBUTTONUP)
+                ToggleMute();
+
+            return 0;
+        }
+
+        case WM_WHEELLEAVE:
+        {
+            UntrackWheel();
+            return 0;
+        }
+
+        case WM_WHEELSCROLL:
+        {
+            ScrollWheel(hWnd);
+            return 0;
+        }
+
+        case WM_SETTINGCHANGE:
+        {
+            if (lParam != 0 && wcscmp((const wchar_t*)lParam, L"ImmersiveColorSet") == 0 && UpdateThemeColors())
+                UpdateNotificationIcon(TRUE);
+
             return 0;
         }
 
@@ -345,6 +2818,14 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             return 1;
         }
 
+        case WM_ENDSESSION:
+        {
+            if (wParam)
+                WriteTrace();
+
+            return 0;
+        }
+
         case WM_DESTROY:
         {
             PostQuitMessage(0);
@@ -355,70 +2836,220 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
     return DefWindowProc(hWnd, message, wParam, lParam);
 }
 
-int wmain(int argc, wchar_t **argv)
+static HWND hWndIcon = NULL;
+static NOTIFYICONDATA notif = { sizeof(notif) };
+
+// Brings up the monitor, the hidden window and the notification icon on the
+// calling thread, whose message loop then drives them. COM must already be
+// initialized on it. Used by wmain and by the combined host (host.cxx).
+BOOL StartVolumeIcon(IMMDeviceEnumerator *pEnumerator)
 {
-    HRESULT hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
 
-    if (SUCCEEDED(hr))
+    vol = new (std::nothrow) VolumeMonitor();
+
+    if (vol == NULL)
+        return FALSE;
+
+    if (FAILED(vol->Initialize(pEnumerator)))
     {
-        vol = new (std::nothrow) VolumeMonitor();
+        vol->Dispose();
+        vol->Release();
+        vol = NULL;
+        return FALSE;
+    }
+
+    const wchar_t g_szWindowClass[] = L"volumeicon";
+    HINSTANCE hInstance = GetModuleHandle(NULL);
+
+    WNDCLASSEX wcex     = { sizeof(wcex) };
+    wcex.style          = 0;
+    wcex.lpfnWndProc    = WndProc;
+    wcex.hInstance      = hInstance;
+    wcex.hCursor        = LoadCursor(NULL, IDC_ARROW);
+    wcex.hbrBackground  = NULL;
+    wcex.lpszClassName  = g_szWindowClass;
+
+    RegisterClassEx(&wcex);
+
+    hWndIcon = CreateWindowEx(WS_EX_NOACTIVATE, g_szWindowClass, NULL, 0, 0, 0, 0, 0, NULL, NULL, hInstance, NULL);
+
+    if (!hWndIcon)
+    {
+        vol->Dispose();
+        vol->Release();
+        vol = NULL;
+        return FALSE;
+    }
+
+    UpdateThemeColors();
+    icons.Initialize(GetSystemMetrics(SM_CXSMICON));
+
+    int level = vol->GetLevel();
+    shown_level = level;
+
+    notif.hWnd = hWndIcon;
+    notif.uID = 1;
+    notif.uFlags = NIF_ICON | NIF_TIP | NIF_MESSAGE;
+    notif.uCallbackMessage = WM_TRAYICON;
+    notif.uVersion = NOTIFYICON_VERSION_4;
+    notif.hIcon = icons.GetIcon(level);
+    FormatTip(notif.szTip, level);
+
+    {
+        TraceScope scope("Shell_NotifyIcon");
+        notify_icon(NIM_ADD, &notif);
+    }
+
+    vol->SetWindow(hWndIcon);
+    SetTimer(hWndIcon, TIMER_TRIM_ENDPOINTS, 60 * 1000, NULL);
+
+    if (meter_enabled)
+        StartMeter(hWndIcon);
+
+    LARGE_INTEGER now, freq;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&freq);
+
+    startup_ms = (now.QuadPart - start.QuadPart) * 1000.0 / freq.QuadPart;
+    startup_gdi_objects = GetGuiResources(GetCurrentProcess(), GR_GDIOBJECTS);
+    startup_user_objects = GetGuiResources(GetCurrentProcess(), GR_USEROBJECTS);
+
+    wchar_t szStartup[128];
+    swprintf(szStartup, 128, L"volumeicon: startup %.1f ms, %lu GDI objects, %lu USER objects\n",
+        startup_ms, (unsigned long)startup_gdi_objects, (unsigned long)startup_user_objects);
+
+    OutputDebugString(szStartup);
+    return TRUE;
+}
+
+void StopVolumeIcon()
+{
+    if (vol == NULL)
+        return;
+
+    StopWheelThread();
+
+    if (meter != NULL)
+        StopMeter(hWndIcon);
+
+    wchar_t szCounters[192];
+    swprintf(szCounters, 192, L"volumeicon: %ld volume notifications, %ld icon updates, %ld skipped, %ld writes, %ld echoes dropped\n",
+        vol->GetNotificationCount(), icon_updates, icon_updates_skipped, vol->GetWriteCount(), vol->GetEchoCount());
+
+    OutputDebugString(szCounters);
+
+    notif.uFlags = 0;
+    notify_icon(NIM_DELETE, &notif);
+    icons.Dispose();
+
+    vol->Dispose();
+    vol->Release();
+    vol = NULL;
+    hWndIcon = NULL;
+}
 
-        if (SUCCEEDED(vol->Initialize()))
+int wmain(int argc, wchar_t **argv)
+{
+    const wchar_t *pszStorm = NULL;
+    const wchar_t *pszMeterSim = NULL;
+    BOOL bVerify = FALSE;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (wcscmp(argv[i], L"--trace") == 0 && i + 1 < argc)
+            StartTrace(argv[++i]);
+        else if (wcscmp(argv[i], L"--verify") == 0)
+            bVerify = TRUE;
+        else if (wcscmp(argv[i], L"--storm") == 0 && i + 1 < argc)
+            pszStorm = argv[++i];
+        else if (wcscmp(argv[i], L"--meter") == 0)
+            meter_enabled = TRUE;
+        else if (wcscmp(argv[i], L"--meter-sim") == 0 && i + 1 < argc)
+            pszMeterSim = argv[++i];
+        else if (wcscmp(argv[i], L"--meter-sim-phase") == 0 && i + 1 < argc)
+            meter_sim_phase_ms = std::max(1, _wtoi(argv[++i]));
+        else if (wcscmp(argv[i], L"--storm-load") == 0 && i + 3 < argc)
         {
-            const wchar_t g_szWindowClass[] = L"volumeicon";
-            HINSTANCE hInstance = GetModuleHandle(NULL);
+            storm_config.cNotifications = std::max(1, _wtoi(argv[++i]));
+            storm_config.nMuteEvery = _wtoi(argv[++i]);
+            storm_config.nFlapEvery = _wtoi(argv[++i]);
+        }
+    }
 
-            WNDCLASSEX wcex     = { sizeof(wcex) };
-            wcex.style          = 0;
-            wcex.lpfnWndProc    = WndProc;
-            wcex.hInstance      = hInstance;
-            wcex.hCursor        = LoadCursor(NULL, IDC_ARROW);
-            wcex.hbrBackground  = NULL;
-            wcex.lpszClassName  = g_szWindowClass;
+    if (bVerify)
+        return RunVerify();
 
-            RegisterClassEx(&wcex);
+    if (trace_enabled)
+        SetConsoleCtrlHandler(TraceConsoleHandler, TRUE);
 
-            HWND hWnd = CreateWindowEx(WS_EX_NOACTIVATE, g_szWindowClass, NULL, 0, 0, 0, 0, 0, NULL, NULL, hInstance, NULL);
+    // Otherwise SM_CXSMICON is always 16 and the shell stretches the icon.
+    SetProcessDPIAware();
 
-            if (hWnd)
-            {
-                InitializeIcons();
+    if (pszMeterSim != NULL)
+    {
+        pszStorm = NULL;
+        meter_enabled = TRUE;
+    }
+
+    if (pszStorm != NULL || pszMeterSim != NULL)
+    {
+        storm_audio = new SimAudio();
+        storm_times = new LONGLONG[pszStorm != NULL ? storm_config.cNotifications : 1];
+        notify_icon = RecordNotifyIcon;
+    }
 
-                int level = GetVolumeLevel();
+    HRESULT hr = E_FAIL;
+    int result = 0;
 
-                NOTIFYICONDATA notif = { sizeof(notif) };
-                notif.hWnd = hWnd;
-                notif.uID = 1;
-                notif.uFlags = NIF_ICON | NIF_TIP;
-                notif.uVersion = NOTIFYICON_VERSION_4;
-                notif.hIcon = icons[level];
-                swprintf(notif.szTip, 64, L"Volumen: %d%%", level);
+    {
+        TraceScope scope("CoInitializeEx");
+        hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
+    }
 
-                Shell_NotifyIcon(NIM_ADD, &notif);
-                vol->SetWindow(hWnd);
+    if (SUCCEEDED(hr))
+    {
+        if (StartVolumeIcon(storm_audio))
+        {
+            HANDLE hStorm = NULL;
+            ULONGLONG cpuStart = ProcessCpuTime();
 
-                MSG msg;
+            if (storm_audio != NULL)
+                hStorm = CreateThread(NULL, 0, pszStorm != NULL ? StormThread : MeterSimThread, hWndIcon, 0, NULL);
 
-                while (GetMessage(&msg, NULL, 0, 0))
-                {
-                    TranslateMessage(&msg);
-                    DispatchMessage(&msg);
-                }
+            MSG msg;
 
-                notif.uFlags = 0;
-                Shell_NotifyIcon(NIM_DELETE, &notif);
+            while (GetMessage(&msg, NULL, 0, 0))
+            {
+                TranslateMessage(&msg);
+                DispatchMessage(&msg);
             }
 
-            vol->Dispose();
-            vol->Release();
+            if (hStorm != NULL)
+            {
+                ULONGLONG cpu = ProcessCpuTime() - cpuStart;
+
+                WaitForSingleObject(hStorm, INFINITE);
+                CloseHandle(hStorm);
+
+                if (pszStorm != NULL)
+                    result = WriteStormResults(pszStorm, cpu, storm_audio->GetDefaultVolume()->GetLevel());
+            }
         }
 
+        StopVolumeIcon();
+
+        if (pszMeterSim != NULL)
+            result = WriteMeterResults(pszMeterSim);
         CoUninitialize();
     }
 
-    return 0;
+    WriteTrace();
+    return result;
 }
 
+#ifdef _WIN32
 int main()
 {
     int argc = 0;
@@ -426,3 +3057,20 @@ int main()
 
     return wmain(argc, argv);
 }
+#else
+// Without a tray only the simulated backend (--storm) and --verify are of
+// use here; the arguments come in as UTF-8.
+int main(int argc, char **argv)
+{
+    std::vector<std::wstring> args(argc);
+    std::vector<wchar_t*> pointers(argc + 1);
+
+    for (int i = 0; i < argc; i++)
+    {
+        args[i] = compat_widen(argv[i]);
+        pointers[i] = &args[i][0];
+    }
+
+    return wmain(argc, pointers.data());
+}
+#endif